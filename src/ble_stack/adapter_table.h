@@ -0,0 +1,71 @@
+#ifndef ADAPTER_TABLE_H
+#define ADAPTER_TABLE_H
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Usable Bluetooth adapters by name ("hci0"), with their object path and the handle that reaches them
+    adapters outside the allow list are never taken in, an empty list allows all of them.
+    An adapter whose object BlueZ removes (a dongle pulled out) is dropped, so no connect is routed
+    to a controller that is gone; it comes back through add() when BlueZ announces it again.
+*/
+template <typename Handle>
+class AdapterTable {
+public:
+
+    struct Adapter
+    {
+        std::string Path;
+        Handle Proxy;
+    };
+
+    using Map = std::map<std::string,Adapter>;
+
+    explicit AdapterTable(const std::vector<std::string>& allowed = {})
+        : allowed(allowed)
+    {
+    }
+
+    // "/org/bluez/hci1" -> "hci1"
+    static std::string name_of(const std::string& adapter_path)
+    {
+        return adapter_path.substr(adapter_path.rfind('/') + 1);
+    }
+
+    bool allows(const std::string& name) const
+    {
+        return allowed.empty() || std::find(allowed.begin(), allowed.end(), name) != allowed.end();
+    }
+
+    // replaces an adapter of the same name, e.g. one that was plugged in again
+    void add(const std::string& adapter_path, Handle proxy)
+    {
+        adapters[name_of(adapter_path)] = Adapter{adapter_path, proxy};
+    }
+
+    // false if the object is not one of the adapters, e.g. a device below one
+    bool remove(const std::string& object_path)
+    {
+        auto it = adapters.find(name_of(object_path));
+        if (it == adapters.end() || it->second.Path != object_path)
+        {
+            return false;
+        }
+        adapters.erase(it);
+        return true;
+    }
+
+    typename Map::const_iterator find(const std::string& name) const { return adapters.find(name); }
+    typename Map::const_iterator begin() const { return adapters.begin(); }
+    typename Map::const_iterator end() const { return adapters.end(); }
+    bool empty() const { return adapters.empty(); }
+    size_t size() const { return adapters.size(); }
+
+private:
+    std::vector<std::string> allowed;   // empty: all
+    Map adapters;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef BLE_AWAIT_H
+#define BLE_AWAIT_H
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bluezproxy.h"
+#include "task.h"
+
+namespace BleTask {
+
+// context of the calling thread, the BLE thread's own context when it runs threaded
+inline Glib::RefPtr<Glib::MainContext> thread_context()
+{
+    return Glib::wrap(g_main_context_ref_thread_default(), false);
+}
+
+/* Responsibilities:
+    suspend a coroutine on a callback based asynchronous call
+    resume it on the GLib loop with the result, or with the fallback value
+    when the call could not be submitted, timed out or was cancelled
+   A completion arriving after a timeout, or after the awaiting coroutine was
+   destroyed, is dropped.
+*/
+template<typename T>
+class Completion
+{
+    public:
+
+        // submits the call with a completion callback, false if nothing was submitted
+        using Submit = std::function<bool(std::function<void(T)>)>;
+
+        Completion(Submit submit, T fallback, unsigned int timeout_ms, CancelToken cancel)
+            : submit(std::move(submit)), fallback(std::move(fallback)), timeout_ms(timeout_ms), cancel(std::move(cancel)) {}
+
+        Completion(const Completion&) = delete;
+        Completion& operator=(const Completion&) = delete;
+
+        ~Completion()
+        {
+            if (state)
+            {
+                state->detach(cancel);
+            }
+        }
+
+        bool await_ready() const { return cancel.cancelled(); }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            state = std::make_shared<State>();
+            state->context = thread_context();
+
+            auto submitted = false;
+            try
+            {
+                submitted = submit([state = state](T result) { state->finish(std::move(result)); });
+            }
+            catch (...)
+            {
+            }
+
+            if (!submitted || state->result)
+            {
+                // nothing to wait for, continue right away
+                return false;
+            }
+
+            state->handle = handle;
+            if (timeout_ms > 0)
+            {
+                state->timer = state->context->signal_timeout().connect([state = state]() { state->finish(std::nullopt); return false; }, timeout_ms);
+            }
+            // resume from the loop, not from inside whoever cancels
+            state->cancel_id = cancel.on_cancel([state = state]() {
+                state->context->signal_idle().connect_once([state]() { state->finish(std::nullopt); });
+            });
+            return true;
+        }
+
+        T await_resume()
+        {
+            if (state && state->result && *state->result)
+            {
+                return std::move(**state->result);
+            }
+            return std::move(fallback);
+        }
+
+    protected:
+
+        struct State : std::enable_shared_from_this<State>
+        {
+            std::coroutine_handle<> handle;
+            std::optional<std::optional<T>> result;
+            Glib::RefPtr<Glib::MainContext> context;
+            sigc::connection timer;
+            uint64_t cancel_id = 0;
+
+            void finish(std::optional<T> outcome)
+            {
+                if (result)
+                {
+                    return;
+                }
+                auto self = this->shared_from_this();
+                result = std::move(outcome);
+                timer.disconnect();
+                if (handle)
+                {
+                    std::exchange(handle, nullptr).resume();
+                }
+            }
+
+            void detach(CancelToken& cancel)
+            {
+                handle = nullptr;
+                timer.disconnect();
+                cancel.forget(cancel_id);
+            }
+        };
+
+        Submit submit;
+        T fallback;
+        unsigned int timeout_ms;
+        CancelToken cancel;
+        std::shared_ptr<State> state;
+};
+
+// resumes with true once the delay has passed, false if cancelled
+inline Completion<bool> sleep(unsigned int delay_ms, CancelToken cancel)
+{
+    return Completion<bool>([delay_ms](std::function<void(bool)> done) {
+                                thread_context()->signal_timeout().connect_once([done]() { done(true); }, delay_ms);
+                                return true;
+                            },
+                            false, 0, cancel);
+}
+
+// Device1.Connect, true once connected
+inline Completion<bool> connect(BlueZProxy& ble, const std::string& address, unsigned int timeout_ms, CancelToken cancel)
+{
+    return Completion<bool>([&ble,address](std::function<void(bool)> done) { return ble.connect_async(address, done); },
+                            false, timeout_ms, cancel);
+}
+
+// GattCharacteristic1.WriteValue with response, true once acknowledged
+inline Completion<bool> write(BlueZProxy& ble, const std::string& address, const std::string& char_uuid,
+                              const std::vector<uint8_t>& payload, unsigned int timeout_ms, CancelToken cancel)
+{
+    return Completion<bool>([&ble,address,char_uuid,payload](std::function<void(bool)> done) {
+                                return ble.write_async(address, char_uuid, payload, done);
+                            },
+                            false, timeout_ms, cancel);
+}
+
+// GattCharacteristic1.ReadValue, empty unless the read succeeded
+inline Completion<std::optional<std::vector<uint8_t>>> read(BlueZProxy& ble, const std::string& address, const std::string& char_uuid,
+                                                             unsigned int timeout_ms, CancelToken cancel)
+{
+    using Value = std::optional<std::vector<uint8_t>>;
+    return Completion<Value>([&ble,address,char_uuid](std::function<void(Value)> done) {
+                                 return ble.read_async(address, char_uuid, [done](bool success, const std::vector<uint8_t>& value) {
+                                     done(success ? Value(value) : std::nullopt);
+                                 });
+                             },
+                             std::nullopt, timeout_ms, cancel);
+}
+
+// GattCharacteristic1.StartNotify, subscription receives the handle, true once BlueZ notifies
+inline Completion<bool> start_notify(BlueZProxy& ble, const std::string& address, const std::string& char_uuid,
+                                     sigc::slot<void,const uint8_t*,size_t> handler, BlueZProxy::Subscription& subscription,
+                                     unsigned int timeout_ms, CancelToken cancel)
+{
+    // the subscription is assigned while submitting, before the awaiting coroutine suspends
+    return Completion<bool>([&ble,address,char_uuid,handler,&subscription](std::function<void(bool)> done) {
+                                subscription = ble.start_notify_async(address, char_uuid, handler, done);
+                                return static_cast<bool>(subscription);
+                            },
+                            false, timeout_ms, cancel);
+}
+
+} // namespace BleTask
+
+#endif
@@ -0,0 +1,261 @@
+#include "ble_thread.h"
+#include "telink_mesh.h"
+#include <future>
+#include <glib.h>
+#include "../logging/metrics.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "BleThread"
+
+// packets handed to the BLE thread and not yet picked up, all meshes together
+static auto& tx_queue_depth = Metrics::instance().gauge("meshgateway_tx_queue_depth",
+                                    "Mesh packets queued for the BLE thread");
+
+BleThread::BleThread(const std::vector<std::string>& adapters, const std::string& bus_address)
+    : context(Glib::MainContext::create()),
+      loop(Glib::MainLoop::create(context))
+{
+    thread = std::thread([this]() {
+        // BlueZProxy subscribes signals and Gio delivers async results on the thread default context
+        g_main_context_push_thread_default(context->gobj());
+        loop->run();
+        g_main_context_pop_thread_default(context->gobj());
+    });
+
+    try
+    {
+        invoke_raw([this,adapters,bus_address]() { ble = std::make_unique<BlueZProxy>(adapters, bus_address); });
+        g_message("BLE thread started");
+    }
+    catch (...)
+    {
+        loop->quit();
+        thread.join();
+        throw;
+    }
+}
+
+BleThread::~BleThread()
+{
+    try
+    {
+        invoke_raw([this]() { ble.reset(); });
+    }
+    catch (const std::exception& e)
+    {
+        g_warning("Error while stopping BLE thread: %s",e.what());
+    }
+    loop->quit();
+    thread.join();
+}
+
+void BleThread::invoke(std::function<void(BlueZProxy&)> fn)
+{
+    invoke_raw([this,fn]() { fn(*ble); });
+}
+
+void BleThread::invoke_raw(std::function<void()> fn)
+{
+    std::promise<void> done;
+    context->signal_idle().connect_once([&done,fn]() {
+        try
+        {
+            fn();
+            done.set_value();
+        }
+        catch (...)
+        {
+            done.set_exception(std::current_exception());
+        }
+    });
+    done.get_future().get();
+}
+
+ThreadedMesh::ThreadedMesh(BleThread& thread,
+                           const std::string& mesh_name,
+                           const std::string& mesh_password,
+                           const uint16_t& vendor_code,
+                           size_t pool_size,
+                           const std::string& state_file,
+                           int16_t rssi_threshold,
+                           PacketCapture* capture)
+    : thread(thread), channel(std::make_shared<Channel>())
+{
+    channel->ble_context = thread.getContext();
+    channel->gateway_context = Glib::wrap(g_main_context_ref_thread_default(), false);
+
+    auto ch = channel.get();
+    thread.invoke([=](BlueZProxy& ble) {
+        ch->mesh = std::make_unique<TelinkMesh>(ble, mesh_name, mesh_password, vendor_code, pool_size, state_file, rssi_threshold, capture);
+        ch->mesh->setRxCallback(sigc::mem_fun(*ch,&Channel::on_packet_rx));
+
+        // isReady on the gateway thread reads this flag, refresh it as links come and go
+        ch->readyPoll = ch->ble_context->signal_timeout().connect([ch]() {
+            ch->ready = ch->mesh->hasConnection();
+            return true;
+        }, 250);
+    });
+}
+
+ThreadedMesh::~ThreadedMesh()
+{
+    auto ch = channel.get();
+    try
+    {
+        // the mesh lives and dies on the BLE thread
+        thread.invoke([ch](BlueZProxy&) {
+            ch->closed = true;
+            ch->readyPoll.disconnect();
+            ch->mesh.reset();
+        });
+    }
+    catch (const std::exception& e)
+    {
+        g_warning("Error while stopping mesh: %s",e.what());
+    }
+}
+
+void ThreadedMesh::setRxCallback(sigc::slot<void,PacketPtr> rxCallback)
+{
+    channel->sigPacketRx.connect(rxCallback);
+}
+
+bool ThreadedMesh::isReady()
+{
+    if (channel->ready)
+    {
+        return true;
+    }
+    // let the BLE thread start discovery
+    channel->kick();
+    return false;
+}
+
+void ThreadedMesh::onReady(std::function<void()> callback)
+{
+    channel->ready_callback = callback;
+
+    auto ch = channel->shared_from_this();
+    channel->ble_context->signal_idle().connect_once([ch]() {
+        if (ch->closed || !ch->mesh)
+        {
+            return;
+        }
+        if (ch->mesh->hasConnection())
+        {
+            // became ready while this was in flight
+            ch->on_mesh_ready();
+        }
+        else
+        {
+            ch->mesh->onReady([ch]() { ch->on_mesh_ready(); });
+        }
+    });
+}
+
+void ThreadedMesh::send(const PacketPtr packet)
+{
+    if (!channel->ready)
+    {
+        channel->kick();
+        throw std::runtime_error("Send failed, mesh not connected");
+    }
+    if (!channel->tx_queue.push(packet))
+    {
+        throw std::runtime_error("Send failed, BLE queue full");
+    }
+    tx_queue_depth++;
+
+    // one wakeup per batch, cleared by the BLE thread before it drains
+    if (!channel->tx_wakeup.exchange(true))
+    {
+        auto ch = channel->shared_from_this();
+        channel->ble_context->signal_idle().connect_once([ch]() { ch->drain_tx(); });
+    }
+}
+
+void ThreadedMesh::Channel::drain_tx()
+{
+    tx_wakeup = false;
+    PacketPtr packet;
+    while (tx_queue.pop(packet))
+    {
+        tx_queue_depth--;
+        if (closed || !mesh)
+        {
+            continue;
+        }
+        try
+        {
+            mesh->send(packet);
+        }
+        catch (const std::exception& e)
+        {
+            g_warning("Dropping packet: %s",e.what());
+        }
+    }
+    if (mesh)
+    {
+        ready = mesh->hasConnection();
+    }
+}
+
+void ThreadedMesh::Channel::on_packet_rx(PacketPtr packet)
+{
+    if (!rx_queue.push(packet))
+    {
+        rx_dropped++;
+        g_warning("Gateway is not keeping up, dropped %u mesh packets",rx_dropped.load());
+        return;
+    }
+
+    if (!rx_wakeup.exchange(true))
+    {
+        auto ch = shared_from_this();
+        gateway_context->signal_idle().connect_once([ch]() { ch->drain_rx(); });
+    }
+}
+
+void ThreadedMesh::Channel::drain_rx()
+{
+    rx_wakeup = false;
+    PacketPtr packet;
+    while (rx_queue.pop(packet))
+    {
+        if (!closed)
+        {
+            sigPacketRx.emit(packet);
+        }
+    }
+}
+
+void ThreadedMesh::Channel::on_mesh_ready()
+{
+    ready = true;
+    auto ch = shared_from_this();
+    gateway_context->signal_idle().connect_once([ch]() {
+        if (!ch->closed && ch->ready_callback)
+        {
+            auto callback = ch->ready_callback;
+            ch->ready_callback = nullptr;
+            callback();
+        }
+    });
+}
+
+void ThreadedMesh::Channel::kick()
+{
+    if (kick_pending.exchange(true))
+    {
+        return;
+    }
+    auto ch = shared_from_this();
+    ble_context->signal_idle().connect_once([ch]() {
+        ch->kick_pending = false;
+        if (!ch->closed && ch->mesh)
+        {
+            // starts discovery when there is no connection
+            ch->ready = ch->mesh->isReady();
+        }
+    });
+}
@@ -0,0 +1,107 @@
+#ifndef BLE_THREAD_H
+#define BLE_THREAD_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <glibmm/main.h>
+
+#include "bluezproxy.h"
+#include "mesh_link.h"
+#include "spsc_queue.h"
+
+class TelinkMesh;
+class PacketCapture;
+
+/* Responsibilities:
+    run BlueZ and all mesh connections on a dedicated thread with its own GMainContext,
+    so a stalled D-Bus call never holds up MQTT handling on the main loop
+*/
+class BleThread {
+public:
+
+    explicit BleThread(const std::vector<std::string>& adapters = {}, const std::string& bus_address = "");
+    ~BleThread();
+
+    BleThread(const BleThread&) = delete;
+    BleThread& operator=(const BleThread&) = delete;
+
+    // runs fn on the BLE thread and waits for it, exceptions are rethrown to the caller.
+    // Must not be called from the BLE thread itself.
+    void invoke(std::function<void(BlueZProxy&)> fn);
+
+    Glib::RefPtr<Glib::MainContext> getContext() const { return context; }
+
+protected:
+
+    void invoke_raw(std::function<void()> fn);
+
+    Glib::RefPtr<Glib::MainContext> context;
+    Glib::RefPtr<Glib::MainLoop> loop;
+    std::unique_ptr<BlueZProxy> ble; // created, used and destroyed on the BLE thread only
+    std::thread thread;
+};
+
+/* Responsibilities:
+    a TelinkMesh living on the BLE thread, used from the gateway thread.
+    Packets cross threads through lock free SPSC queues, rare control calls are posted as idle callbacks.
+*/
+class ThreadedMesh : public MeshLink {
+public:
+
+    ThreadedMesh(BleThread& thread,
+                 const std::string& mesh_name,
+                 const std::string& mesh_password,
+                 const uint16_t& vendor_code,
+                 size_t pool_size = 1,
+                 const std::string& state_file = "",
+                 int16_t rssi_threshold = -70,
+                 PacketCapture* capture = nullptr);
+    ~ThreadedMesh();
+
+    void setRxCallback(sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback) override;
+    bool isReady() override;
+    void onReady(std::function<void()> callback) override;
+    void send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet) override;
+
+protected:
+
+    using PacketPtr = std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>;
+
+    // shared with every callback posted across threads, so none of them can outlive it
+    struct Channel : public std::enable_shared_from_this<Channel>
+    {
+        Glib::RefPtr<Glib::MainContext> ble_context;
+        Glib::RefPtr<Glib::MainContext> gateway_context;
+
+        SpscQueue<PacketPtr,256> tx_queue;   // gateway -> BLE thread
+        SpscQueue<PacketPtr,256> rx_queue;   // BLE thread -> gateway
+
+        std::atomic<bool> ready{false};
+        std::atomic<bool> closed{false};
+        std::atomic<bool> tx_wakeup{false};
+        std::atomic<bool> rx_wakeup{false};
+        std::atomic<bool> kick_pending{false};
+        std::atomic<uint32_t> rx_dropped{0};
+
+        // BLE thread only
+        std::unique_ptr<TelinkMesh> mesh;
+        sigc::connection readyPoll;
+
+        // gateway thread only
+        std::function<void()> ready_callback;
+        sigc::signal<void,PacketPtr> sigPacketRx;
+
+        void drain_tx();
+        void drain_rx();
+        void on_packet_rx(PacketPtr packet);
+        void on_mesh_ready();
+        void kick();
+    };
+
+    BleThread& thread;
+    std::shared_ptr<Channel> channel;
+};
+
+#endif
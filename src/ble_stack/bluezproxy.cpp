@@ -3,11 +3,51 @@
 #include <giomm/dbusproxy.h>
 #include <giomm/dbusconnection.h>
 #include <glib.h>
+#include "../logging/log.h"
+#include "../logging/metrics.h"
+#include <algorithm>
+#include <array>
+#include <limits>
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "BluezProxy"
+
+namespace
+{
+    // the D-Bus methods with a latency histogram
+    enum class DBusMethod { GetManagedObjects, GetAll, StartDiscovery, StopDiscovery, SetDiscoveryFilter,
+                            Connect, Disconnect, WriteValue, ReadValue, StartNotify, Count };
+
+    // round trip per D-Bus method, for the metrics endpoint - resolved once, recording is lock free
+    LatencyHistogram& dbus_latency(DBusMethod method)
+    {
+        static const auto histograms = []() {
+            static const char* const names[] = {"GetManagedObjects", "GetAll", "StartDiscovery", "StopDiscovery",
+                                                "SetDiscoveryFilter", "Connect", "Disconnect", "WriteValue",
+                                                "ReadValue", "StartNotify"};
+            static_assert(std::size(names) == static_cast<size_t>(DBusMethod::Count), "one name per method");
+            std::array<LatencyHistogram*, static_cast<size_t>(DBusMethod::Count)> histograms{};
+            for (size_t i = 0; i < histograms.size(); i++)
+            {
+                histograms[i] = &Metrics::instance().histogram("meshgateway_dbus_call_seconds", "BlueZ D-Bus method call latency",
+                                                               "method", names[i]);
+            }
+            return histograms;
+        }();
+        return *histograms[static_cast<size_t>(method)];
+    }
+
+    // failed calls count as well, a timeout is the slowest call of all
+    template<typename Call>
+    auto timed_call(DBusMethod method, Call&& call)
+    {
+        Metrics::Timer timer(dbus_latency(method));
+        return call();
+    }
+}
 #define G_LOG_USE_STRUCTURED 1
-BlueZProxy::BlueZProxy()
+BlueZProxy::BlueZProxy(const std::vector<std::string>& adapters, const std::string& bus_address)
+    : bus_address(bus_address), adapters(adapters)
     {
     setup_dbus_proxy();
 }
@@ -17,117 +57,495 @@ BlueZProxy::~BlueZProxy() {
 }
 
 void BlueZProxy::setup_dbus_proxy() {
-    connection = Gio::DBus::Connection::get_sync(Gio::DBus::BUS_TYPE_SYSTEM);
+    if (bus_address.empty()) {
+        connection = Gio::DBus::Connection::get_sync(Gio::DBus::BUS_TYPE_SYSTEM);
+    } else if (bus_address == "session") {
+        connection = Gio::DBus::Connection::get_sync(Gio::DBus::BUS_TYPE_SESSION);
+    } else {
+        // a private bus, e.g. the one the mesh emulator serves on
+        connection = Gio::DBus::Connection::create_for_address_sync(bus_address,
+                        Gio::DBus::CONNECTION_FLAGS_AUTHENTICATION_CLIENT | Gio::DBus::CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION);
+    }
     if (!connection) {
-        throw std::runtime_error("Failed to connect to the system D-Bus.");
+        throw std::runtime_error("Failed to connect to the D-Bus.");
+    }
+
+    // keep the object mirror current from signal payloads
+    connection->signal_subscribe(
+        sigc::mem_fun(this, &BlueZProxy::on_interfaces_added),
+        "org.bluez",
+        "org.freedesktop.DBus.ObjectManager",
+        "InterfacesAdded",
+        {},
+        {}
+    );
+    connection->signal_subscribe(
+        sigc::mem_fun(this, &BlueZProxy::on_interfaces_removed),
+        "org.bluez",
+        "org.freedesktop.DBus.ObjectManager",
+        "InterfacesRemoved",
+        {},
+        {}
+    );
+    connection->signal_subscribe(
+        sigc::mem_fun(this, &BlueZProxy::on_device_properties_changed),
+        "org.bluez",
+        "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        {},
+        "org.bluez.Device1"  // arg0: only Device1 property changes
+    );
+
+    // also enumerates the adapters
+    seed_object_mirror();
+
+    if (adapters.empty()) {
+        throw std::runtime_error("No usable Bluetooth adapter found.");
+    }
+}
+
+void BlueZProxy::add_adapter(const std::string& adapter_path)
+{
+    auto name = adapters.name_of(adapter_path);
+    if (!adapters.allows(name)) {
+        LOG_DEBUG("Ignoring adapter %s",name.c_str());
+        return;
     }
 
     // Create a proxy for the BlueZ adapter interface
-    adapter_proxy_ = Gio::DBus::Proxy::create_sync(
+    auto proxy = Gio::DBus::Proxy::create_sync(
         connection,
         "org.bluez",         // BlueZ service name
-        "/org/bluez/hci0",   // Default adapter path
+        adapter_path,        // Adapter path
         "org.bluez.Adapter1" // BlueZ Adapter interface
     );
-    
+    adapters.add(adapter_path, proxy);
+    g_message("Using Bluetooth adapter %s",name.c_str());
 }
 
-void BlueZProxy::start_scan(sigc::slot<void,const std::string, const std::string> callback)
-{    
-    
+std::vector<std::string> BlueZProxy::get_adapters() const
+{
+    std::vector<std::string> names;
+    for (const auto& [name, adapter] : adapters) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+std::string BlueZProxy::adapter_of(const std::string& object_path)
+{
+    // /org/bluez/<adapter>/dev_XX_XX_XX_XX_XX_XX/...
+    static const std::string prefix = "/org/bluez/";
+    if (object_path.compare(0, prefix.size(), prefix) != 0) {
+        return std::string();
+    }
+    auto end = object_path.find('/', prefix.size());
+    return object_path.substr(prefix.size(), end == std::string::npos ? std::string::npos : end - prefix.size());
+}
+
+size_t BlueZProxy::connections_on(const std::string& adapter) const
+{
+    size_t count = 0;
+    for (const auto& [address, path] : bound_paths) {
+        if (adapter_of(path) == adapter) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void BlueZProxy::seed_object_mirror()
+{
     try {
-        // Listen for DeviceAdded signals (new devices discovered) before starting the scan
-       connection->signal_subscribe(
-            sigc::mem_fun(this, &BlueZProxy::on_interfaces_added), // Slot for the callback
-            "org.bluez",         // Sender name (can be empty if not filtering by sender)
-            "org.freedesktop.DBus.ObjectManager", // Interface name
-            "InterfacesAdded",   // Signal member (signal name)
-            {},        // Object path (can be empty if not filtering by path)
-            {}                  // First argument to filter by (optional, typically empty)            
+        auto om_proxy = Gio::DBus::Proxy::create_sync(
+            connection,
+            "org.bluez",
+            "/",
+            "org.freedesktop.DBus.ObjectManager"
         );
-        
-        auto result = adapter_proxy_->call_sync("StartDiscovery", Glib::VariantContainerBase());
+        auto result = timed_call(DBusMethod::GetManagedObjects, [&]() { return om_proxy->call_sync("GetManagedObjects"); });
 
-        // Handle the returned value if any
-        if (!result.gobj()) { // Check if the result is empty
-            g_warning("No response received from StartDiscovery call.");
-        } else {
-            g_message("Started scanning for devices successfully.");
+        auto objects = Glib::VariantBase::cast_dynamic<
+                                Glib::Variant<
+                                std::map<Glib::DBusObjectPathString,
+                                    std::map<Glib::ustring,
+                                        std::map<Glib::ustring,
+                                                Glib::VariantBase>>>>>
+                            (result.get_child(0));
+
+        for (const auto& [object_path, interfaces] : objects.get()) {
+            add_interfaces(object_path, interfaces);
         }
+        LOG_DEBUG("Object mirror seeded with %zu devices, %zu characteristics", devices.size(), characteristics.size());
+    } catch (const Glib::Error& e) {
+        g_warning("Error while reading BlueZ devices: %s", e.what().c_str());
+    }
+}
 
-        sigDeviceFound.connect(callback);
+void BlueZProxy::add_interfaces(const Glib::ustring& object_path,
+                                const std::map<Glib::ustring, std::map<Glib::ustring, Glib::VariantBase>>& interfaces)
+{
+    if (interfaces.find("org.bluez.Adapter1") != interfaces.end()) {
+        // at startup or when a dongle is plugged in
+        add_adapter(object_path);
+    }
 
-    } catch (const Glib::Error& e) {
-        g_warning("Error starting device discovery: %s",e.what().c_str());
+    auto device_it = interfaces.find("org.bluez.Device1");
+    if (device_it != interfaces.end()) {
+        update_device(object_path, device_it->second);
     }
 
+    auto char_it = interfaces.find("org.bluez.GattCharacteristic1");
+    if (char_it != interfaces.end()) {
+        auto uuid_it = char_it->second.find("UUID");
+        if (uuid_it != char_it->second.end()) {
+            // characteristics live below their device: <device>/serviceXXXX/charYYYY
+            std::string device_path = object_path.raw().substr(0, object_path.raw().rfind("/service"));
+            auto uuid = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(uuid_it->second).get();
+
+            characteristics[object_path] = Characteristic{device_path, uuid};
+            char_index[device_path + "|" + uuid.raw()] = object_path;
+        }
+    }
 }
 
-void BlueZProxy::start_rssi_scan(sigc::slot<void,std::shared_ptr<Device>> callback)
+void BlueZProxy::remove_object(const std::string& object_path)
+{
+    if (adapters.remove(object_path)) {
+        g_warning("Bluetooth adapter %s was removed",adapter_of(object_path).c_str());
+    }
+
+    auto device_it = devices.find(object_path);
+    if (device_it != devices.end()) {
+        unindex_device(object_path, *device_it->second);
+        devices.erase(device_it);
+    }
+
+    auto char_it = characteristics.find(object_path);
+    if (char_it != characteristics.end()) {
+        char_index.erase(char_it->second.DevicePath + "|" + char_it->second.UUID);
+        characteristics.erase(char_it);
+    }
+    char_proxies.erase(object_path);
+
+    auto notify_it = notify_subscriptions.find(object_path);
+    if (notify_it != notify_subscriptions.end()) {
+        // the characteristic is gone, so is its subscription
+        connection->signal_unsubscribe(notify_it->second.dbus_id);
+        notify_subscriptions.erase(notify_it);
+    }
+}
+
+std::shared_ptr<BlueZProxy::Device> BlueZProxy::update_device(const Glib::ustring& object_path,
+                                                              const std::map<Glib::ustring, Glib::VariantBase>& properties)
+{
+    auto& device = devices[object_path];
+    if (!device) {
+        device = std::make_shared<Device>();
+        device->Adapter = adapter_of(object_path);
+    }
+
+    if (properties.find("Name") == properties.end() && properties.find("Address") == properties.end()) {
+        // the common case: RSSI/Connected updates leave the indexes alone
+        apply_device_properties(*device, properties);
+        return device;
+    }
+
+    unindex_device(object_path, *device);
+    apply_device_properties(*device, properties);
+    address_index.emplace(device->Address, object_path);
+    name_index.emplace(device->Name, object_path);
+    return device;
+}
+
+void BlueZProxy::unindex_device(const std::string& object_path, const Device& device)
+{
+    auto address_range = address_index.equal_range(device.Address);
+    for (auto it = address_range.first; it != address_range.second; ++it) {
+        if (it->second == object_path) {
+            address_index.erase(it);
+            break;
+        }
+    }
+
+    auto range = name_index.equal_range(device.Name);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == object_path) {
+            name_index.erase(it);
+            break;
+        }
+    }
+}
+
+void BlueZProxy::start_scan(sigc::slot<void,const std::string, const std::string> callback)
 {    
     
-    try {
-        // Listen for DeviceAdded signals (new devices discovered) before starting the scan
-       connection->signal_subscribe(
-            sigc::mem_fun(this, &BlueZProxy::on_device_properties_changed), // Slot for the callback
-            "org.bluez",         // Sender name (can be empty if not filtering by sender)
-            "org.freedesktop.DBus.Properties", // Interface name
-            "PropertiesChanged",   // Signal member (signal name)
-            {},        // Object path (can be empty if not filtering by path)
-            {}                  // First argument to filter by (optional, typically empty)            
-        );
+    // InterfacesAdded is subscribed for the object mirror already
+    sigDeviceFound.connect(callback);
+
+    for (const auto& [name, adapter] : adapters) {
+        try {
+            auto result = timed_call(DBusMethod::StartDiscovery, [&]() { return adapter.Proxy->call_sync("StartDiscovery", Glib::VariantContainerBase()); });
+
+            // Handle the returned value if any
+            if (!result.gobj()) { // Check if the result is empty
+                g_warning("No response received from StartDiscovery call on %s.",name.c_str());
+            } else {
+                g_message("Started scanning for devices on %s successfully.",name.c_str());
+            }
+        } catch (const Glib::Error& e) {
+            g_warning("Error starting device discovery on %s: %s",name.c_str(),e.what().c_str());
+        }
+    }
 
-        sigDeviceFoundByRSSI.connect(callback);
-        
-        auto result = adapter_proxy_->call_sync("StartDiscovery", Glib::VariantContainerBase());
+}
+
+BlueZProxy::ScanHandle BlueZProxy::start_rssi_scan(sigc::slot<void,std::shared_ptr<Device>> callback, const DiscoveryFilter& filter)
+{    
+    bool already_scanning = !active_scans.empty();
+
+    // Device1 property changes (RSSI updates) are subscribed for the object mirror already
+    auto handle = next_scan_handle++;
+    active_scans[handle] = ActiveScan{sigDeviceFoundByRSSI.connect(callback), filter};
 
-        // Handle the returned value if any
-        if (!result.gobj()) { // Check if the result is empty
-            g_warning("No response received from StartDiscovery call.");
+    // one filter per D-Bus client, so concurrent scans share a merged one
+    std::vector<DiscoveryFilter> filters;
+    for (const auto& [id, scan] : active_scans) {
+        filters.push_back(scan.filter);
+    }
+    set_discovery_filter(merge_filters(filters));
+
+    if (already_scanning) {
+        return handle;
+    }
+
+    for (const auto& [name, adapter] : adapters) {
+        try {
+            auto result = timed_call(DBusMethod::StartDiscovery, [&]() { return adapter.Proxy->call_sync("StartDiscovery", Glib::VariantContainerBase()); });
+
+            // Handle the returned value if any
+            if (!result.gobj()) { // Check if the result is empty
+                g_warning("No response received from StartDiscovery call on %s.",name.c_str());
+            } else {
+                g_message("Started scanning for devices on %s successfully.",name.c_str());
+            }        
+        } catch (const Glib::Error& e) {
+            g_warning("Error starting device discovery on %s: %s",name.c_str(),e.what().c_str());   
+        }
+    }
+
+    return handle;
+}
+
+void BlueZProxy::stop_scan(ScanHandle scan)
+{
+    auto it = active_scans.find(scan);
+    if (it == active_scans.end()) {
+        return;
+    }
+    it->second.callback.disconnect();
+    active_scans.erase(it);
+
+    if (active_scans.empty() && sigDeviceFound.empty()) {
+        stop_discovery();
+        return;
+    }
+
+    // narrow the filter again for the remaining scans
+    std::vector<DiscoveryFilter> filters;
+    for (const auto& [id, remaining] : active_scans) {
+        filters.push_back(remaining.filter);
+    }
+    if (!filters.empty()) {
+        set_discovery_filter(merge_filters(filters));
+    }
+}
+
+BlueZProxy::DiscoveryFilter BlueZProxy::merge_filters(const std::vector<DiscoveryFilter>& filters)
+{
+    if (filters.size() == 1) {
+        return filters.front();
+    }
+
+    // the loosest filter that still lets every scan see its devices
+    DiscoveryFilter merged = filters.front();
+    merged.DuplicateData = false;
+    for (const auto& filter : filters) {
+        if (filter.Transport != merged.Transport) {
+            merged.Transport = "auto";
+        }
+        if (!filter.RSSI || !merged.RSSI) {
+            merged.RSSI.reset();
         } else {
-            g_message("Started scanning for devices successfully.");
-        }        
+            merged.RSSI = std::min(*merged.RSSI, *filter.RSSI);
+        }
+        if (filter.Pattern != merged.Pattern) {
+            merged.Pattern.clear();
+        }
+        if (filter.UUIDs.empty() || merged.UUIDs.empty()) {
+            merged.UUIDs.clear();
+        } else {
+            for (const auto& uuid : filter.UUIDs) {
+                if (std::find(merged.UUIDs.begin(), merged.UUIDs.end(), uuid) == merged.UUIDs.end()) {
+                    merged.UUIDs.push_back(uuid);
+                }
+            }
+        }
+        merged.DuplicateData = merged.DuplicateData || filter.DuplicateData;
+    }
+    return merged;
+}
 
-    } catch (const Glib::Error& e) {
-        g_warning("Error starting device discovery: %s",e.what().c_str());   
+void BlueZProxy::set_discovery_filter(const DiscoveryFilter& filter)
+{
+    std::map<Glib::ustring, Glib::VariantBase> options;
+    if (!filter.Transport.empty())
+    {
+        options["Transport"] = Glib::Variant<Glib::ustring>::create(filter.Transport);
+    }
+    if (filter.RSSI)
+    {
+        options["RSSI"] = Glib::Variant<int16_t>::create(*filter.RSSI);
+    }
+    if (!filter.UUIDs.empty())
+    {
+        options["UUIDs"] = Glib::Variant<std::vector<Glib::ustring>>::create(std::vector<Glib::ustring>(filter.UUIDs.begin(),filter.UUIDs.end()));
+    }
+    options["DuplicateData"] = Glib::Variant<bool>::create(filter.DuplicateData);
+    if (!filter.Pattern.empty())
+    {
+        options["Pattern"] = Glib::Variant<Glib::ustring>::create(filter.Pattern);
     }
 
+    for (const auto& [name, adapter] : adapters) {
+        auto adapter_options = options;
+        try {
+            timed_call(DBusMethod::SetDiscoveryFilter, [&]() {
+                return adapter.Proxy->call_sync("SetDiscoveryFilter",
+                                                Glib::VariantContainerBase::create_tuple(Glib::Variant<std::map<Glib::ustring, Glib::VariantBase>>::create(adapter_options)));
+            });
+        } catch (const Glib::Error& e) {
+            if (filter.Pattern.empty())
+            {
+                g_warning("Error setting discovery filter on %s: %s",name.c_str(),e.what().c_str());
+                continue;
+            }
+            // Pattern needs BlueZ 5.54, filter on name client side instead
+            g_warning("Discovery filter rejected on %s (%s), retrying without name pattern",name.c_str(),e.what().c_str());
+            adapter_options.erase("Pattern");
+            try {
+                timed_call(DBusMethod::SetDiscoveryFilter, [&]() {
+                    return adapter.Proxy->call_sync("SetDiscoveryFilter",
+                                                    Glib::VariantContainerBase::create_tuple(Glib::Variant<std::map<Glib::ustring, Glib::VariantBase>>::create(adapter_options)));
+                });
+            } catch (const Glib::Error& e) {
+                g_warning("Error setting discovery filter on %s: %s",name.c_str(),e.what().c_str());
+            }
+        }
+    }
 }
 
 void BlueZProxy::stop_scan()
 {
-    try
-    {
-        adapter_proxy_->call_sync("StopDiscovery");
-        sigDeviceFound.clear();
-        sigDeviceFoundByRSSI.clear();
-    } catch (const Glib::Error& e) {
-        g_warning("Glib::Error: %s", e.what().c_str());
-    } catch (const std::exception& e) {
-        g_warning("Standard exception: %s", e.what());
-    } catch (...) {
-        g_warning("Unknown error");
-    }    
+    sigDeviceFound.clear();
+    sigDeviceFoundByRSSI.clear();
+    active_scans.clear();
+    stop_discovery();
+}
+
+void BlueZProxy::stop_discovery()
+{
+    for (const auto& [name, adapter] : adapters) {
+        try
+        {
+            timed_call(DBusMethod::StopDiscovery, [&]() { return adapter.Proxy->call_sync("StopDiscovery"); });
+        } catch (const Glib::Error& e) {
+            g_warning("Glib::Error on %s: %s", name.c_str(), e.what().c_str());
+        } catch (const std::exception& e) {
+            g_warning("Standard exception on %s: %s", name.c_str(), e.what());
+        } catch (...) {
+            g_warning("Unknown error on %s", name.c_str());
+        }    
+
+        try
+        {
+            // an empty dictionary clears our discovery filter
+            std::map<Glib::ustring, Glib::VariantBase> no_options;
+            timed_call(DBusMethod::SetDiscoveryFilter, [&]() {
+                return adapter.Proxy->call_sync("SetDiscoveryFilter",
+                                                Glib::VariantContainerBase::create_tuple(Glib::Variant<std::map<Glib::ustring, Glib::VariantBase>>::create(no_options)));
+            });
+        } catch (const Glib::Error& e) {
+            LOG_DEBUG("Could not clear discovery filter on %s: %s", name.c_str(), e.what().c_str());
+        }
+    }
 }
 
 bool BlueZProxy::connect(const std::string& device_address) {
     try {
-        auto device_proxy_ = get_device_proxy(device_address);
+        // pick the adapter now, later calls for this address stick to it
+        auto device_path = get_device_path(device_address);
+        bound_paths[device_address] = device_path;
+
+        auto device_proxy_ = get_device_proxy(device_path);
         
         if (!device_proxy_) {
             g_warning("Failed to create proxy for device: %s", device_address.c_str());
+            bound_paths.erase(device_address);
             return false;
         }
 
         // Call BlueZ Device1's `Connect` method
-        auto method_call = device_proxy_->call_sync("Connect");
+        auto method_call = timed_call(DBusMethod::Connect, [&]() { return device_proxy_->call_sync("Connect"); });
 
         if (!method_call) {
             g_warning("Failed to connect to device: %s", device_address.c_str());
+            bound_paths.erase(device_address);
             return false;
         }
 
-        g_message("Successfully connected to device: %s", device_address.c_str());
+        g_message("Successfully connected to device: %s via %s", device_address.c_str(), adapter_of(device_path).c_str());
+        return true;
+    } catch (const Glib::Error& e) {
+        bound_paths.erase(device_address);
+        g_warning("Glib::Error occurred while connecting to device %s: %s", device_address.c_str(), e.what().c_str());
+    } catch (const std::exception& e) {
+        bound_paths.erase(device_address);
+        g_warning("Standard exception occurred while connecting to device %s: %s", device_address.c_str(), e.what());
+    } catch (...) {
+        bound_paths.erase(device_address);
+        g_warning("Unknown error occurred while connecting to device: %s", device_address.c_str());
+    }
+
+    return false;
+}
+
+bool BlueZProxy::connect_async(const std::string& device_address,sigc::slot<void,bool> callback)
+{
+    try {
+        auto device_path = get_device_path(device_address);
+        auto device_proxy_ = get_device_proxy(device_path);
+
+        if (!device_proxy_) {
+            g_warning("Failed to create proxy for device: %s", device_address.c_str());
+            return false;
+        }
+
+        // Call BlueZ Device1's `Connect` method, fails fast if BlueZ does not know the device
+        bound_paths[device_address] = device_path;
+        device_proxy_->call("Connect",
+                            [this,device_proxy_,callback,device_address,start = LatencyTracer::now_us()](Glib::RefPtr<Gio::AsyncResult>& result) {
+                                dbus_latency(DBusMethod::Connect).record(LatencyTracer::now_us() - start);
+                                try {
+                                    device_proxy_->call_finish(result);
+                                    g_message("Successfully connected to device: %s", device_address.c_str());
+                                    callback(true);
+                                } catch (const Glib::Error& e) {
+                                    g_warning("Glib::Error occurred while connecting to device %s: %s", device_address.c_str(), e.what().c_str());
+                                    bound_paths.erase(device_address);
+                                    callback(false);
+                                }
+                            });
         return true;
     } catch (const Glib::Error& e) {
         g_warning("Glib::Error occurred while connecting to device %s: %s", device_address.c_str(), e.what().c_str());
@@ -142,6 +560,8 @@ bool BlueZProxy::connect(const std::string& device_address) {
 
 void BlueZProxy::disconnect(const std::string& device_address)
 {
+    release_notifications(get_device_path(device_address));
+
     try {
         auto device_proxy_ = get_device_proxy(device_address);
         
@@ -151,7 +571,7 @@ void BlueZProxy::disconnect(const std::string& device_address)
         }
 
         // Call BlueZ Device1's `Connect` method
-        auto method_call = device_proxy_->call_sync("Disconnect");
+        auto method_call = timed_call(DBusMethod::Disconnect, [&]() { return device_proxy_->call_sync("Disconnect"); });
 
         if (!method_call) {
             g_warning("Error while diconnecting %s", device_address.c_str());
@@ -166,6 +586,9 @@ void BlueZProxy::disconnect(const std::string& device_address)
     } catch (...) {
         g_warning("Unknown error occurred while disconnecting device: %s", device_address.c_str());
     }    
+
+    // the next connect may pick another adapter
+    bound_paths.erase(device_address);
 }
 
 bool BlueZProxy::write(const std::string& device_address,const std::string& write_char_uuid,const std::vector<uint8_t>& payload)
@@ -183,7 +606,43 @@ bool BlueZProxy::write(const std::string& device_address,const std::string& writ
         auto params_variant = Glib::VariantContainerBase::create_tuple(std::vector<Glib::VariantBase>({value_variant,options_variant}));
             
         // Write the payload to the characteristic
-        write_char_proxy->call_sync("WriteValue",params_variant);
+        timed_call(DBusMethod::WriteValue, [&]() { return write_char_proxy->call_sync("WriteValue",params_variant); });
+        return true;
+    } catch (const Glib::Error& e) {
+        g_warning("Glib::Error occurred while writing to device %s: %s", device_address.c_str(), e.what().c_str());
+    } catch (const std::exception& e) {
+        g_warning("Standard exception occurred while writing to device %s: %s", device_address.c_str(), e.what());
+    } catch (...) {
+        g_warning("Unknown error occurred while writing to device: %s", device_address.c_str());
+    }
+    return false;
+}
+
+bool BlueZProxy::write_async(const std::string& device_address,const std::string& write_char_uuid,const std::vector<uint8_t>& payload,sigc::slot<void,bool> callback)
+{
+    try {
+        auto device_path = get_device_path(device_address);
+        auto write_char_proxy = get_char_proxy(device_path,write_char_uuid);
+
+        std::map<Glib::ustring, Glib::VariantBase> options;
+        options["type"] = Glib::Variant<Glib::ustring>::create("request");
+        auto options_variant = Glib::Variant< std::map<Glib::ustring, Glib::VariantBase>>::create(options);
+        auto value_variant = Glib::Variant<std::vector<uint8_t>>::create(payload);
+        auto params_variant = Glib::VariantContainerBase::create_tuple(std::vector<Glib::VariantBase>({value_variant,options_variant}));
+
+        // completion runs on the main loop, the proxy is kept alive by the capture
+        write_char_proxy->call("WriteValue",
+                               [write_char_proxy,callback,device_address,start = LatencyTracer::now_us()](Glib::RefPtr<Gio::AsyncResult>& result) {
+                                    dbus_latency(DBusMethod::WriteValue).record(LatencyTracer::now_us() - start);
+                                    try {
+                                        write_char_proxy->call_finish(result);
+                                        callback(true);
+                                    } catch (const Glib::Error& e) {
+                                        g_warning("Glib::Error occurred while writing to device %s: %s", device_address.c_str(), e.what().c_str());
+                                        callback(false);
+                                    }
+                               },
+                               params_variant);
         return true;
     } catch (const Glib::Error& e) {
         g_warning("Glib::Error occurred while writing to device %s: %s", device_address.c_str(), e.what().c_str());
@@ -204,74 +663,166 @@ std::vector<uint8_t> BlueZProxy::read(const std::string& device_address,const st
     std::map<Glib::ustring, Glib::VariantBase> read_options;
     auto read_options_variant = Glib::Variant< std::map<Glib::ustring, Glib::VariantBase>>::create(read_options);
     
-    auto response_variant = read_char_proxy->call_sync("ReadValue",Glib::VariantContainerBase::create_tuple(read_options_variant));    
+    auto response_variant = timed_call(DBusMethod::ReadValue, [&]() {
+        return read_char_proxy->call_sync("ReadValue",Glib::VariantContainerBase::create_tuple(read_options_variant));
+    });
     auto response_data_variant = Glib::VariantBase::cast_dynamic<Glib::Variant<std::vector<uint8_t>>>(response_variant.get_child(0));
     return response_data_variant.get();   
 }
 
-void BlueZProxy::start_notify(const std::string& device_address,const std::string& notify_char_uuid,sigc::slot<void,const std::vector<uint8_t>> callback)
+bool BlueZProxy::read_async(const std::string& device_address,const std::string& read_char_uuid,sigc::slot<void,bool,const std::vector<uint8_t>&> callback)
+{
+    try {
+        auto device_path = get_device_path(device_address);
+        auto read_char_proxy = get_char_proxy(device_path,read_char_uuid);
+
+        std::map<Glib::ustring, Glib::VariantBase> read_options;
+        auto read_options_variant = Glib::Variant< std::map<Glib::ustring, Glib::VariantBase>>::create(read_options);
+
+        read_char_proxy->call("ReadValue",
+                              [read_char_proxy,callback,device_address,start = LatencyTracer::now_us()](Glib::RefPtr<Gio::AsyncResult>& result) {
+                                    dbus_latency(DBusMethod::ReadValue).record(LatencyTracer::now_us() - start);
+                                    try {
+                                        auto response_variant = read_char_proxy->call_finish(result);
+                                        auto response_data_variant = Glib::VariantBase::cast_dynamic<Glib::Variant<std::vector<uint8_t>>>(response_variant.get_child(0));
+                                        callback(true,response_data_variant.get());
+                                    } catch (const Glib::Error& e) {
+                                        g_warning("Glib::Error occurred while reading from device %s: %s", device_address.c_str(), e.what().c_str());
+                                        callback(false,std::vector<uint8_t>());
+                                    }
+                              },
+                              Glib::VariantContainerBase::create_tuple(read_options_variant));
+        return true;
+    } catch (const Glib::Error& e) {
+        g_warning("Glib::Error occurred while reading from device %s: %s", device_address.c_str(), e.what().c_str());
+    } catch (const std::exception& e) {
+        g_warning("Standard exception occurred while reading from device %s: %s", device_address.c_str(), e.what());
+    } catch (...) {
+        g_warning("Unknown error occurred while reading from device: %s", device_address.c_str());
+    }
+    return false;
+}
+
+BlueZProxy::Subscription BlueZProxy::start_notify(const std::string& device_address,const std::string& notify_char_uuid,sigc::slot<void,const uint8_t*,size_t> callback)
 {
     auto device_path = get_device_path(device_address);
     auto notify_char_proxy = get_char_proxy(device_path,notify_char_uuid);
-    auto notify_char_path = get_char_path(device_path,notify_char_uuid);
+    std::string notify_char_path = get_char_path(device_path,notify_char_uuid);
+
+    auto id = subscribe(device_path, notify_char_path, callback);
+
+    // Enable notifications
+    timed_call(DBusMethod::StartNotify, [&]() { return notify_char_proxy->call_sync("StartNotify"); });
+
+    LOG_DEBUG("Live subscriptions: %zu",getLiveSubscriptions());
+    return Subscription(this, notify_char_path, id);
+}
+
+BlueZProxy::Subscription BlueZProxy::start_notify_async(const std::string& device_address,const std::string& notify_char_uuid,sigc::slot<void,const uint8_t*,size_t> callback,sigc::slot<void,bool> started)
+{
+    try {
+        auto device_path = get_device_path(device_address);
+        auto notify_char_proxy = get_char_proxy(device_path,notify_char_uuid);
+        std::string notify_char_path = get_char_path(device_path,notify_char_uuid);
+
+        // subscribe first, so no notification sent right after StartNotify is missed
+        auto id = subscribe(device_path, notify_char_path, callback);
+
+        notify_char_proxy->call("StartNotify",
+                                [notify_char_proxy,started,device_address,start = LatencyTracer::now_us()](Glib::RefPtr<Gio::AsyncResult>& result) {
+                                    dbus_latency(DBusMethod::StartNotify).record(LatencyTracer::now_us() - start);
+                                    try {
+                                        notify_char_proxy->call_finish(result);
+                                        started(true);
+                                    } catch (const Glib::Error& e) {
+                                        g_warning("Glib::Error occurred while enabling notifications on device %s: %s", device_address.c_str(), e.what().c_str());
+                                        started(false);
+                                    }
+                                });
+
+        LOG_DEBUG("Live subscriptions: %zu",getLiveSubscriptions());
+        return Subscription(this, notify_char_path, id);
+    } catch (const Glib::Error& e) {
+        g_warning("Glib::Error occurred while enabling notifications on device %s: %s", device_address.c_str(), e.what().c_str());
+    } catch (const std::exception& e) {
+        g_warning("Standard exception occurred while enabling notifications on device %s: %s", device_address.c_str(), e.what());
+    } catch (...) {
+        g_warning("Unknown error occurred while enabling notifications on device: %s", device_address.c_str());
+    }
+    return Subscription();
+}
+
+uint64_t BlueZProxy::subscribe(const std::string& device_path, const std::string& char_path, sigc::slot<void,const uint8_t*,size_t> callback)
+{
+    // a leftover subscription from an earlier link would decrypt with a stale key
+    auto old_it = notify_subscriptions.find(char_path);
+    if (old_it != notify_subscriptions.end()) {
+        LOG_DEBUG("Replacing stale notification subscription on %s",char_path.c_str());
+        unsubscribe(char_path, old_it->second.id);
+    }
    
-    connection->signal_subscribe(
+    auto dbus_id = connection->signal_subscribe(
         sigc::mem_fun(this, &BlueZProxy::on_data), // Slot for the callback
         "org.bluez",         // Sender name (can be empty if not filtering by sender)
         "org.freedesktop.DBus.Properties", // Interface name
         "PropertiesChanged",   // Signal member (signal name)
-        notify_char_path,        // Object path (can be empty if not filtering by path)
+        char_path,        // Object path (can be empty if not filtering by path)
         {}                  // First argument to filter by (optional, typically empty)            
     );
 
-    sigDataRx.connect(callback);
+    auto id = next_subscription_id++;
+    notify_subscriptions[char_path] = NotifySubscription{id, dbus_id, device_path, callback};
+    return id;
+}
 
-    // Enable notifications
-    notify_char_proxy->call_sync("StartNotify");
-               
+void BlueZProxy::unsubscribe(const std::string& char_path, uint64_t id)
+{
+    auto it = notify_subscriptions.find(char_path);
+    if (it == notify_subscriptions.end() || it->second.id != id) {
+        // already released, e.g. by disconnect
+        return;
+    }
+
+    connection->signal_unsubscribe(it->second.dbus_id);
+    notify_subscriptions.erase(it);
 }
 
-void BlueZProxy::disconnect_by_name(const std::string& device_name) {
-    try {        
-        auto om_proxy = Gio::DBus::Proxy::create_sync(
-            connection,
-            "org.bluez",                 // BlueZ service
-            "/",                 // Specific device path
-            "org.freedesktop.DBus.ObjectManager" // Interface for managed objects
-        );
-        // Get managed objects
-        auto result = om_proxy->call_sync("GetManagedObjects");
+void BlueZProxy::release_notifications(const std::string& device_path)
+{
+    for (auto it = notify_subscriptions.begin(); it != notify_subscriptions.end(); ) {
+        if (it->second.device_path == device_path) {
+            connection->signal_unsubscribe(it->second.dbus_id);
+            it = notify_subscriptions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
 
-        //std::cout << result.get_type_string() << std::endl;
-        // Unpack the variant containing the managed objects
-        auto objects = Glib::VariantBase::cast_dynamic<
-                                Glib::Variant<
-                                std::map<Glib::DBusObjectPathString,
-                                    std::map<Glib::ustring,
-                                        std::map<Glib::ustring,
-                                                Glib::VariantBase>>>>>
-                            (result.get_child(0));
+size_t BlueZProxy::getLiveSubscriptions() const
+{
+    return notify_subscriptions.size() + sigDeviceFound.size() + sigDeviceFoundByRSSI.size();
+}
 
-        // Iterate through all objects managed by the adapter
-        for (const auto& [object_path, interfaces] : objects.get()) {
-            if (interfaces.find("org.bluez.Device1") != interfaces.end()) {
-                auto device_proxy = Gio::DBus::Proxy::create_sync(
-                    connection,
-                    "org.bluez",
-                    object_path,
-                    "org.bluez.Device1"
-                );
-
-                Glib::Variant<Glib::ustring> name_variant;
-                Glib::Variant<bool> connected_variant;
-                device_proxy->get_cached_property(name_variant,"Name");                
-                device_proxy->get_cached_property(connected_variant,"Connected");
-                if (name_variant && Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(name_variant).get()==device_name
-                    && connected_variant && Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(connected_variant).get()) {
-                    // Call Disconnect method
-                    device_proxy->call_sync("Disconnect");
-                    g_message("Disconnected device: %s", object_path.c_str());
-                }
+void BlueZProxy::disconnect_by_name(const std::string& device_name) {
+    try {
+        // collect first, Disconnect may let signals modify the index underneath us
+        std::vector<std::string> connected_paths;
+        auto range = name_index.equal_range(device_name);
+        for (auto it = range.first; it != range.second; ++it) {
+            auto device_it = devices.find(it->second);
+            if (device_it != devices.end() && device_it->second->Connected) {
+                connected_paths.push_back(it->second);
+            }
+        }
+
+        for (const auto& object_path : connected_paths) {
+            auto device_proxy = get_device_proxy(Glib::DBusObjectPathString(object_path));
+            timed_call(DBusMethod::Disconnect, [&]() { return device_proxy->call_sync("Disconnect"); });
+            g_message("Disconnected device: %s", object_path.c_str());
+            auto device_it = devices.find(object_path);
+            if (device_it != devices.end()) {
+                bound_paths.erase(device_it->second->Address);
             }
         }
     } catch (const Glib::Error& e) {
@@ -302,26 +853,35 @@ void BlueZProxy::on_interfaces_added(const Glib::RefPtr<Gio::DBus::Connection>&
     // Extract the object path and interface map
     auto [obj_path, interfaces] = tuple.get();
 
-    g_debug("Interfaces added on %s",obj_path.c_str());
+    LOG_DEBUG("Interfaces added on %s",obj_path.c_str());
         
-    // Check if the device has the desired "Name" property
-    auto device_it = interfaces.find("org.bluez.Device1");
-    if (device_it != interfaces.end()) {
-        auto properties = device_it->second;
+    add_interfaces(obj_path, interfaces);
 
-        Glib::ustring name,address;
+    auto device_it = devices.find(obj_path);
+    if (interfaces.find("org.bluez.Device1") != interfaces.end() && device_it != devices.end()) {
+        sigDeviceFound.emit(device_it->second->Address,device_it->second->Name);
+    }
+}
 
-        auto name_it = properties.find("Name");
-        if (name_it != properties.end()) {
-            name = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(name_it->second).get();          
-        }
+void BlueZProxy::on_interfaces_removed(const Glib::RefPtr<Gio::DBus::Connection>& connection,
+                   const Glib::ustring& sender_name,
+                   const Glib::ustring& object_path,
+                   const Glib::ustring& interface_name,
+                   const Glib::ustring& signal_name,
+                   const Glib::VariantContainerBase& parameters) {
 
-        auto address_it = properties.find("Address");
-        if (address_it != properties.end()) {
-            address = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(address_it->second).get();          
-        }
+    auto tuple = Glib::VariantBase::cast_dynamic<Glib::Variant<std::tuple<
+                    Glib::ustring, // Object path (o)
+                    std::vector<Glib::ustring> // as
+                    >>>(parameters);
 
-        sigDeviceFound.emit(address,name);
+    auto [obj_path, interfaces] = tuple.get();
+
+    if (std::find(interfaces.begin(), interfaces.end(), "org.bluez.Adapter1") != interfaces.end()
+        || std::find(interfaces.begin(), interfaces.end(), "org.bluez.Device1") != interfaces.end()
+        || std::find(interfaces.begin(), interfaces.end(), "org.bluez.GattCharacteristic1") != interfaces.end()) {
+        LOG_DEBUG("Object removed: %s",obj_path.c_str());
+        remove_object(obj_path);
     }
 }
 
@@ -332,38 +892,38 @@ void BlueZProxy::on_device_properties_changed(const Glib::RefPtr<Gio::DBus::Conn
                              const Glib::ustring& signal_name,
                              const Glib::VariantContainerBase& parameters)
 {   
-    auto tuple = Glib::VariantBase::cast_dynamic<Glib::Variant<std::tuple<
-                        Glib::ustring, // Object path (o)
-                        std::map<Glib::ustring, Glib::VariantBase> ,
-                        std::vector<Glib::ustring>
-                        >>>(parameters);
+    try {
+        auto tuple = Glib::VariantBase::cast_dynamic<Glib::Variant<std::tuple<
+                            Glib::ustring, // Interface name (s)
+                            std::map<Glib::ustring, Glib::VariantBase> ,
+                            std::vector<Glib::ustring>
+                            >>>(parameters);
 
-    auto [o, properties, extras] = tuple.get();
+        auto [interface, properties, invalidated] = tuple.get();
 
-    auto value_it = properties.find("RSSI");
-    if (value_it != properties.end())
-    {
-        // get the data            
-        auto data = Glib::VariantBase::cast_dynamic<Glib::Variant<std::int16_t>>(value_it->second).get();            
-        Glib::DBusObjectPathString obj_path(object_path);
-        auto device_info = get_device_info(obj_path);
-        sigDeviceFoundByRSSI.emit(device_info);
-    }
-     // Signal format: a{sv} (Dictionary of property names to values)
-    /*Glib::Variant<std::map<Glib::ustring, Glib::VariantBase>> props;
-    Glib::Variant<std::vector<Glib::ustring>> invalidated_props;
+        if (devices.find(object_path) == devices.end()) {
+            // missed its InterfacesAdded, fetch the full property set once
+            get_device_info(Glib::DBusObjectPathString(object_path.raw()));
+        }
 
-    parameters.get_child(props, 0);  // First argument: changed properties
-    parameters.get_child(invalidated_props, 1);  // Second argument: invalidated properties
+        // apply the changed values to the table, no round trip to BlueZ needed
+        auto device = update_device(object_path, properties);
 
-    auto changed_props = props.get();
+        if (std::find(invalidated.begin(), invalidated.end(), "RSSI") != invalidated.end()) {
+            // device is no longer being seen
+            device->RSSI = std::numeric_limits<int16_t>::min();
+        }
 
-    if (changed_props.find("RSSI") != changed_props.end()) {
-        auto rssi_value = changed_props.at("RSSI");
-        //Glib::ustring device_path = proxy->get_object_path();
-        //rssi_values[device_path] = rssi_value;
-        std::cout << "RSSI for " << object_path << ": " << rssi_value << std::endl;    
-    }*/
+        if (properties.find("RSSI") != properties.end() && !sigDeviceFoundByRSSI.empty())
+        {
+            // hand out a snapshot, the table entry keeps changing
+            sigDeviceFoundByRSSI.emit(std::make_shared<Device>(*device));
+        }
+    } catch (const std::bad_cast& e) {
+        g_warning("Unexpected PropertiesChanged payload on %s",object_path.c_str());
+    } catch (const Glib::Error& e) {
+        g_warning("Error while reading device %s: %s",object_path.c_str(),e.what().c_str());
+    }
 }
 
 
@@ -373,32 +933,34 @@ void BlueZProxy::on_data(const Glib::RefPtr<Gio::DBus::Connection>& connection,
              const Glib::ustring& interface_name,
              const Glib::ustring& signal_name,
              const Glib::VariantContainerBase& parameters) {
-    try {
-             
-        auto tuple = Glib::VariantBase::cast_dynamic<Glib::Variant<std::tuple<
-                        Glib::ustring, // Object path (o)
-                        std::map<Glib::ustring, Glib::VariantBase> ,
-                        std::vector<Glib::ustring>
-                        >>>(parameters);
-
-        // Extract the object path and property map
-        auto [object_path, properties, extras] = tuple.get();
-        
-        auto value_it = properties.find("Value");
-        if (value_it != properties.end())
-        {
-            // get the data            
-            auto data = Glib::VariantBase::cast_dynamic<Glib::Variant<std::vector<uint8_t>>>(value_it->second).get();
 
-            sigDataRx.emit(data);          
-        }
-        
+    auto handler_it = notify_subscriptions.find(object_path);
+    if (handler_it == notify_subscriptions.end()) {
+        return;
+    }
 
-    } catch (const Glib::Error& e) {
-        std::cerr << "Error processing property change " << e.what() << std::endl;
+    // (sa{sv}as) - look up Value directly instead of unpacking the whole tuple,
+    // the byte array is borrowed from the message, nothing is copied
+    GVariant* params = const_cast<GVariant*>(parameters.gobj());
+    if (!params || !g_variant_is_of_type(params, G_VARIANT_TYPE("(sa{sv}as)"))) {
+        g_warning("Unexpected notification payload on %s",object_path.c_str());
+        return;
     }
 
-   
+    GVariant* changed = g_variant_get_child_value(params, 1);
+    GVariant* value = g_variant_lookup_value(changed, "Value", G_VARIANT_TYPE_BYTESTRING);
+    if (value) {
+        gsize length = 0;
+        auto data = static_cast<const uint8_t*>(g_variant_get_fixed_array(value, &length, sizeof(uint8_t)));
+
+        // only the connection owning this characteristic can decrypt it,
+        // copy the slot since the handler may release its own subscription
+        auto handler = handler_it->second.handler;
+        handler(data, length);
+
+        g_variant_unref(value);
+    }
+    g_variant_unref(changed);
 }
 
 Glib::RefPtr<Gio::DBus::Proxy> BlueZProxy::get_device_proxy(const Glib::DBusObjectPathString& device_path)
@@ -418,11 +980,41 @@ Glib::RefPtr<Gio::DBus::Proxy> BlueZProxy::get_device_proxy(const std::string& d
     return get_device_proxy(get_device_path(device_address));
 }
 
-void get_device_info(const Glib::DBusObjectPathString &device_path);
-
 Glib::DBusObjectPathString BlueZProxy::get_device_path(const std::string& device_address)
 {
-    auto device_path = "/org/bluez/hci0/dev_" + device_address;
+    // stay on the adapter we connected through
+    auto bound_it = bound_paths.find(device_address);
+    if (bound_it != bound_paths.end()) {
+        return Glib::DBusObjectPathString(bound_it->second);
+    }
+
+    // a device seen by several adapters goes to the one with the fewest connections, then the best RSSI
+    std::shared_ptr<Device> best;
+    std::string best_path;
+    size_t best_load = 0;
+    auto range = address_index.equal_range(device_address);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto device_it = devices.find(it->second);
+        if (device_it == devices.end() || adapters.find(device_it->second->Adapter) == adapters.end()) {
+            continue;
+        }
+        auto& device = device_it->second;
+        if (device->Connected) {
+            return Glib::DBusObjectPathString(it->second);
+        }
+        auto load = connections_on(device->Adapter);
+        if (!best || load < best_load || (load == best_load && device->RSSI > best->RSSI)) {
+            best = device;
+            best_path = it->second;
+            best_load = load;
+        }
+    }
+    if (best) {
+        return Glib::DBusObjectPathString(best_path);
+    }
+
+    // not seen yet, assume the first adapter
+    auto device_path = (adapters.empty() ? std::string("/org/bluez/hci0") : adapters.begin()->second.Path) + "/dev_" + device_address;
     std::replace(device_path.begin(), device_path.end(), ':', '_'); // Format device path
     return device_path;
 }
@@ -435,67 +1027,41 @@ Glib::RefPtr<Gio::DBus::Proxy> BlueZProxy::get_char_proxy(const Glib::ustring& d
         throw std::invalid_argument("Characteristic not found");
     }
 
-     // Create the proxy for the pairing characteristic using its path
-    auto char_proxy = Gio::DBus::Proxy::create_sync(
-                            connection,
-                            "org.bluez",
-                            char_path,        
-                            "org.bluez.GattCharacteristic1"
-    );
+    // proxies stay valid until BlueZ removes the characteristic object
+    auto& char_proxy = char_proxies[char_path];
+    if (!char_proxy) {
+        char_proxy = Gio::DBus::Proxy::create_sync(
+                                connection,
+                                "org.bluez",
+                                char_path,        
+                                "org.bluez.GattCharacteristic1"
+        );
+    }
 
     return char_proxy;
 }
 
 Glib::ustring BlueZProxy::get_char_path(const Glib::ustring& device_path,const std::string& target_uuid) {
 
+    auto it = char_index.find(device_path.raw() + "|" + target_uuid);
+    if (it != char_index.end()) {
+        return it->second;
+    }
 
-    auto om_proxy = Gio::DBus::Proxy::create_sync(
-        connection,
-        "org.bluez",                 // BlueZ service
-        "/",                 // Specific device path
-        "org.freedesktop.DBus.ObjectManager" // Interface for managed objects
-    );
-
-    auto result = om_proxy->call_sync("GetManagedObjects");
-
-    // Unpack the variant containing the managed objects
-    auto managed_objects = Glib::VariantBase::cast_dynamic<
-                                Glib::Variant<
-                                std::map<Glib::DBusObjectPathString,
-                                    std::map<Glib::ustring,
-                                        std::map<Glib::ustring,
-                                                Glib::VariantBase>>>>>
-                            (result.get_child(0));
-    
-        for (const auto& [path, interfaces] : managed_objects.get()) {
-            // Check if the object path is under the given device path
-          //  std::cout << path << std::endl;
-            if (path.find(device_path) == 0) {
-      
-
-                auto it = interfaces.find("org.bluez.GattCharacteristic1");
-                if (it != interfaces.end()) {
-                    // Get the UUID property of the GattCharacteristic1 interface
-                    auto properties = it->second;                    
-                    if (properties.find("UUID") != properties.end()) {
-                        auto uuid = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("UUID")).get();                        
-                        if (uuid == target_uuid) {
-                            g_debug("Found GATT characteristic path: %s",path.c_str());
-                            return path;
-                        }
-                    }
-                }
-            }
-        }
-
-    // If not found, throw an exception
+    // services not resolved yet or the device is gone
     g_warning("Characteristic with UUID %s not found", target_uuid.c_str());
     return Glib::ustring ();
 }
 
 
 std::shared_ptr<BlueZProxy::Device> BlueZProxy::get_device_info(const Glib::DBusObjectPathString &device_path) {
-    
+
+    auto it = devices.find(device_path);
+    if (it != devices.end()) {
+        return std::make_shared<Device>(*it->second);
+    }
+
+    // not announced yet, ask BlueZ once
     auto proxy = Gio::DBus::Proxy::create_sync(
         connection,
         "org.bluez",                 // BlueZ service
@@ -504,70 +1070,68 @@ std::shared_ptr<BlueZProxy::Device> BlueZProxy::get_device_info(const Glib::DBus
     );
 
     auto interface_variant = Glib::Variant<Glib::ustring>::create("org.bluez.Device1");
-    auto result_variant = proxy->call_sync("GetAll",Glib::VariantContainerBase::create_tuple({interface_variant}));
+    auto result_variant = timed_call(DBusMethod::GetAll, [&]() {
+        return proxy->call_sync("GetAll",Glib::VariantContainerBase::create_tuple({interface_variant}));
+    });
 
 
     auto tuple = Glib::VariantBase::cast_dynamic<Glib::Variant<std::tuple<
                                                 std::map<Glib::ustring, Glib::VariantBase>>>>(result_variant);
 
     auto [properties] = tuple.get();
-    
 
-    // Create the Device structure
-    auto device_info = std::make_shared<BlueZProxy::Device>();
+    return std::make_shared<Device>(*update_device(device_path, properties));
+}
 
+void BlueZProxy::apply_device_properties(Device& device, const std::map<Glib::ustring, Glib::VariantBase>& properties) {
+    
     // Extract and map each property into the Device structure
     try {
                 // Check and extract each property
         if (properties.find("Address") != properties.end()) {
-            device_info->Address = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("Address")).get();
+            device.Address = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("Address")).get();
         }
 
         if (properties.find("AddressType") != properties.end()) {
-            device_info->AddressType = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("AddressType")).get();
+            device.AddressType = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("AddressType")).get();
         }
 
         if (properties.find("Name") != properties.end()) {
-            device_info->Name = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("Name")).get();
+            device.Name = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("Name")).get();
         }
 
         if (properties.find("Alias") != properties.end()) {
-            device_info->Alias = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("Alias")).get();
+            device.Alias = Glib::VariantBase::cast_dynamic<Glib::Variant<Glib::ustring>>(properties.at("Alias")).get();
         }
 
         if (properties.find("Paired") != properties.end()) {
-            device_info->Paired = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Paired")).get();
+            device.Paired = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Paired")).get();
         }
 
         if (properties.find("Bonded") != properties.end()) {
-            device_info->Bonded = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Bonded")).get();
+            device.Bonded = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Bonded")).get();
         }
 
         if (properties.find("Trusted") != properties.end()) {
-            device_info->Trusted = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Trusted")).get();
+            device.Trusted = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Trusted")).get();
         }
 
         if (properties.find("Blocked") != properties.end()) {
-            device_info->Blocked = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Blocked")).get();
+            device.Blocked = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Blocked")).get();
         }
 
         if (properties.find("LegacyPairing") != properties.end()) {
-            device_info->LegacyPairing = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("LegacyPairing")).get();
+            device.LegacyPairing = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("LegacyPairing")).get();
         }
 
         if (properties.find("RSSI") != properties.end()) {
-            device_info->RSSI = Glib::VariantBase::cast_dynamic<Glib::Variant<int16_t>>(properties.at("RSSI")).get();
+            device.RSSI = Glib::VariantBase::cast_dynamic<Glib::Variant<int16_t>>(properties.at("RSSI")).get();
         }
 
         if (properties.find("Connected") != properties.end()) {
-            device_info->Connected = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Connected")).get();
+            device.Connected = Glib::VariantBase::cast_dynamic<Glib::Variant<bool>>(properties.at("Connected")).get();
         }   
-    } catch (const Glib::Error &e) {
-        std::cerr << "Error while extracting device properties: " << e.what() << std::endl;
-        return nullptr;  // Return nullptr if any error occurs
+    } catch (const std::bad_cast &e) {
+        g_warning("Error while extracting device properties of %s: %s", device.Address.c_str(), e.what());
     }
-
-    // Return the populated device info
-    return device_info;
-    
-}
\ No newline at end of file
+}
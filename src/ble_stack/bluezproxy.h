@@ -6,6 +6,11 @@
 #include <string>
 #include <sigc++/sigc++.h>
 #include <vector>
+#include <map>
+#include <optional>
+#include <limits>
+#include <unordered_map>
+#include "adapter_table.h"
 
 class BlueZProxy {
 public:
@@ -16,36 +21,116 @@ public:
         std::string AddressType;
         std::string Name;
         std::string Alias;
-        bool Paired;
-        bool Bonded;
-        bool Trusted;
-        bool Blocked;
-        bool LegacyPairing;
-        int16_t RSSI;
-        bool Connected;        
+        bool Paired = false;
+        bool Bonded = false;
+        bool Trusted = false;
+        bool Blocked = false;
+        bool LegacyPairing = false;
+        int16_t RSSI = std::numeric_limits<int16_t>::min(); // not seen
+        bool Connected = false;        
+        std::string Adapter;                   // controller that sees the device, e.g. "hci0"
     };
 
-    BlueZProxy();
+    // applied by BlueZ via SetDiscoveryFilter, so filtered devices never reach us
+    struct DiscoveryFilter
+    {
+        std::string Transport = "le";          // "auto", "bredr" or "le"
+        std::optional<int16_t> RSSI;           // RSSI floor in dBm
+        std::string Pattern;                   // device name or address prefix
+        std::vector<std::string> UUIDs;        // advertised service UUIDs
+        bool DuplicateData = true;             // report repeated advertisements, needed for RSSI updates
+    };
+
+    // scoped notification subscription, unsubscribes when released or destroyed
+    class Subscription
+    {
+        public:
+            Subscription() = default;
+            Subscription(BlueZProxy* owner, const std::string& char_path, uint64_t id)
+                : owner(owner), char_path(char_path), id(id) {}
+            ~Subscription() { release(); }
+
+            Subscription(const Subscription&) = delete;
+            Subscription& operator=(const Subscription&) = delete;
+            Subscription(Subscription&& other) noexcept { *this = std::move(other); }
+            Subscription& operator=(Subscription&& other) noexcept
+            {
+                if (this != &other) {
+                    release();
+                    owner = other.owner;
+                    char_path = std::move(other.char_path);
+                    id = other.id;
+                    other.owner = nullptr;
+                }
+                return *this;
+            }
+
+            explicit operator bool() const { return owner != nullptr; }
+
+            void release()
+            {
+                if (owner) {
+                    owner->unsubscribe(char_path, id);
+                    owner = nullptr;
+                }
+            }
+
+        protected:
+            BlueZProxy* owner = nullptr;
+            std::string char_path;
+            uint64_t id = 0;
+    };
+
+    // adapters names the controllers to use (e.g. "hci0","hci1"), empty uses every adapter BlueZ reports.
+    // bus_address picks where org.bluez lives: empty for the system bus, "session", or a D-Bus address (the mesh emulator)
+    explicit BlueZProxy(const std::vector<std::string>& adapters = {}, const std::string& bus_address = "");
     ~BlueZProxy();
 
+    std::vector<std::string> get_adapters() const;
+
     
     void start_scan(sigc::slot<void,const std::string, const std::string> callback);
 
-    void start_rssi_scan(sigc::slot<void,std::shared_ptr<Device>> callback);
+    // several callers may scan at once, each stops its own scan through the returned handle
+    using ScanHandle = uint64_t;
+    ScanHandle start_rssi_scan(sigc::slot<void,std::shared_ptr<Device>> callback, const DiscoveryFilter& filter);
+    // a DiscoveryFilter() default argument would need its member initializers before BlueZProxy is complete
+    ScanHandle start_rssi_scan(sigc::slot<void,std::shared_ptr<Device>> callback) { return start_rssi_scan(callback, DiscoveryFilter()); }
+    void stop_scan(ScanHandle scan);
 
+    // stops every scan
     void stop_scan();
     
     bool connect(const std::string& device_address);
 
+    // returns false if the connect could not be submitted, otherwise callback reports the outcome
+    bool connect_async(const std::string& device_address,sigc::slot<void,bool> callback);
+
+    // also releases the notification subscriptions of that device
     void disconnect(const std::string& device_address);
 
     void disconnect_by_name(const std::string& device_name);
 
     bool write(const std::string& device_address,const std::string& write_char_uuid,const std::vector<uint8_t>& payload);
 
+    // returns false if the write could not be submitted, otherwise callback reports the outcome
+    bool write_async(const std::string& device_address,const std::string& write_char_uuid,const std::vector<uint8_t>& payload,sigc::slot<void,bool> callback);
+
     std::vector<uint8_t> read(const std::string& device_address,const std::string& read_char_uuid);
 
-    void start_notify(const std::string& device_address,const std::string& notify_char_uuid,sigc::slot<void,const std::vector<uint8_t>> callback);
+    // returns false if the read could not be submitted, otherwise callback receives success and value
+    bool read_async(const std::string& device_address,const std::string& read_char_uuid,sigc::slot<void,bool,const std::vector<uint8_t>&> callback);
+
+    // the callback stays subscribed until the returned handle is released or the device is disconnected
+    // the callback borrows the notification payload, it is only valid during the call
+    Subscription start_notify(const std::string& device_address,const std::string& notify_char_uuid,sigc::slot<void,const uint8_t*,size_t> callback);
+
+    // subscribes right away and starts notifying without blocking, started reports whether BlueZ accepted StartNotify
+    // an empty handle means nothing was submitted
+    Subscription start_notify_async(const std::string& device_address,const std::string& notify_char_uuid,sigc::slot<void,const uint8_t*,size_t> callback,sigc::slot<void,bool> started);
+
+    // D-Bus and callback subscriptions currently held on behalf of callers
+    size_t getLiveSubscriptions() const;
     
 protected:
 
@@ -56,6 +141,13 @@ protected:
                              const Glib::ustring& signal_name,
                              const Glib::VariantContainerBase& parameters);
 
+    void on_interfaces_removed(const Glib::RefPtr<Gio::DBus::Connection>& connection,
+                             const Glib::ustring& sender_name,
+                             const Glib::ustring& object_path,
+                             const Glib::ustring& interface_name,
+                             const Glib::ustring& signal_name,
+                             const Glib::VariantContainerBase& parameters);
+
     void on_device_properties_changed(const Glib::RefPtr<Gio::DBus::Connection>& connection,
                              const Glib::ustring& sender_name,
                              const Glib::ustring& object_path,
@@ -71,22 +163,71 @@ protected:
                  const Glib::VariantContainerBase& parameters);
     
     // Helper methods
+    void set_discovery_filter(const DiscoveryFilter& filter);
+    void stop_discovery();
+    static DiscoveryFilter merge_filters(const std::vector<DiscoveryFilter>& filters);
     Glib::RefPtr<Gio::DBus::Proxy> get_device_proxy(const Glib::DBusObjectPathString& device_path);
     Glib::RefPtr<Gio::DBus::Proxy> get_device_proxy(const std::string& device_address);
     std::shared_ptr<Device>  get_device_info(const Glib::DBusObjectPathString &device_path);
+    void seed_object_mirror();
+    void add_interfaces(const Glib::ustring& object_path, const std::map<Glib::ustring, std::map<Glib::ustring, Glib::VariantBase>>& interfaces);
+    void remove_object(const std::string& object_path);
+    void unindex_device(const std::string& object_path, const Device& device);
+    std::shared_ptr<Device> update_device(const Glib::ustring& object_path, const std::map<Glib::ustring, Glib::VariantBase>& properties);
+    static void apply_device_properties(Device& device, const std::map<Glib::ustring, Glib::VariantBase>& properties);
     Glib::DBusObjectPathString get_device_path(const std::string& device_address);
     Glib::RefPtr<Gio::DBus::Proxy> get_char_proxy(const Glib::ustring& device_path,const std::string& char_uuid);
     Glib::ustring get_char_path(const Glib::ustring& device_path,const std::string& target_uuid);
     void setup_dbus_proxy();    
+    void add_adapter(const std::string& adapter_path);
+    static std::string adapter_of(const std::string& object_path);
+    size_t connections_on(const std::string& adapter) const;
+    uint64_t subscribe(const std::string& device_path, const std::string& char_path, sigc::slot<void,const uint8_t*,size_t> callback);
+    void unsubscribe(const std::string& char_path, uint64_t id);
+    void release_notifications(const std::string& device_path);
 
     // Internal state
     Glib::RefPtr<Gio::DBus::Connection> connection;
-    Glib::RefPtr<Gio::DBus::Proxy> adapter_proxy_;  
+
+    std::string bus_address;                    // empty: the system bus
+    AdapterTable<Glib::RefPtr<Gio::DBus::Proxy>> adapters;  // usable adapters by name, allow list applied
+    std::unordered_map<std::string,std::string> bound_paths; // address -> device path we connected through
+
+    struct Characteristic
+    {
+        std::string DevicePath;
+        std::string UUID;
+    };
+
+    // mirror of the BlueZ object tree, seeded once and kept current from signals
+    std::unordered_map<std::string,std::shared_ptr<Device>> devices;     // by object path
+    std::unordered_multimap<std::string,std::string> address_index;      // address -> device paths, one per adapter
+    std::unordered_multimap<std::string,std::string> name_index;         // name -> device paths
+    std::unordered_map<std::string,Characteristic> characteristics;      // by object path
+    std::unordered_map<std::string,std::string> char_index;              // "<device path>|<uuid>" -> characteristic path
+    std::unordered_map<std::string,Glib::RefPtr<Gio::DBus::Proxy>> char_proxies;
 
     // callback signals
     sigc::signal<void,std::shared_ptr<Device>> sigDeviceFoundByRSSI;
+    struct ActiveScan
+    {
+        sigc::connection callback;
+        DiscoveryFilter filter;
+    };
+    std::map<ScanHandle,ActiveScan> active_scans;
+    ScanHandle next_scan_handle = 1;
     sigc::signal<void,const std::string,const std::string> sigDeviceFound;
-    sigc::signal<void,const std::vector<uint8_t>&> sigDataRx;
+
+    struct NotifySubscription
+    {
+        uint64_t id;
+        guint dbus_id;
+        std::string device_path;
+        sigc::slot<void,const uint8_t*,size_t> handler;
+    };
+    // one notification handler per characteristic object path
+    std::unordered_map<std::string,NotifySubscription> notify_subscriptions;
+    uint64_t next_subscription_id = 1;
 
 };
 
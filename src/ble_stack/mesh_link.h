@@ -0,0 +1,28 @@
+#ifndef MESH_LINK_H
+#define MESH_LINK_H
+
+#include <functional>
+#include <memory>
+#include <sigc++/sigc++.h>
+#include "telink_mesh_protocol.h"
+
+/* What the gateway needs from a mesh:
+    receive packets, send packets, know when sending is possible.
+   Implemented by TelinkMesh on the calling thread and by ThreadedMesh on the BLE thread.
+*/
+class MeshLink {
+public:
+    virtual ~MeshLink() = default;
+
+    virtual void setRxCallback(sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback) = 0;
+
+    // false starts (re)connecting, onReady reports when it succeeded
+    virtual bool isReady() = 0;
+
+    virtual void onReady(std::function<void()> callback) = 0;
+
+    // throws if the packet can not be sent
+    virtual void send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet) = 0;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "packet_capture.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+// pcapng block types and options
+static constexpr uint32_t block_section_header = 0x0A0D0D0A;
+static constexpr uint32_t block_interface = 0x00000001;
+static constexpr uint32_t block_enhanced_packet = 0x00000006;
+static constexpr uint16_t opt_end = 0;
+static constexpr uint16_t opt_comment = 1;
+static constexpr uint16_t opt_if_name = 2;
+static constexpr uint16_t opt_epb_flags = 2;
+static constexpr uint16_t opt_shb_userappl = 4;
+
+static int64_t wall_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static int64_t mono_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PacketCapture::PacketCapture(const std::string& path, uint64_t max_bytes)
+    : path(path), max_bytes(max_bytes), anchor_wall_us(wall_us()), anchor_mono_us(mono_us())
+{
+    buffer.reserve(64 * 1024);
+    open();
+    writer = std::thread([this]() { run(); });
+}
+
+PacketCapture::~PacketCapture()
+{
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stopping = true;
+    }
+    stop_signal.notify_one();
+    writer.join();
+    flush();
+    if (file)
+    {
+        std::fclose(file);
+    }
+}
+
+void PacketCapture::capture(Interface interface, Direction direction, const std::string& address, const uint8_t* data, size_t length)
+{
+    Record record;
+    record.timestamp_us = anchor_wall_us + (mono_us() - anchor_mono_us);
+    record.interface = interface;
+    record.direction = direction;
+    record.length = static_cast<uint8_t>(std::min(length, max_packet));
+    std::memcpy(record.data.data(), data, record.length);
+    std::memcpy(record.address.data(), address.c_str(), std::min(address.size(), record.address.size() - 1));
+
+    if (!queue.push(record))
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void PacketCapture::run()
+{
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    while (!stopping)
+    {
+        stop_signal.wait_for(lock, std::chrono::milliseconds(flush_interval_ms));
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+void PacketCapture::flush()
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    Record record;
+    while (queue.pop(record))
+    {
+        encode(record);
+        if (buffer.size() >= 60 * 1024)
+        {
+            write_buffer();
+        }
+    }
+    write_buffer();
+}
+
+void PacketCapture::open()
+{
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        throw std::runtime_error("Could not create capture file " + path);
+    }
+    file_bytes = 0;
+    write_headers();
+    write_buffer();
+}
+
+void PacketCapture::write_headers()
+{
+    static const char application[] = "meshgateway";
+    static const char* interface_names[] = {"encrypted", "decrypted"};
+
+    // section header, little endian, unknown section length
+    auto start = buffer.size();
+    put_u32(block_section_header);
+    put_u32(0);
+    put_u32(0x1A2B3C4D);
+    put_u16(1);
+    put_u16(0);
+    put_u32(0xFFFFFFFF);
+    put_u32(0xFFFFFFFF);
+    put_option(opt_shb_userappl, application, sizeof(application) - 1);
+    put_option(opt_end, nullptr, 0);
+    put_u32(0);
+    uint32_t length = buffer.size() - start;
+    std::memcpy(&buffer[start + 4], &length, 4);
+    std::memcpy(&buffer[buffer.size() - 4], &length, 4);
+
+    // one interface per packet form, microsecond timestamps (the default resolution)
+    for (auto name : interface_names)
+    {
+        start = buffer.size();
+        put_u32(block_interface);
+        put_u32(0);
+        put_u16(link_type);
+        put_u16(0);
+        put_u32(max_packet);
+        put_option(opt_if_name, name, std::strlen(name));
+        put_option(opt_end, nullptr, 0);
+        put_u32(0);
+        length = buffer.size() - start;
+        std::memcpy(&buffer[start + 4], &length, 4);
+        std::memcpy(&buffer[buffer.size() - 4], &length, 4);
+    }
+}
+
+void PacketCapture::encode(const Record& record)
+{
+    auto start = buffer.size();
+    put_u32(block_enhanced_packet);
+    put_u32(0);
+    put_u32(record.interface);
+    put_u32(static_cast<uint32_t>(static_cast<uint64_t>(record.timestamp_us) >> 32));
+    put_u32(static_cast<uint32_t>(record.timestamp_us));
+    put_u32(record.length);
+    put_u32(record.length);
+    buffer.insert(buffer.end(), record.data.begin(), record.data.begin() + record.length);
+    pad();
+
+    // the node address as comment, the direction as epb_flags bits 0-1
+    put_option(opt_comment, record.address.data(), std::strlen(record.address.data()));
+    uint32_t flags = record.direction;
+    put_option(opt_epb_flags, &flags, sizeof(flags));
+    put_option(opt_end, nullptr, 0);
+    put_u32(0);
+
+    uint32_t length = buffer.size() - start;
+    std::memcpy(&buffer[start + 4], &length, 4);
+    std::memcpy(&buffer[buffer.size() - 4], &length, 4);
+}
+
+void PacketCapture::write_buffer()
+{
+    if (buffer.empty() || !file)
+    {
+        buffer.clear();
+        return;
+    }
+
+    std::fwrite(buffer.data(), 1, buffer.size(), file);
+    std::fflush(file);
+    file_bytes += buffer.size();
+    buffer.clear();
+
+    if (file_bytes >= max_bytes)
+    {
+        // keep one previous file, a capture left on in production can't fill the disk
+        std::fclose(file);
+        file = nullptr;
+        std::rename(path.c_str(), (path + ".1").c_str());
+        file = std::fopen(path.c_str(), "wb");
+        file_bytes = 0;
+        if (file)
+        {
+            write_headers();
+            write_buffer();
+        }
+    }
+}
+
+void PacketCapture::put_u16(uint16_t value)
+{
+    auto bytes = reinterpret_cast<const uint8_t*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+}
+
+void PacketCapture::put_u32(uint32_t value)
+{
+    auto bytes = reinterpret_cast<const uint8_t*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+}
+
+void PacketCapture::put_option(uint16_t code, const void* value, uint16_t length)
+{
+    put_u16(code);
+    put_u16(length);
+    auto bytes = static_cast<const uint8_t*>(value);
+    buffer.insert(buffer.end(), bytes, bytes + length);
+    pad();
+}
+
+void PacketCapture::pad()
+{
+    while (buffer.size() % 4 != 0)
+    {
+        buffer.push_back(0);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef PACKET_CAPTURE_H
+#define PACKET_CAPTURE_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "spsc_queue.h"
+
+/* Responsibilities:
+    record mesh packets, encrypted and decrypted, with timestamp, direction and node address
+    write them to a pcapng file Wireshark can open, one interface per form
+    keep the packet path cheap: records go into a preallocated queue, a background thread encodes and writes them
+   All captured connections must run on one thread (the BLE loop), it is the queue's only producer.
+   Timestamps are monotonic, anchored to the wall clock when the capture starts, so they line up with
+   Home Assistant and broker logs. The file is rotated to <path>.1 once it reaches max_bytes.
+*/
+class PacketCapture {
+public:
+
+    // pcapng interface ids
+    enum Interface : uint32_t
+    {
+        ENCRYPTED = 0,
+        DECRYPTED = 1
+    };
+
+    enum Direction : uint8_t
+    {
+        INBOUND = 1,    // mesh -> gateway
+        OUTBOUND = 2    // gateway -> mesh
+    };
+
+    // throws std::runtime_error if the file can't be created
+    explicit PacketCapture(const std::string& path, uint64_t max_bytes = 100ull * 1024 * 1024);
+    ~PacketCapture();
+
+    PacketCapture(const PacketCapture&) = delete;
+    PacketCapture& operator=(const PacketCapture&) = delete;
+
+    // producer side, never blocks, counts a drop when the writer falls behind
+    void capture(Interface interface, Direction direction, const std::string& address, const uint8_t* data, size_t length);
+
+    // writes everything captured so far
+    void flush();
+
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+    static constexpr size_t max_packet = 20;
+    static constexpr uint16_t link_type = 147; // LINKTYPE_USER0, raw Telink mesh packets
+
+protected:
+
+    struct Record
+    {
+        int64_t timestamp_us = 0;
+        uint32_t interface = 0;
+        uint8_t direction = 0;
+        uint8_t length = 0;
+        std::array<uint8_t,max_packet> data{};
+        std::array<char,18> address{};  // "AA:BB:CC:DD:EE:FF"
+    };
+
+    void run();
+    void open();
+    void write_headers();
+    void encode(const Record& record);
+    void write_buffer();
+
+    void put_u16(uint16_t value);
+    void put_u32(uint32_t value);
+    void put_option(uint16_t code, const void* value, uint16_t length);
+    void pad();
+
+    std::string path;
+    uint64_t max_bytes;
+    FILE* file = nullptr;
+    uint64_t file_bytes = 0;
+
+    int64_t anchor_wall_us;
+    int64_t anchor_mono_us;
+
+    SpscQueue<Record,4096> queue;
+    std::atomic<uint64_t> dropped{0};
+
+    // writer side, guarded so flush() may also run from the producer thread
+    std::mutex write_mutex;
+    std::vector<uint8_t> buffer;
+
+    static constexpr unsigned int flush_interval_ms = 200;
+    std::mutex stop_mutex;
+    std::condition_variable stop_signal;
+    bool stopping = false;
+    std::thread writer;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "proxy_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <json/json.h>
+#include <glib.h>
+#include "../logging/log.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "ProxyCache"
+
+ProxyCache::ProxyCache(const std::string& state_file, size_t capacity, uint32_t max_failures)
+    : state_file(state_file), capacity(capacity), max_failures(max_failures)
+{
+    load();
+}
+
+void ProxyCache::recordSuccess(const std::string& address, int16_t rssi)
+{
+    auto it = std::find_if(entries.begin(), entries.end(), [&address](const Entry& e) { return e.Address == address; });
+    if (it == entries.end())
+    {
+        entries.push_back(Entry{address});
+        it = entries.end() - 1;
+    }
+
+    it->RSSI = rssi;
+    it->Successes++;
+    it->Failures = 0;
+    it->LastSuccess = std::time(nullptr);
+
+    // keep the best 'capacity' entries
+    auto ranked_entries = ranked();
+    if (ranked_entries.size() > capacity)
+    {
+        ranked_entries.resize(capacity);
+    }
+    entries = ranked_entries;
+
+    save();
+}
+
+void ProxyCache::recordFailure(const std::string& address)
+{
+    auto it = std::find_if(entries.begin(), entries.end(), [&address](const Entry& e) { return e.Address == address; });
+    if (it == entries.end())
+    {
+        return;
+    }
+
+    // a single timeout or a node briefly out of range keeps its history, it only ranks lower
+    it->Failures++;
+    if (it->Failures >= max_failures)
+    {
+        g_message("Forgetting proxy %s after %u failures in a row",address.c_str(),it->Failures);
+        entries.erase(it);
+    }
+    save();
+}
+
+std::vector<ProxyCache::Entry> ProxyCache::ranked() const
+{
+    auto ranked_entries = entries;
+    std::stable_sort(ranked_entries.begin(), ranked_entries.end(), [](const Entry& a, const Entry& b) {
+        if ((a.Failures == 0) != (b.Failures == 0))
+        {
+            return a.Failures == 0;
+        }
+        if (a.Successes != b.Successes)
+        {
+            return a.Successes > b.Successes;
+        }
+        return a.RSSI > b.RSSI;
+    });
+    return ranked_entries;
+}
+
+void ProxyCache::load()
+{
+    if (state_file.empty())
+    {
+        return;
+    }
+
+    std::ifstream file(state_file);
+    if (!file)
+    {
+        LOG_DEBUG("No proxy state file %s yet",state_file.c_str());
+        return;
+    }
+
+    Json::Value root;
+    Json::CharReaderBuilder reader;
+    std::string errs;
+    if (!Json::parseFromStream(reader, file, &root, &errs))
+    {
+        g_warning("Ignoring unreadable proxy state file %s: %s",state_file.c_str(),errs.c_str());
+        return;
+    }
+
+    for (const auto& node : root["proxies"])
+    {
+        Entry entry;
+        entry.Address = node["address"].asString();
+        entry.RSSI = static_cast<int16_t>(node["rssi"].asInt());
+        entry.Successes = node["successes"].asUInt();
+        entry.LastSuccess = node["last_success"].asInt64();
+        entry.Failures = node["failures"].asUInt();
+        if (!entry.Address.empty())
+        {
+            entries.push_back(entry);
+        }
+    }
+    g_message("Loaded %zu known proxy nodes from %s",entries.size(),state_file.c_str());
+}
+
+void ProxyCache::save() const
+{
+    if (state_file.empty())
+    {
+        return;
+    }
+
+    Json::Value root;
+    Json::Value proxies(Json::arrayValue);
+    for (const auto& entry : entries)
+    {
+        Json::Value node;
+        node["address"] = entry.Address;
+        node["rssi"] = entry.RSSI;
+        node["successes"] = entry.Successes;
+        node["last_success"] = static_cast<Json::Int64>(entry.LastSuccess);
+        node["failures"] = entry.Failures;
+        proxies.append(node);
+    }
+    root["proxies"] = proxies;
+
+    // write to a temporary file first, so a crash never leaves a truncated state file
+    const std::string tmp_file = state_file + ".tmp";
+    {
+        std::ofstream file(tmp_file, std::ios::trunc);
+        if (!file)
+        {
+            g_warning("Could not write proxy state file %s",tmp_file.c_str());
+            return;
+        }
+        Json::StreamWriterBuilder writer;
+        file << Json::writeString(writer, root);
+    }
+
+    if (std::rename(tmp_file.c_str(), state_file.c_str()) != 0)
+    {
+        g_warning("Could not replace proxy state file %s",state_file.c_str());
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef PROXY_CACHE_H
+#define PROXY_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Responsibilities:
+    remember mesh nodes we recently paired with successfully
+    penalise a node that failed, forget it only after several failures in a row
+    rank them so a restart or link loss can try a direct connect before scanning
+    persist the list to a small JSON state file
+*/
+class ProxyCache {
+public:
+
+    struct Entry
+    {
+        std::string Address;
+        int16_t RSSI = 0;
+        uint32_t Successes = 0;
+        int64_t LastSuccess = 0; // unix time, seconds
+        uint32_t Failures = 0;   // in a row, reset by a success
+    };
+
+    // an empty path keeps the cache in memory only
+    ProxyCache(const std::string& state_file, size_t capacity = 8, uint32_t max_failures = 3);
+
+    void recordSuccess(const std::string& address, int16_t rssi);
+    void recordFailure(const std::string& address);
+
+    // nodes without a failure since their last success first, then the most successful, RSSI breaks ties
+    std::vector<Entry> ranked() const;
+
+protected:
+
+    void load();
+    void save() const;
+
+    std::string state_file;
+    size_t capacity;
+    uint32_t max_failures;
+    std::vector<Entry> entries;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/* Bounded single producer / single consumer queue
+    lock free, one thread pushes and one thread pops.
+    Capacity must be a power of two, one slot is kept free to tell full from empty.
+*/
+template <typename T, size_t Capacity>
+class SpscQueue {
+public:
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    // producer side, false if the queue is full
+    bool push(T value)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t next = (tail + 1) & (Capacity - 1);
+        if (next == head_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        slots[tail] = std::move(value);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false if the queue is empty
+    bool pop(T& value)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        value = std::move(slots[head]);
+        slots[head] = T(); // release what the slot held, e.g. a shared_ptr
+        head_.store((head + 1) & (Capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, the index-th queued element from the front without removing it, nullptr beyond the last
+    const T* peek(size_t index) const
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        const size_t queued = (tail_.load(std::memory_order_acquire) - head) & (Capacity - 1);
+        if (index >= queued)
+        {
+            return nullptr;
+        }
+        return &slots[(head + index) & (Capacity - 1)];
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return Capacity - 1; }
+
+protected:
+    // producer and consumer indexes on separate cache lines
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) std::array<T, Capacity> slots{};
+};
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace BleTask {
+
+/* Responsibilities:
+    shared cancellation flag, every copy observes the same state
+    let suspended awaitables register a wakeup for when they are cancelled
+*/
+class CancelToken
+{
+    public:
+
+        CancelToken() : state(std::make_shared<State>()) {}
+
+        bool cancelled() const { return state->cancelled; }
+
+        void cancel()
+        {
+            if (state->cancelled)
+            {
+                return;
+            }
+            state->cancelled = true;
+            auto callbacks = std::move(state->callbacks);
+            state->callbacks.clear();
+            for (auto& [id, callback] : callbacks)
+            {
+                callback();
+            }
+        }
+
+        // callback runs once on cancel (at once if already cancelled), the id unregisters it
+        uint64_t on_cancel(std::function<void()> callback)
+        {
+            if (state->cancelled)
+            {
+                callback();
+                return 0;
+            }
+            auto id = state->next_id++;
+            state->callbacks.emplace(id, std::move(callback));
+            return id;
+        }
+
+        void forget(uint64_t id)
+        {
+            state->callbacks.erase(id);
+        }
+
+    protected:
+
+        struct State
+        {
+            bool cancelled = false;
+            uint64_t next_id = 1;
+            std::map<uint64_t,std::function<void()>> callbacks;
+        };
+        std::shared_ptr<State> state;
+};
+
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase
+{
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    // tasks are lazy, they run once awaited or started
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        // continue with the awaiting coroutine, a detached task just stops
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            auto continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<typename T>
+struct Promise : PromiseBase
+{
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+
+    template<typename U>
+    void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+    T result()
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template<>
+struct Promise<void> : PromiseBase
+{
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void result()
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+} // namespace detail
+
+/* Responsibilities:
+    own a coroutine frame, destroying the task destroys a suspended coroutine with it
+    let a coroutine co_await another one and receive its result or exception
+*/
+template<typename T>
+class [[nodiscard]] Task
+{
+    public:
+
+        using promise_type = detail::Promise<T>;
+
+        Task() = default;
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+        ~Task() { destroy(); }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+        Task& operator=(Task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                destroy();
+                handle = std::exchange(other.handle, nullptr);
+            }
+            return *this;
+        }
+
+        bool done() const { return !handle || handle.done(); }
+
+        // runs a task nobody awaits up to its first suspension
+        void start()
+        {
+            if (handle && !handle.done())
+            {
+                handle.resume();
+            }
+        }
+
+        // result or exception of a finished task
+        T result() { return handle.promise().result(); }
+
+        bool await_ready() const noexcept { return done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+
+        T await_resume() { return handle.promise().result(); }
+
+    protected:
+
+        void destroy()
+        {
+            if (handle)
+            {
+                handle.destroy();
+                handle = nullptr;
+            }
+        }
+
+        std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template<typename T>
+Task<T> Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/* Responsibilities:
+    run detached tasks and keep their frames until they finish
+    cancel every task spawned so far, later tasks get a fresh token
+   Destroying the scope destroys the tasks that are still suspended, so a
+   coroutine never resumes after the object it works on is gone.
+*/
+class TaskScope
+{
+    public:
+
+        explicit TaskScope(std::function<void(const std::exception&)> on_error = nullptr)
+            : on_error(on_error) {}
+
+        TaskScope(const TaskScope&) = delete;
+        TaskScope& operator=(const TaskScope&) = delete;
+
+        // token to hand to the tasks spawned next
+        CancelToken token() const { return cancel_token; }
+
+        void spawn(Task<void> task)
+        {
+            reap();
+            task.start();
+            if (task.done())
+            {
+                finish(task);
+            }
+            else
+            {
+                tasks.push_back(std::move(task));
+            }
+        }
+
+        // tasks see the cancellation at their next suspension point and wind down
+        void cancel()
+        {
+            auto cancelled = cancel_token;
+            cancel_token = CancelToken();
+            cancelled.cancel();
+        }
+
+        size_t size()
+        {
+            reap();
+            return tasks.size();
+        }
+
+    protected:
+
+        void reap()
+        {
+            for (auto it = tasks.begin(); it != tasks.end(); )
+            {
+                if (it->done())
+                {
+                    auto task = std::move(*it);
+                    it = tasks.erase(it);
+                    finish(task);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        void finish(Task<void>& task)
+        {
+            try
+            {
+                task.result();
+            }
+            catch (const std::exception& e)
+            {
+                if (on_error)
+                {
+                    on_error(e);
+                }
+            }
+            catch (...)
+            {
+            }
+        }
+
+        std::function<void(const std::exception&)> on_error;
+        CancelToken cancel_token;
+        std::vector<Task<void>> tasks;
+};
+
+} // namespace BleTask
+
+#endif
@@ -1,25 +1,78 @@
-
 #include "../crypto/crypto.h"
-#include <thread>
 
 #include "telink_mesh.h"
+#include "../logging/log.h"
+#include "../logging/metrics.h"
+#include <chrono>
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "Mesh"
 
+// exported on the metrics endpoint
+namespace
+{
+    std::string command_label(size_t command)
+    {
+        char hex[8];
+        snprintf(hex, sizeof(hex), "0x%02zx", command);
+        return hex;
+    }
+
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    const auto packets_tx = Metrics::instance().counter("meshgateway_mesh_packets_tx_total",
+                                "Mesh packets submitted to a proxy, by command", "command", 256, command_label);
+    const auto packets_rx = Metrics::instance().counter("meshgateway_mesh_packets_rx_total",
+                                "Mesh packets received from a proxy, by command", "command", 256, command_label);
+    const auto reconnects = Metrics::instance().counter("meshgateway_mesh_reconnects_total",
+                                "Proxy connections lost and queued for re-establishing");
+    auto& encrypt_time = Metrics::instance().histogram("meshgateway_crypto_seconds",
+                                "Time to encrypt or decrypt one mesh packet", "op", "encrypt", 1e-9);
+    auto& decrypt_time = Metrics::instance().histogram("meshgateway_crypto_seconds",
+                                "Time to encrypt or decrypt one mesh packet", "op", "decrypt", 1e-9);
+    auto& discovery_time = Metrics::instance().histogram("meshgateway_discovery_seconds",
+                                "Time from the start of a mesh discovery until a proxy is chosen");
+    auto& writes_in_flight = Metrics::instance().gauge("meshgateway_ble_writes_in_flight",
+                                "BLE writes submitted to BlueZ and not yet acknowledged");
+}
+
 TelinkMesh::TelinkMesh( BlueZProxy& bluetoothproxy,
                         const std::string& mesh_name,
                         const std::string& mesh_password,
-                        const uint16_t& vendor_code                        
+                        const uint16_t& vendor_code,
+                        size_t pool_size,
+                        const std::string& state_file,
+                        int16_t rssi_threshold,
+                        PacketCapture* capture
                                   ) : mesh_name(mesh_name),
                                       mesh_password(mesh_password),
                                       vendor_code(vendor_code),
-                                      ble(bluetoothproxy)
+                                      pool_size(std::max<size_t>(pool_size,1)),
+                                      rssi_threshold(rssi_threshold),
+                                      capture(capture),
+                                      proxy_cache(state_file),
+                                      ble(bluetoothproxy),
+                                      attempts([](const std::exception& e) { g_warning("Connection attempt aborted: %s",e.what()); })
 {        
 }
 
+// timers and deferred calls run on the context the mesh was created on,
+// the BLE thread's own context when it runs threaded
+static Glib::RefPtr<Glib::MainContext> mesh_context()
+{
+    return BleTask::thread_context();
+}
+
 TelinkMesh::~TelinkMesh()
-{}
+{
+    stop_scan();
+    replenishTimer.disconnect();
+    discoveryTimer.disconnect();
+    settleTimer.disconnect();
+}
 
 /*void TelinkMesh::setConnectedCallback(sigc::slot<void> connectCallback)
 {
@@ -33,7 +86,7 @@ void TelinkMesh::setRxCallback(sigc::slot<void,std::shared_ptr<TelinkMeshProtoco
 
 bool TelinkMesh::isReady()
 {
-    if (connectedDevice)
+    if (!connections.empty())
     {
         return true;
     }
@@ -51,145 +104,566 @@ void TelinkMesh::onReady(std::function<void()> callback)
 
 void TelinkMesh::send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
 {    
-    try
+    while (!connections.empty())
     {
-        if (!connectedDevice || !connectedDevice->send(packet))        
-        {            
-            throw std::runtime_error("Send failed");
+        auto& device = least_loaded();
+        if (device.send(packet))
+        {
+            return;
         }
+        // assume the connection is broken
+        LOG_DEBUG("Send to %s failed, assuming connection is broken.",device.device_info->Address.c_str());
+        drop_connection(&device);
+    }
+
+    discover();
+    throw std::runtime_error("Send failed, mesh not connected");
+}
+
+TelinkMesh::ConnectedDevice& TelinkMesh::least_loaded()
+{
+    // least queued writes wins, ties are served round robin
+    size_t best = next_connection % connections.size();
+    for (size_t i = 1; i < connections.size(); i++)
+    {
+        size_t candidate = (next_connection + i) % connections.size();
+        if (connections[candidate]->getQueueDepth() < connections[best]->getQueueDepth())
+        {
+            best = candidate;
+        }
+    }
+    next_connection = best + 1;
+    return *connections[best];
+}
+
+void TelinkMesh::on_send_failed(ConnectedDevice* device, std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
+{
+    // the device is still executing its write callback, release it from the main loop
+    mesh_context()->signal_idle().connect_once(sigc::bind(sigc::mem_fun(*this,&TelinkMesh::on_connection_lost),device,packet));
+}
+
+void TelinkMesh::on_connection_lost(ConnectedDevice* device, std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
+{
+    if (std::any_of(connections.begin(), connections.end(), [device](const auto& c) { return c.get() == device; }))
+    {
+        LOG_DEBUG("Write to %s failed, assuming connection is broken.",device->device_info->Address.c_str());
+        drop_connection(device);
+    }
+
+    if (!packet)
+    {
+        // notifications could not be enabled, nothing to resend
+        return;
+    }
+
+    try
+    {
+        send(packet);
     }
     catch(const std::exception& e)
     {
-        // assume the connection is broken
-        g_debug("Send error %s, assuming connection is broken.",e.what());
-        connectedDevice = nullptr;
-        discover();
-        throw;
+        // keep it for when the mesh is ready again
+        if (resend_queue.size() < max_resend_queue)
+        {
+            resend_queue.push_back(packet);
+        }
+        else
+        {
+            g_warning("Dropping mesh packet, resend queue is full.");
+        }
     }
-    catch(...)
+}
+
+void TelinkMesh::drop_connection(ConnectedDevice* device)
+{
+    auto it = std::find_if(connections.begin(), connections.end(), [device](const auto& c) { return c.get() == device; });
+    if (it == connections.end())
     {
-        // assume the connection is broken
-        g_debug("Unknown exception type during send, assuming connection is broken.");
-        connectedDevice = nullptr;
-        discover();
-        throw;
+        return;
+    }
+
+    candidates.erase(device->device_info->Address);
+    connections.erase(it);
+    reconnects.inc();
+
+    promote_standby();
+
+    // re-establish missing connections in the background
+    schedule_replenish(2000);
+}
+
+bool TelinkMesh::promote_standby()
+{
+    if (!standbyDevice)
+    {
+        return false;
+    }
+
+    g_message("Failing over to standby connection %s(%s)",
+               standbyDevice->device_info->Name.c_str(),
+               standbyDevice->device_info->Address.c_str());
+
+    standbyDevice->activate_notifications();
+    connections.push_back(std::move(standbyDevice));
+    return true;
+}
+
+void TelinkMesh::schedule_replenish(unsigned int delay_ms)
+{
+    replenishTimer.disconnect();
+    replenishTimer = mesh_context()->signal_timeout().connect([this]() { replenish(); return false; }, delay_ms);
+}
+
+void TelinkMesh::replenish()
+{
+    if (connections.empty())
+    {
+        // discovery takes over
+        return;
+    }
+
+    // pair the missing pooled connections and the standby concurrently
+    size_t wanted = (pool_size - std::min(pool_size, connections.size())) + (standbyDevice ? 0 : 1);
+    size_t in_flight = attempting.size();
+    for (auto& candidate : ranked_candidates())
+    {
+        if (in_flight >= wanted)
+        {
+            return;
+        }
+
+        if (in_use(candidate->Address) || attempting.count(candidate->Address))
+        {
+            continue;
+        }
+
+        attempts.spawn(attempt(candidate, 1, attempts.token()));
+        in_flight++;
+    }
+
+    if (in_flight == 0 && wanted > 0)
+    {
+        g_warning("Only %zu of %zu pooled connections (standby: %s) available for %s",
+                  connections.size(), pool_size, standbyDevice ? "yes" : "no", mesh_name.c_str());
+    }
+}
+
+bool TelinkMesh::in_use(const std::string& address)
+{
+    if (standbyDevice && standbyDevice->device_info->Address == address)
+    {
+        return true;
+    }
+    return std::any_of(connections.begin(), connections.end(),
+                       [&address](const auto& c) { return c->device_info->Address == address; });
+}
+
+std::unique_ptr<TelinkMesh::ConnectedDevice> TelinkMesh::make_connection(std::shared_ptr<BlueZProxy::Device> device_info)
+{
+    return std::make_unique<ConnectedDevice>(ble,
+                                             device_info,
+                                             mesh_name,
+                                             mesh_password,
+                                             vendor_code,
+                                             sigc::mem_fun(this,&TelinkMesh::on_packet_rx),
+                                             sigc::mem_fun(this,&TelinkMesh::on_send_failed),
+                                             capture);
+}
+
+std::vector<std::shared_ptr<BlueZProxy::Device>> TelinkMesh::ranked_candidates()
+{
+    std::vector<std::shared_ptr<BlueZProxy::Device>> ranked;
+    for (auto& [address, device] : candidates)
+    {
+        ranked.push_back(device);
     }
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a->RSSI > b->RSSI; });
+    return ranked;
 }
 
 void TelinkMesh::discover()
 {   
     if (!discovering)
     {        
+        // attempts still in flight wind down at their next suspension point
+        attempts.cancel();
         ble.disconnect_by_name(mesh_name);
-        ble.stop_scan();
+        stop_scan();
         discovering = true;
-        connectedDevice = nullptr;
+        discovery_started_us = LatencyTracer::now_us();
+        replenishTimer.disconnect();
+        standbyDevice = nullptr;
+        connections.clear();
         current_best_device = nullptr;
+        candidates.clear();
+        scan_backoff_ms = min_scan_backoff_ms;
         // start scanning for a mesh device
-        ble.start_rssi_scan(sigc::mem_fun(this,&TelinkMesh::on_device_found_rssi));
-        g_message("Scanning for %s",mesh_name.c_str());
-        // Set a timeout to check discovery after 'timeout_seconds' seconds    
-        Glib::signal_timeout().connect([this]()
-        {                
-            if (this->current_best_device)
+        start_scan_window();
+        // meanwhile, try the proxy that worked best before
+        fast_connect();
+    }
+}
+
+void TelinkMesh::start_scan_window()
+{
+    // let BlueZ drop everything that can't be one of our mesh nodes
+    BlueZProxy::DiscoveryFilter filter;
+    filter.Transport = "le";
+    filter.RSSI = min_rssi;
+    filter.Pattern = mesh_name;
+    stop_scan();
+    scan = ble.start_rssi_scan(sigc::mem_fun(this,&TelinkMesh::on_device_found_rssi),filter);
+    g_message("Scanning for %s",mesh_name.c_str());
+
+    // connect to the best node found within the window, unless a strong node shows up earlier
+    discoveryTimer.disconnect();
+    discoveryTimer = mesh_context()->signal_timeout().connect(sigc::bind_return(sigc::mem_fun(*this,&TelinkMesh::on_scan_window_end),false),
+                                                    scan_window_ms);
+}
+
+void TelinkMesh::stop_scan()
+{
+    // other meshes on the same BlueZProxy may still be scanning
+    if (scan)
+    {
+        ble.stop_scan(scan);
+        scan = 0;
+    }
+}
+
+void TelinkMesh::on_scan_window_end()
+{
+    if (current_best_device)
+    {
+        conclude_discovery();
+        return;
+    }
+
+    // duty cycle the radio instead of monopolising it with an endless scan
+    stop_scan();
+    g_warning("No device with name %s found during scan. Scanning again in %u ms...",mesh_name.c_str(),scan_backoff_ms);
+    discoveryTimer = mesh_context()->signal_timeout().connect(sigc::bind_return(sigc::mem_fun(*this,&TelinkMesh::start_scan_window),false),
+                                                    scan_backoff_ms);
+    scan_backoff_ms = std::min(scan_backoff_ms*2,max_scan_backoff_ms);
+}
+
+void TelinkMesh::conclude_discovery()
+{
+    if (!discovering)
+    {
+        return;
+    }
+
+    end_discovery();
+
+    if (attempting.count(current_best_device->Address))
+    {
+        // already being tried as a known proxy
+        return;
+    }
+    attempts.spawn(attempt(current_best_device, best_candidate_tries, attempts.token()));
+}
+
+void TelinkMesh::end_discovery()
+{
+    if (discovering)
+    {
+        discovery_time.record(LatencyTracer::now_us() - discovery_started_us);
+    }
+    discoveryTimer.disconnect();
+    settleTimer.disconnect();
+    stop_scan();
+    discovering = false;
+}
+
+void TelinkMesh::fast_connect()
+{
+    // try the proxies that worked best before while the scan runs, the first to pair ends discovery
+    auto known = proxy_cache.ranked();
+    for (size_t i = 0; i < known.size() && i < pool_size; i++)
+    {
+        auto candidate = std::make_shared<BlueZProxy::Device>();
+        candidate->Address = known[i].Address;
+        candidate->Name = mesh_name;
+        candidate->RSSI = known[i].RSSI;
+        g_message("Trying known proxy %s while scanning",candidate->Address.c_str());
+        attempts.spawn(attempt(candidate, 1, attempts.token()));
+    }
+}
+
+BleTask::Task<void> TelinkMesh::attempt(std::shared_ptr<BlueZProxy::Device> candidate, unsigned int tries, BleTask::CancelToken cancel)
+{
+    const std::string address = candidate->Address;
+    attempting.insert(address);
+
+    std::unique_ptr<ConnectedDevice> device;
+    for (unsigned int i = 0; i < tries && !device && !cancel.cancelled(); i++)
+    {
+        if (i > 0)
+        {
+            g_warning("Connecting to device %s failed, trying again...",address.c_str());
+            if (!co_await BleTask::sleep(retry_delay_ms, cancel))
             {
-                this->ble.stop_scan();
-                discovering = false;
-                this->connect(1);                
-                return false;
+                break;
             }
-            else
+        }
+
+        try
+        {
+            device = co_await establish(candidate, cancel);
+        }
+        catch (const std::exception& e)
+        {
+            g_warning("Connection attempt to %s failed: %s",address.c_str(),e.what());
+        }
+    }
+
+    attempting.erase(attempting.find(address));
+
+    if (cancel.cancelled())
+    {
+        // discovery restarted meanwhile, dropping the connection disconnects it
+        co_return;
+    }
+
+    if (device)
+    {
+        adopt(std::move(device));
+    }
+    else
+    {
+        on_attempt_failed(candidate);
+    }
+}
+
+BleTask::Task<std::unique_ptr<TelinkMesh::ConnectedDevice>> TelinkMesh::establish(std::shared_ptr<BlueZProxy::Device> candidate, BleTask::CancelToken cancel)
+{
+    if (!co_await BleTask::connect(ble, candidate->Address, connect_timeout_ms, cancel))
+    {
+        co_return nullptr;
+    }
+
+    auto device = make_connection(candidate);
+    if (!co_await device->pair(cancel))
+    {
+        co_return nullptr;
+    }
+    co_return std::move(device);
+}
+
+void TelinkMesh::adopt(std::unique_ptr<ConnectedDevice> device)
+{
+    auto info = device->device_info;
+
+    if (discovering)
+    {
+        // a known proxy won the race against the scan
+        end_discovery();
+
+        // the scan was cut short, the other known proxies are pool/failover candidates as well
+        for (auto& entry : proxy_cache.ranked())
+        {
+            if (candidates.find(entry.Address) == candidates.end())
             {
-                g_warning("No device with name %s found during scan. Continuing scan...",this->mesh_name.c_str());            
-                return true;
+                auto known = std::make_shared<BlueZProxy::Device>();
+                known->Address = entry.Address;
+                known->Name = mesh_name;
+                known->RSSI = entry.RSSI;
+                candidates[entry.Address] = known;
             }
-        }, 5000);
+        }
+        candidates[info->Address] = info;
+    }
+
+    if (connections.size() < pool_size)
+    {
+        device->activate_notifications();
+        g_message("Paired with %s(%s)",info->Name.c_str(),info->Address.c_str());
+        proxy_cache.recordSuccess(info->Address,info->RSSI);
+        connections.push_back(std::move(device));
+        if (connections.size() == 1)
+        {
+            on_first_connection();
+        }
+    }
+    else if (!standbyDevice)
+    {
+        // keep it paired, but silent until it gets promoted
+        g_message("Standby connection paired with %s(%s)",info->Name.c_str(),info->Address.c_str());
+        proxy_cache.recordSuccess(info->Address,info->RSSI);
+        standbyDevice = std::move(device);
+    }
+    else
+    {
+        // several attempts raced for the last slot
+        LOG_DEBUG("Dropping surplus connection to %s",info->Address.c_str());
     }
 }
 
+void TelinkMesh::on_attempt_failed(std::shared_ptr<BlueZProxy::Device> candidate)
+{
+    g_message("Could not pair with %s",candidate->Address.c_str());
+    proxy_cache.recordFailure(candidate->Address);
+    // don't try it again until the next discovery
+    candidates.erase(candidate->Address);
+
+    if (!connections.empty())
+    {
+        // continue with the next candidate
+        replenish();
+    }
+    else if (!discovering && attempting.empty())
+    {
+        g_warning("No mesh connection could be established, fallback to discovery...");
+        discover();
+    }
+}
+
+void TelinkMesh::on_first_connection()
+{
+    if (callback_on_ready)
+    {
+        auto callback = callback_on_ready;
+        callback_on_ready=nullptr;
+        callback();
+    }
+
+    // packets whose connection broke while in flight
+    auto pending = std::move(resend_queue);
+    resend_queue.clear();
+    for (auto& packet : pending)
+    {
+        try
+        {
+            send(packet);
+        }
+        catch(const std::exception& e)
+        {
+            g_warning("Resend failed: %s",e.what());
+        }
+    }
+
+    // fill the pool and pair a standby once queued commands have gone out
+    schedule_replenish(2000);
+}
+
 bool TelinkMesh::ConnectedDevice::send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
 {
     if(packet_seq == 0) {packet_seq++;}
     packet->setSeq(packet_seq++);    
     packet->setVendorCode(vendor_code);
 
-    g_debug("Sending mesh packet:");
-    packet->debug();
+    LOG_SAMPLED(g_debug("Sending mesh packet via %s:",device_info->Address.c_str()); packet->debug());
     auto data = packet->getData();
+    auto encrypt_start = now_ns();
     auto enc_packet = crypto::encrypt_packet(shared_key, macdata, data);
+    encrypt_time.record(now_ns() - encrypt_start);
 
-    return ble.write(device_info->Address,"00010203-0405-0607-0809-0a0b0c0d1912",enc_packet);   
-}
+    // the callback only runs for writes that were actually submitted
+    if (!ble.write_async(device_info->Address,
+                         "00010203-0405-0607-0809-0a0b0c0d1912",
+                         enc_packet,
+                         sigc::bind(sigc::mem_fun(*this,&TelinkMesh::ConnectedDevice::on_write_done),packet)))
+    {
+        return false;
+    }
+    queue_depth++;
+    writes_in_flight++;
+    packets_tx.inc(packet->getCommand());
+    LatencyTracer::instance().submitted(packet->getTrace());
 
-void TelinkMesh::on_device_found_rssi(std::shared_ptr<BlueZProxy::Device> device_info)
-{
-    // check if device matches the filter and if device RSSI is better than what we have seen so far
-    if ((device_info->Name == mesh_name)
-        && (!current_best_device || device_info->RSSI > current_best_device->RSSI))
+    if (capture)
     {
-        current_best_device = device_info;
+        capture->capture(PacketCapture::DECRYPTED, PacketCapture::OUTBOUND, device_info->Address, data.data(), data.size());
+        capture->capture(PacketCapture::ENCRYPTED, PacketCapture::OUTBOUND, device_info->Address, enc_packet.data(), enc_packet.size());
     }
+    return true;
 }
 
-void TelinkMesh::on_packet_rx(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
+void TelinkMesh::ConnectedDevice::on_write_done(bool success, std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
 {
-    sigPacketRx.emit(packet);
+    queue_depth--;
+    writes_in_flight--;
+    if (!success)
+    {
+        sigSendFailed.emit(this,packet);
+        return;
+    }
+    LatencyTracer::instance().written(packet->getTrace());
 }
 
-void TelinkMesh::connect(uint8_t retries)
+void TelinkMesh::on_device_found_rssi(std::shared_ptr<BlueZProxy::Device> device_info)
 {
-    if (current_best_device && ble.connect(current_best_device->Address))    
+    if (device_info->Name != mesh_name)
     {
-        connectedDevice=std::make_unique<ConnectedDevice>(ble,
-                                                         current_best_device,
-                                                         mesh_name,
-                                                         mesh_password,
-                                                         vendor_code,
-                                                         sigc::mem_fun(this,&TelinkMesh::on_packet_rx));
-        pair(1);
+        return;
     }
-    else if (retries>0)
+
+    // remember every mesh node as a pool/failover candidate
+    candidates[device_info->Address] = device_info;
+
+    // check if device RSSI is better than what we have seen so far
+    if (!current_best_device || device_info->RSSI > current_best_device->RSSI)
+    {
+        current_best_device = device_info;
+    }
+
+    if (!discovering)
     {
-        g_warning("Connecting to device %s failed, trying again...",current_best_device->Address.c_str());
-        Glib::signal_timeout().connect_once([this,retries]() { connect(retries-1);}, 5000);
-    } else
+        return;
+    }
+
+    if (device_info->RSSI >= rssi_threshold)
     {
-        // retry discovery
-        g_warning("Connecting to device %s failed, fallback to discovery...",current_best_device->Address.c_str());
-        this->discover();
+        // good enough, connect right away (outside of the BlueZ signal emission)
+        LOG_DEBUG("%s is above the RSSI threshold (%d dBm)",device_info->Address.c_str(),device_info->RSSI);
+        settleTimer.disconnect();
+        settleTimer = mesh_context()->signal_idle().connect(sigc::bind_return(sigc::mem_fun(*this,&TelinkMesh::conclude_discovery),false));
+    }
+    else if (!settleTimer.connected())
+    {
+        // give stronger nodes a moment to show up
+        settleTimer = mesh_context()->signal_timeout().connect(sigc::bind_return(sigc::mem_fun(*this,&TelinkMesh::conclude_discovery),false),
+                                                     settle_ms);
     }
 }
 
-void TelinkMesh::pair(uint8_t retries)
+void TelinkMesh::on_packet_rx(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
 {
-    if (connectedDevice->pair())
+    // every pooled connection relays the same mesh traffic, only pass on the first copy
+    if (is_duplicate(packet))
     {
-        connectedDevice->activate_notifications();        
-
-        g_message("Paired with %s(%s)",
-                   connectedDevice->device_info->Name.c_str(),
-                   connectedDevice->device_info->Address.c_str());   
-       // sigConnected.emit();
+        return;
+    }
+    sigPacketRx.emit(packet);
+}
 
-       Glib::signal_timeout().connect_once([this]() {
-            if (callback_on_ready)
-            {
-                callback_on_ready();
-                callback_on_ready=nullptr;
-            }
-       },500);
+bool TelinkMesh::is_duplicate(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>& packet)
+{
+    if (connections.size() < 2)
+    {
+        return false;
     }
-    else if (retries>0)
+
+    // FNV-1a over the decrypted packet
+    uint64_t hash = 14695981039346656037ull;
+    for (auto byte : packet->getData())
     {
-        g_warning("Pairing with device %s failed, trying again...",current_best_device->Address.c_str());
-        Glib::signal_timeout().connect_once([this,retries]() { pair(retries-1);}, 5000);
-    } else
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+
+    auto now = g_get_monotonic_time();
+    for (auto& seen : recent_rx)
     {
-        // retry discovery
-        g_warning("Pairing with device %s failed, fallback to discovery...",current_best_device->Address.c_str());
-        this->discover();
+        if (seen.hash == hash && now - seen.time_us < duplicate_window_us)
+        {
+            return true;
+        }
     }
 
+    recent_rx[recent_rx_next] = {hash, now};
+    recent_rx_next = (recent_rx_next + 1) % recent_rx.size();
+    return false;
 }
 
 TelinkMesh::ConnectedDevice::ConnectedDevice( BlueZProxy& ble,
@@ -197,76 +671,138 @@ TelinkMesh::ConnectedDevice::ConnectedDevice( BlueZProxy& ble,
                 std::string mesh_name,
                 std::string mesh_password,
                 uint16_t vendor_code,
-                sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback)
+                sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback,
+                sigc::slot<void,ConnectedDevice*,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> sendFailedCallback,
+                PacketCapture* capture)
                     : ble(ble),
                       device_info(device_info),
                       mesh_name(mesh_name),
                       mesh_password(mesh_password),
-                      vendor_code(vendor_code)
+                      vendor_code(vendor_code),
+                      capture(capture)
 {
     sigPacketRx.connect(rxCallback);
+    sigSendFailed.connect(sendFailedCallback);
     macdata = mac_to_reversed_vector(device_info->Address);
 }
 
 TelinkMesh::ConnectedDevice::~ConnectedDevice()
 {
+    // completions of writes still in flight no longer reach this device
+    writes_in_flight -= queue_depth;
+    notifySubscription.release();
     ble.disconnect(device_info->Address);
 }
 
-bool TelinkMesh::ConnectedDevice::pair()
+BleTask::Task<bool> TelinkMesh::ConnectedDevice::pair(BleTask::CancelToken cancel)
 {
     // Prepare pairing request
     auto data = std::vector<uint8_t>(16,0x00);
-    auto random_data = crypto::get_random_bytes(8);
-    for (int i=0;i<8;i++){data[i]=random_data[i];}
+    auto pairing_random = crypto::get_random_bytes(8);
+    for (int i=0;i<8;i++){data[i]=pairing_random[i];}
     auto enc_data = crypto::key_encrypt(mesh_name, mesh_password, data);
     std::vector<uint8_t> packet = {0x0c}; // Start with 0x0c
     packet.insert(packet.end(), data.begin(), data.begin()+8); // Add data
     packet.insert(packet.end(), enc_data.begin(), enc_data.begin() + 8); // Add first 8 bytes of encrypted data
 
-    const std::string pairing_char_uuid = "00010203-0405-0607-0809-0a0b0c0d1914";
+    LOG_DEBUG("Submitting pairing request");
+    auto deadline_us = g_get_monotonic_time() + static_cast<int64_t>(pairing_timeout_ms) * 1000;
+    if (!co_await BleTask::write(ble, device_info->Address, pairing_char_uuid, packet, pairing_timeout_ms, cancel))
+    {
+        LOG_DEBUG("Pairing with %s failed",device_info->Address.c_str());
+        co_return false;
+    }
 
-    g_debug("Submitting pairing request");
-    // submit pairing request
-    if (!ble.write(device_info->Address,pairing_char_uuid,packet)){return false;};
+    while (!cancel.cancelled())
+    {
+        auto remaining_ms = (deadline_us - g_get_monotonic_time()) / 1000;
+        if (remaining_ms <= 0)
+        {
+            break;
+        }
 
-    // wait for response
-    g_debug("Waiting for 500ms...");
-    std::this_thread::sleep_for(std::chrono::milliseconds(500)) ;
-    // read pairing response
-    g_debug("Reading pairing response");
-    auto data2 = ble.read(device_info->Address,pairing_char_uuid);       
-        
-    // Generate the shared key
-    shared_key = crypto::generate_sk(mesh_name,mesh_password,random_data,std::vector<uint8_t>(data2.begin()+1,data2.begin()+9));
+        // read pairing response
+        LOG_DEBUG("Reading pairing response");
+        auto response = co_await BleTask::read(ble, device_info->Address, pairing_char_uuid, remaining_ms, cancel);
+        if (response && response->size() >= 9 && (*response)[0] == 0x0d)
+        {
+            // Generate the shared key
+            shared_key = crypto::generate_sk(mesh_name,mesh_password,pairing_random,std::vector<uint8_t>(response->begin()+1,response->begin()+9));
+            co_return true;
+        }
+        if (response && !response->empty() && (*response)[0] != 0x0c)
+        {
+            g_warning("Pairing rejected by %s (0x%02X), check mesh name and password",device_info->Address.c_str(),(*response)[0]);
+            co_return false;
+        }
 
-    return true;
+        // the peer has not answered yet (still reads back our request), poll again shortly
+        co_await BleTask::sleep(pairing_poll_ms, cancel);
+    }
+
+    LOG_DEBUG("Pairing with %s failed",device_info->Address.c_str());
+    co_return false;
 }
 
 void TelinkMesh::ConnectedDevice::activate_notifications()
 {
-        g_debug("Enabling data notifications");
+    tasks.spawn(notifications(tasks.token()));
+}
+
+BleTask::Task<void> TelinkMesh::ConnectedDevice::notifications(BleTask::CancelToken cancel)
+{
+        LOG_DEBUG("Enabling data notifications");
         // IMPORTANT - IMPORTANT - IMPORTANT - IMPORTANT - IMPORTANT - IMPORTANT - IMPORTANT 
         //        This requires a patched bluez stack, or else a timeout will occur!!!!
         // IMPORTANT - IMPORTANT - IMPORTANT - IMPORTANT - IMPORTANT - IMPORTANT - IMPORTANT 
-        ble.start_notify(device_info->Address,
-                         "00010203-0405-0607-0809-0a0b0c0d1911",
-                        sigc::mem_fun(this, &TelinkMesh::ConnectedDevice::on_data_rx));
+        bool enabled = co_await BleTask::start_notify(ble, device_info->Address, notify_char_uuid,
+                                                      sigc::mem_fun(this, &TelinkMesh::ConnectedDevice::on_data_rx),
+                                                      notifySubscription, notify_timeout_ms, cancel);
 
         // we need to write this value to actually start notifications
-        ble.write(device_info->Address,"00010203-0405-0607-0809-0a0b0c0d1911",std::vector<uint8_t>({0x01}));
-     
+        if (enabled)
+        {
+            const std::vector<uint8_t> enable = {0x01};
+            enabled = co_await BleTask::write(ble, device_info->Address, notify_char_uuid, enable, notify_timeout_ms, cancel);
+        }
+
+        if (!enabled && !cancel.cancelled())
+        {
+            g_warning("Could not enable notifications on %s",device_info->Address.c_str());
+            sigSendFailed.emit(this,nullptr);
+        }
 }
 
-void TelinkMesh::ConnectedDevice::on_data_rx(const std::vector<uint8_t>& data)
+void TelinkMesh::ConnectedDevice::on_data_rx(const uint8_t* data, size_t length)
 {        
     try {    
-        auto decrypted_data = crypto::decrypt_packet(shared_key,macdata,data);
+        if (capture) {
+            capture->capture(PacketCapture::ENCRYPTED, PacketCapture::INBOUND, device_info->Address, data, length);
+        }
+
+        // the notification payload is borrowed, decrypt a stack copy in place
+        std::array<uint8_t,MAX_PACKET_SIZE> buffer;
+        if (length != buffer.size()) {
+            throw std::invalid_argument("Data must be 20 bytes");
+        }
+        std::copy(data, data + length, buffer.begin());
+        auto decrypt_start = now_ns();
+        const bool decrypted = crypto::decrypt_packet_in_place(shared_key,macdata,buffer.data(),buffer.size());
+        decrypt_time.record(now_ns() - decrypt_start);
+        if (!decrypted) {
+            // the buffer is still ciphertext, parsing it would make up a packet
+            g_warning("Could not decrypt data from %s, dropping data packet.",device_info->Address.c_str());
+            return;
+        }
+
+        if (capture) {
+            capture->capture(PacketCapture::DECRYPTED, PacketCapture::INBOUND, device_info->Address, buffer.data(), buffer.size());
+        }
         
-        auto packet = TelinkMeshProtocol::TelinkMeshPacket::create(decrypted_data);
+        auto packet = TelinkMeshProtocol::TelinkMeshPacket::create(buffer.data(),buffer.size());
+        packets_rx.inc(packet->getCommand());
         
-        g_info("Received mesh packet");
-        packet->debug();
+        LOG_SAMPLED(g_debug("Received mesh packet via %s:",device_info->Address.c_str()); packet->debug());
         sigPacketRx.emit(packet);
     }
     catch(std::exception e)
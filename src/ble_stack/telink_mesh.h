@@ -3,33 +3,49 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <set>
+#include <array>
 
 #include "bluezproxy.h"
+#include "ble_await.h"
+#include "mesh_link.h"
 #include "telink_mesh_protocol.h"
+#include "proxy_cache.h"
+#include "packet_capture.h"
 
 /* Responsibilities:
-    establish and maintain mesh node connection
+    establish and maintain a pool of mesh node connections
     send and receive mesh packets
     encrypt/decrypt packets
+   Each connection attempt (connect, pair) runs as one coroutine on the GLib loop,
+   so several attempts proceed concurrently without blocking it.
 */
-class TelinkMesh {
+class TelinkMesh : public MeshLink, public sigc::trackable {
 public:
     
     TelinkMesh(BlueZProxy& bluetoothproxy,
                const std::string& mesh_name,
                const std::string& mesh_password,
-               const uint16_t& vendor_code
+               const uint16_t& vendor_code,
+               size_t pool_size = 1,
+               const std::string& state_file = "",
+               int16_t rssi_threshold = -70,
+               PacketCapture* capture = nullptr    // optional, must outlive the mesh
     );
     ~TelinkMesh();
     
     void setConnectedCallback(sigc::slot<void> connectCallback);
-    void setRxCallback(sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback);    
+    void setRxCallback(sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback) override;    
 
-    bool isReady();
+    bool isReady() override;
     
-    void onReady(std::function<void()> callback);
+    void onReady(std::function<void()> callback) override;
 
-    void send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet);
+    void send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet) override;
+
+    // like isReady, without starting discovery
+    bool hasConnection() const { return !connections.empty(); }
 
 protected:
     
@@ -53,48 +69,136 @@ protected:
                              std::string mesh_name,
                              std::string mesh_password,
                              uint16_t vendor_code,
-                             sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback);                             
+                             sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback,
+                             sigc::slot<void,ConnectedDevice*,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> sendFailedCallback,
+                             PacketCapture* capture = nullptr);
             
             ~ConnectedDevice();
 
-            bool pair();
+            // resumes with whether a session key was established
+            BleTask::Task<bool> pair(BleTask::CancelToken cancel);
+            // enables notifications in the background, a failure is reported through sendFailedCallback without a packet
             void activate_notifications();
+            // submits the packet, a failed write is reported through sendFailedCallback
             bool send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet);
+            unsigned int getQueueDepth() const { return queue_depth; }
 
             std::shared_ptr<BlueZProxy::Device> device_info;
         protected:
-            void on_data_rx(const std::vector<uint8_t>& data);
+            void on_data_rx(const uint8_t* data, size_t length);
+            void on_write_done(bool success, std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet);
+            BleTask::Task<void> notifications(BleTask::CancelToken cancel);
             std::vector<uint8_t> mac_to_reversed_vector(const std::string& mac_address);
 
             BlueZProxy& ble;        
-            uint16_t packet_seq = 1;
+            BlueZProxy::Subscription notifySubscription;
+            uint16_t packet_seq = 1; // per connection, each node tracks the sequence of its own link
+            unsigned int queue_depth = 0; // writes submitted but not yet acknowledged
             std::string mesh_name;
             std::string mesh_password;
             uint16_t vendor_code;
             std::vector<uint8_t> macdata;
             std::vector<uint8_t> shared_key;
+            PacketCapture* capture;
+
+            static constexpr const char* pairing_char_uuid = "00010203-0405-0607-0809-0a0b0c0d1914";
+            static constexpr const char* notify_char_uuid = "00010203-0405-0607-0809-0a0b0c0d1911";
+            static constexpr unsigned int pairing_poll_ms = 10;
+            static constexpr unsigned int pairing_timeout_ms = 2000;
+            static constexpr unsigned int notify_timeout_ms = 5000;
 
             sigc::signal<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> sigPacketRx;
+            sigc::signal<void,ConnectedDevice*,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> sigSendFailed;
+
+            // background tasks of this connection, destroyed with it
+            BleTask::TaskScope tasks;
             
     };
 
     void discover();
-    void connect(uint8_t retries);
-    void pair(uint8_t retries);
+    void start_scan_window();
+    void stop_scan();
+    void on_scan_window_end();
+    void conclude_discovery();
+    void end_discovery();
+    void fast_connect();
+    BleTask::Task<void> attempt(std::shared_ptr<BlueZProxy::Device> candidate, unsigned int tries, BleTask::CancelToken cancel);
+    BleTask::Task<std::unique_ptr<ConnectedDevice>> establish(std::shared_ptr<BlueZProxy::Device> candidate, BleTask::CancelToken cancel);
+    void adopt(std::unique_ptr<ConnectedDevice> device);
+    void on_attempt_failed(std::shared_ptr<BlueZProxy::Device> candidate);
+    void on_first_connection();
+    void schedule_replenish(unsigned int delay_ms);
+    void replenish();
+    bool promote_standby();
+    void drop_connection(ConnectedDevice* device);
+    bool in_use(const std::string& address);
+    ConnectedDevice& least_loaded();
+    std::unique_ptr<ConnectedDevice> make_connection(std::shared_ptr<BlueZProxy::Device> device_info);
+    std::vector<std::shared_ptr<BlueZProxy::Device>> ranked_candidates();
     void on_device_found_rssi(std::shared_ptr<BlueZProxy::Device> device_info);    
     void on_packet_rx(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet);
+    bool is_duplicate(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>& packet);
+    void on_send_failed(ConnectedDevice* device, std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet);
+    void on_connection_lost(ConnectedDevice* device, std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet);
     
     
     std::string mesh_name;
     std::string mesh_password;
     uint16_t vendor_code;
+    size_t pool_size;
+
+    // discovery: connect at once above the threshold, otherwise shortly after the first match
+    int16_t rssi_threshold;
+    PacketCapture* capture;
+    static constexpr int16_t min_rssi = -90; // nodes below this are not worth a connection attempt
+    static constexpr unsigned int settle_ms = 1500;
+    static constexpr unsigned int scan_window_ms = 5000;
+    static constexpr unsigned int min_scan_backoff_ms = 2000;
+    static constexpr unsigned int max_scan_backoff_ms = 60000;
+    unsigned int scan_backoff_ms = min_scan_backoff_ms;
+    sigc::connection settleTimer;
+
+    // recently successful proxies, tried directly while discovery scans
+    ProxyCache proxy_cache;
+    sigc::connection discoveryTimer;
+    BlueZProxy::ScanHandle scan = 0;
 
     std::shared_ptr<BlueZProxy::Device> current_best_device = nullptr;
-    std::unique_ptr<ConnectedDevice> connectedDevice = nullptr;
+    // connection attempts
+    static constexpr unsigned int connect_timeout_ms = 10000;
+    static constexpr unsigned int retry_delay_ms = 5000;
+    static constexpr unsigned int best_candidate_tries = 2;
+    std::multiset<std::string> attempting; // addresses with an attempt in flight, cancelled ones until they wind down
+    // paired and notifying connections, TX is spread over them by queue depth
+    std::vector<std::unique_ptr<ConnectedDevice>> connections;
+    size_t next_connection = 0;
+    // paired (but not notifying) connection to the next best node, promoted when a pooled connection fails
+    std::unique_ptr<ConnectedDevice> standbyDevice = nullptr;
+    // mesh nodes seen during the last discovery, by address
+    std::map<std::string,std::shared_ptr<BlueZProxy::Device>> candidates;
+    sigc::connection replenishTimer;
+
+    // packets whose write failed while no connection was left
+    std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> resend_queue;
+    static constexpr size_t max_resend_queue = 32;
+
+    // recently received packets, to merge the RX streams of pooled connections
+    struct RecentPacket
+    {
+        uint64_t hash;
+        int64_t time_us;
+    };
+    std::array<RecentPacket,32> recent_rx = {};
+    size_t recent_rx_next = 0;
+    static constexpr int64_t duplicate_window_us = 2000000;
 
     BlueZProxy& ble;
 
     bool discovering = false;
+    int64_t discovery_started_us = 0;   // LatencyTracer::now_us(), for the discovery duration metric
+
+    // connection attempts, cancelled when discovery restarts and destroyed with the mesh
+    BleTask::TaskScope attempts;
         
 
     std::function<void()> callback_on_ready=nullptr;;
@@ -9,6 +9,7 @@
 #include <memory> 
 #include <cstring> 
 #include <endian.h>
+#include "../logging/latency.h"
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "Mesh protocol"
@@ -188,7 +189,13 @@ public:
 
             static std::shared_ptr<TelinkMeshPacket> create(const std::vector<uint8_t>& data)
             {
-                if (data.size() != 20) {
+                return create(data.data(), data.size());
+            }
+
+            // copies the bytes straight into the packet, no intermediate buffers
+            static std::shared_ptr<TelinkMeshPacket> create(const uint8_t* data, size_t length)
+            {
+                if (length != 20) {
                     throw std::invalid_argument("Data must be 20 bytes");
                 }
 
@@ -199,17 +206,17 @@ public:
                 switch (cmd)
                 {
                     case Command::COMMAND_ADDRESS_REPORT:
-                        return std::make_shared<TelinkMeshAddressReport>(data);
+                        return assign(std::make_shared<TelinkMeshAddressReport>(),data,length);
                     case Command::COMMAND_ONLINE_STATUS_REPORT:
-                        return std::make_shared<TelinkMeshOnlineStatusReport>(data);
+                        return assign(std::make_shared<TelinkMeshOnlineStatusReport>(),data,length);
                     case Command::COMMAND_STATUS_REPORT:
-                        return std::make_shared<TelinkLightStatusReport>(data);
+                        return assign(std::make_shared<TelinkLightStatusReport>(),data,length);
                     case Command::COMMAND_GROUP_ID_REPORT:
-                        return std::make_shared<TelinkMeshGroupIDReport>(data);
+                        return assign(std::make_shared<TelinkMeshGroupIDReport>(),data,length);
                     case Command::COMMAND_DEVICE_INFO_REPORT:
-                        return std::make_shared<TelinkMeshDeviceInfoReport>(data);
+                        return assign(std::make_shared<TelinkMeshDeviceInfoReport>(),data,length);
                     case Command::COMMAND_TIME_REPORT:
-                        return std::make_shared<TelinkMeshTimeReport>(data);                    
+                        return assign(std::make_shared<TelinkMeshTimeReport>(),data,length);                    
                     default:
                         g_warning("Cannot decode mesh command type 0x%02X",cmd);
                         throw std::runtime_error("Unexpected mesh command type");
@@ -221,9 +228,18 @@ public:
                 return data;
             }
 
+            // timestamps of the MQTT command this packet carries, see LatencyTracer
+            PacketTrace& getTrace() { return trace; }
+
 
         protected:
 
+            static std::shared_ptr<TelinkMeshPacket> assign(std::shared_ptr<TelinkMeshPacket> packet, const uint8_t* data, size_t length)
+            {
+                std::copy(data, data + length, packet->packet.data);
+                return packet;
+            }
+
             TelinkMeshPacket(TelinkMeshProtocol::Command command)
             {
                 packet.command=command;
@@ -239,6 +255,7 @@ public:
             }            
 
             Packet packet = {};
+            PacketTrace trace;
 
     };
 
@@ -3,6 +3,7 @@
 #include <openssl/aes.h>
 #include <openssl/rand.h>
 #include <algorithm>  
+#include <iterator>
 #include <iomanip>
 #include <sstream>
 #include <random>
@@ -173,4 +174,32 @@ std::vector<unsigned char> decrypt_packet(const std::vector<unsigned char> &sk,
     return decrypted_packet;
 }
 
+// Same as decrypt_packet, but on a caller owned buffer, all temporaries live on the stack
+bool decrypt_packet_in_place(const std::vector<unsigned char> &sk, const std::vector<unsigned char> &address, unsigned char *packet, size_t length)
+{
+    if (sk.size() != AES_BLOCK_SIZE || address.size() < 3 || length < 8 || length > AES_BLOCK_SIZE + 7) {
+        return false;
+    }
+
+    // reversed key, as in encrypt()
+    unsigned char reversed_key[AES_BLOCK_SIZE];
+    std::reverse_copy(sk.begin(), sk.end(), reversed_key);
+    AES_KEY aes_key = {};
+    AES_set_encrypt_key(reversed_key, 128, &aes_key);
+
+    // reversed plaintext { 0, IV } with IV = address[0..2] packet[0..4] 0...
+    unsigned char block[AES_BLOCK_SIZE] = {};
+    const unsigned char plaintext_head[] = { 0, address[0], address[1], address[2], packet[0], packet[1], packet[2], packet[3], packet[4] };
+    std::reverse_copy(std::begin(plaintext_head), std::end(plaintext_head), block + AES_BLOCK_SIZE - sizeof(plaintext_head));
+
+    unsigned char result[AES_BLOCK_SIZE];
+    AES_ecb_encrypt(block, result, &aes_key, AES_ENCRYPT);
+
+    // XOR the packet data (packet[7:]) with the reversed result
+    for (size_t i = 0; i < length - 7; i++) {
+        packet[i + 7] ^= result[AES_BLOCK_SIZE - 1 - i];
+    }
+    return true;
+}
+
 }
\ No newline at end of file
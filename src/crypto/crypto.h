@@ -25,6 +25,9 @@ std::vector<uint8_t> encrypt_packet(const std::vector<uint8_t>& sk, const std::v
 // Decrypt the packet with the secret key
 std::vector<uint8_t> decrypt_packet(const std::vector<uint8_t>& sk, const std::vector<uint8_t>& address, const std::vector<uint8_t>& packet);
 
+// Decrypt the packet in place without allocating, packet must hold 8 to 23 bytes
+bool decrypt_packet_in_place(const std::vector<uint8_t>& sk, const std::vector<uint8_t>& address, uint8_t* packet, size_t length);
+
 void print_hex(const std::string &label, const std::vector<unsigned char> &data);
 
 } // namespace crypto
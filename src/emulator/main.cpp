@@ -0,0 +1,95 @@
+#include "virtual_mesh.h"
+#include "mock_bluez.h"
+#include <giomm.h>
+#include <glibmm.h>
+#include <glib-unix.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "MeshEmulator"
+
+/* A Telink mesh without hardware: a virtual mesh served as org.bluez on a private bus.
+
+   dbus-run-session -- sh -c 'mesh_emulator & BLUEZ_DBUS_ADDRESS=session meshgateway'
+
+   Keep it off the system bus, it would fight the real bluetoothd for the org.bluez name.
+*/
+static gboolean quit_loop(gpointer loop)
+{
+    g_main_loop_quit(static_cast<GMainLoop*>(loop));
+    return G_SOURCE_REMOVE;
+}
+
+int main() {
+    const char* emulator_dbus_address = std::getenv("EMULATOR_DBUS_ADDRESS"); // bus to serve on, default the session bus
+    const char* mesh_name = std::getenv("MESH_NAME");
+    const char* mesh_password = std::getenv("MESH_PASSWORD");
+    const char* emulator_nodes = std::getenv("EMULATOR_NODES"); // virtual lights, at most 254
+    const char* emulator_relay_latency = std::getenv("EMULATOR_RELAY_LATENCY_MS"); // per hop
+    const char* emulator_jitter = std::getenv("EMULATOR_LATENCY_JITTER_MS"); // added per hop, uniform
+    const char* emulator_loss = std::getenv("EMULATOR_LOSS"); // probability a hop drops a packet
+    const char* emulator_range = std::getenv("EMULATOR_RANGE_NODES"); // nodes within one hop
+    const char* emulator_report_interval = std::getenv("EMULATOR_REPORT_INTERVAL_MS"); // spontaneous status reports, 0 = off
+    const char* emulator_seed = std::getenv("EMULATOR_SEED"); // same seed, same run
+    const char* emulator_connect_ms = std::getenv("EMULATOR_CONNECT_MS"); // until Connect returns
+    const char* emulator_write_ms = std::getenv("EMULATOR_WRITE_MS"); // until WriteValue returns
+
+    VirtualMesh::Config mesh_config;
+    if (mesh_name) mesh_config.name = mesh_name;
+    if (mesh_password) mesh_config.password = mesh_password;
+    if (emulator_nodes) mesh_config.nodes = std::stoul(emulator_nodes);
+    if (emulator_relay_latency) mesh_config.relay_latency_ms = std::stoul(emulator_relay_latency);
+    if (emulator_jitter) mesh_config.latency_jitter_ms = std::stoul(emulator_jitter);
+    if (emulator_loss) mesh_config.loss = std::stod(emulator_loss);
+    if (emulator_range) mesh_config.range_nodes = std::stoul(emulator_range);
+    if (emulator_report_interval) mesh_config.report_interval_ms = std::stoul(emulator_report_interval);
+    if (emulator_seed) mesh_config.seed = std::stoul(emulator_seed);
+
+    MockBlueZ::Config bluez_config;
+    if (emulator_connect_ms) bluez_config.connect_ms = std::stoul(emulator_connect_ms);
+    if (emulator_write_ms) bluez_config.write_ms = std::stoul(emulator_write_ms);
+
+    try
+    {
+        Gio::init();
+        auto mainLoop = Glib::MainLoop::create();
+
+        auto connection = emulator_dbus_address
+            ? Gio::DBus::Connection::create_for_address_sync(emulator_dbus_address,
+                    Gio::DBus::CONNECTION_FLAGS_AUTHENTICATION_CLIENT | Gio::DBus::CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION)
+            : Gio::DBus::Connection::get_sync(Gio::DBus::BUS_TYPE_SESSION);
+
+        // relaying runs on the main loop, like BlueZ delivering to the gateway
+        VirtualMesh mesh(mesh_config, [](uint32_t delay_ms, std::function<void()> fn) {
+            if (delay_ms == 0) {
+                Glib::signal_idle().connect_once(fn);
+            } else {
+                Glib::signal_timeout().connect_once(fn, delay_ms);
+            }
+        });
+        MockBlueZ bluez(connection, mesh, bluez_config);
+
+        // leave through the destructors, so gateways see their links drop
+        g_unix_signal_add(SIGINT, quit_loop, mainLoop->gobj());
+        g_unix_signal_add(SIGTERM, quit_loop, mainLoop->gobj());
+
+        Glib::signal_timeout().connect_seconds([&mesh, &bluez]() {
+            const auto& stats = mesh.getStats();
+            g_message("%zu connections, %" G_GUINT64_FORMAT " commands, %" G_GUINT64_FORMAT " rejected, %" G_GUINT64_FORMAT " lost, %" G_GUINT64_FORMAT " notifications",
+                      bluez.getConnections(), stats.commands, stats.rejected, stats.lost, stats.notifications);
+            return true;
+        }, 60);
+
+        mainLoop->run();
+    }
+    catch (const Glib::Error& e)
+    {
+        g_warning("Emulator failed: %s", e.what().c_str());
+        return 1;
+    }
+    catch (const std::exception& e)
+    {
+        g_warning("Emulator failed: %s", e.what());
+        return 1;
+    }
+    return 0;
+}
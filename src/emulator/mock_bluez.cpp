@@ -0,0 +1,406 @@
+#include "mock_bluez.h"
+#include <algorithm>
+#include <glib.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "MockBlueZ"
+
+// the subset of the BlueZ API the gateway calls, see doc/*-api.txt in the BlueZ sources
+static const char* introspection_xml = R"(
+<node>
+  <interface name="org.freedesktop.DBus.ObjectManager">
+    <method name="GetManagedObjects">
+      <arg name="objects" type="a{oa{sa{sv}}}" direction="out"/>
+    </method>
+    <signal name="InterfacesAdded">
+      <arg name="object" type="o"/>
+      <arg name="interfaces" type="a{sa{sv}}"/>
+    </signal>
+    <signal name="InterfacesRemoved">
+      <arg name="object" type="o"/>
+      <arg name="interfaces" type="as"/>
+    </signal>
+  </interface>
+  <interface name="org.bluez.Adapter1">
+    <method name="StartDiscovery"/>
+    <method name="StopDiscovery"/>
+    <method name="SetDiscoveryFilter">
+      <arg name="filter" type="a{sv}" direction="in"/>
+    </method>
+    <property name="Address" type="s" access="read"/>
+    <property name="Name" type="s" access="read"/>
+    <property name="Powered" type="b" access="read"/>
+    <property name="Discovering" type="b" access="read"/>
+  </interface>
+  <interface name="org.bluez.Device1">
+    <method name="Connect"/>
+    <method name="Disconnect"/>
+    <property name="Address" type="s" access="read"/>
+    <property name="AddressType" type="s" access="read"/>
+    <property name="Name" type="s" access="read"/>
+    <property name="Alias" type="s" access="read"/>
+    <property name="Paired" type="b" access="read"/>
+    <property name="Bonded" type="b" access="read"/>
+    <property name="Trusted" type="b" access="read"/>
+    <property name="Blocked" type="b" access="read"/>
+    <property name="LegacyPairing" type="b" access="read"/>
+    <property name="RSSI" type="n" access="read"/>
+    <property name="Connected" type="b" access="read"/>
+    <property name="ServicesResolved" type="b" access="read"/>
+  </interface>
+  <interface name="org.bluez.GattCharacteristic1">
+    <method name="ReadValue">
+      <arg name="options" type="a{sv}" direction="in"/>
+      <arg name="value" type="ay" direction="out"/>
+    </method>
+    <method name="WriteValue">
+      <arg name="value" type="ay" direction="in"/>
+      <arg name="options" type="a{sv}" direction="in"/>
+    </method>
+    <method name="StartNotify"/>
+    <method name="StopNotify"/>
+    <property name="UUID" type="s" access="read"/>
+    <property name="Flags" type="as" access="read"/>
+    <property name="Notifying" type="b" access="read"/>
+  </interface>
+</node>
+)";
+
+static constexpr const char* object_manager_interface = "org.freedesktop.DBus.ObjectManager";
+static constexpr const char* adapter_interface = "org.bluez.Adapter1";
+static constexpr const char* device_interface = "org.bluez.Device1";
+static constexpr const char* characteristic_interface = "org.bluez.GattCharacteristic1";
+
+// the Telink service as a real light exposes it, object names as BlueZ numbers the handles
+static constexpr const char* notify_char = "/service0010/char0011";
+static constexpr const char* command_char = "/service0010/char0014";
+static constexpr const char* pairing_char = "/service0010/char0018";
+
+MockBlueZ::MockBlueZ(const Glib::RefPtr<Gio::DBus::Connection>& connection, VirtualMesh& mesh, const Config& config)
+    : connection(connection), mesh(mesh), config(config),
+      adapter_path("/org/bluez/" + config.adapter),
+      introspection(Gio::DBus::NodeInfo::create_for_xml(introspection_xml)),
+      vtable(sigc::mem_fun(*this, &MockBlueZ::on_method_call), sigc::mem_fun(*this, &MockBlueZ::on_get_property))
+{
+    register_objects();
+
+    // the gateway only listens to signals sent by org.bluez
+    name_owner = g_bus_own_name_on_connection(connection->gobj(), "org.bluez", G_BUS_NAME_OWNER_FLAGS_NONE,
+                                              nullptr, nullptr, nullptr, nullptr);
+    g_message("Serving %zu virtual nodes as org.bluez on %s", mesh.getNodes().size(), adapter_path.c_str());
+}
+
+MockBlueZ::~MockBlueZ()
+{
+    scan_timer.disconnect();
+    for (auto& [path, device] : devices) {
+        if (device.connected) {
+            mesh.disconnect(device.session);
+        }
+    }
+    for (auto id : registrations) {
+        connection->unregister_object(id);
+    }
+    g_bus_unown_name(name_owner);
+}
+
+size_t MockBlueZ::getConnections() const
+{
+    return std::count_if(devices.begin(), devices.end(), [](const auto& entry) { return entry.second.connected; });
+}
+
+void MockBlueZ::register_objects()
+{
+    registrations.push_back(connection->register_object("/", introspection->lookup_interface(object_manager_interface), vtable));
+    registrations.push_back(connection->register_object(adapter_path, introspection->lookup_interface(adapter_interface), vtable));
+
+    const auto& nodes = mesh.getNodes();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        // /org/bluez/hci0/dev_A4_C1_38_01_E0_01
+        std::string path = adapter_path + "/dev_" + nodes[i].address;
+        std::replace(path.begin(), path.end(), ':', '_');
+        devices[path].node = i;
+        node_paths.push_back(path);
+        registrations.push_back(connection->register_object(path, introspection->lookup_interface(device_interface), vtable));
+
+        characteristics[path + notify_char] = Characteristic{path, CharKind::NOTIFY, "00010203-0405-0607-0809-0a0b0c0d1911"};
+        characteristics[path + command_char] = Characteristic{path, CharKind::COMMAND, "00010203-0405-0607-0809-0a0b0c0d1912"};
+        characteristics[path + pairing_char] = Characteristic{path, CharKind::PAIRING, "00010203-0405-0607-0809-0a0b0c0d1914"};
+        for (const char* suffix : {notify_char, command_char, pairing_char}) {
+            registrations.push_back(connection->register_object(path + suffix, introspection->lookup_interface(characteristic_interface), vtable));
+        }
+    }
+}
+
+MockBlueZ::Properties MockBlueZ::properties(const std::string& path, const Glib::ustring& interface) const
+{
+    Properties result;
+    if (interface == adapter_interface && path == adapter_path) {
+        result["Address"] = Glib::Variant<Glib::ustring>::create("00:1A:7D:DA:71:00");
+        result["Name"] = Glib::Variant<Glib::ustring>::create("mesh_emulator");
+        result["Powered"] = Glib::Variant<bool>::create(true);
+        result["Discovering"] = Glib::Variant<bool>::create(discovering);
+    } else if (interface == device_interface) {
+        auto it = devices.find(path);
+        if (it == devices.end()) {
+            return result;
+        }
+        const auto& node = mesh.getNodes()[it->second.node];
+        // Telink lights advertise the mesh name
+        result["Address"] = Glib::Variant<Glib::ustring>::create(node.address);
+        result["AddressType"] = Glib::Variant<Glib::ustring>::create("public");
+        result["Name"] = Glib::Variant<Glib::ustring>::create(mesh.getConfig().name);
+        result["Alias"] = Glib::Variant<Glib::ustring>::create(mesh.getConfig().name);
+        result["Paired"] = Glib::Variant<bool>::create(false);
+        result["Bonded"] = Glib::Variant<bool>::create(false);
+        result["Trusted"] = Glib::Variant<bool>::create(false);
+        result["Blocked"] = Glib::Variant<bool>::create(false);
+        result["LegacyPairing"] = Glib::Variant<bool>::create(false);
+        result["RSSI"] = Glib::Variant<int16_t>::create(node.rssi);
+        result["Connected"] = Glib::Variant<bool>::create(it->second.connected);
+        result["ServicesResolved"] = Glib::Variant<bool>::create(it->second.connected);
+    } else if (interface == characteristic_interface) {
+        auto it = characteristics.find(path);
+        if (it == characteristics.end()) {
+            return result;
+        }
+        std::vector<Glib::ustring> flags = {"read", "write"};
+        if (it->second.kind == CharKind::NOTIFY) {
+            flags.push_back("notify");
+        }
+        result["UUID"] = Glib::Variant<Glib::ustring>::create(it->second.uuid);
+        result["Flags"] = Glib::Variant<std::vector<Glib::ustring>>::create(flags);
+        result["Notifying"] = Glib::Variant<bool>::create(it->second.kind == CharKind::NOTIFY && devices.at(it->second.device_path).notifying);
+    }
+    return result;
+}
+
+void MockBlueZ::on_method_call(const Glib::RefPtr<Gio::DBus::Connection>& connection,
+                               const Glib::ustring& sender,
+                               const Glib::ustring& object_path,
+                               const Glib::ustring& interface_name,
+                               const Glib::ustring& method_name,
+                               const Glib::VariantContainerBase& parameters,
+                               const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation)
+{
+    try {
+        if (interface_name == object_manager_interface && method_name == "GetManagedObjects") {
+            std::map<Glib::DBusObjectPathString, std::map<Glib::ustring, Properties>> objects;
+            objects[Glib::DBusObjectPathString(adapter_path)][adapter_interface] = properties(adapter_path, adapter_interface);
+            for (const auto& [path, device] : devices) {
+                objects[Glib::DBusObjectPathString(path)][device_interface] = properties(path, device_interface);
+            }
+            for (const auto& [path, characteristic] : characteristics) {
+                objects[Glib::DBusObjectPathString(path)][characteristic_interface] = properties(path, characteristic_interface);
+            }
+            invocation->return_value(Glib::VariantContainerBase::create_tuple(
+                Glib::Variant<std::map<Glib::DBusObjectPathString, std::map<Glib::ustring, Properties>>>::create(objects)));
+        } else if (interface_name == adapter_interface) {
+            adapter_call(method_name, parameters, invocation);
+        } else if (interface_name == device_interface) {
+            device_call(object_path, method_name, invocation);
+        } else if (interface_name == characteristic_interface) {
+            characteristic_call(object_path, method_name, parameters, invocation);
+        } else {
+            invocation->return_dbus_error("org.freedesktop.DBus.Error.UnknownMethod", "Unknown method " + method_name);
+        }
+    } catch (const std::bad_cast& e) {
+        invocation->return_dbus_error("org.bluez.Error.InvalidArguments", "Invalid arguments");
+    }
+}
+
+void MockBlueZ::on_get_property(Glib::VariantBase& property,
+                                const Glib::RefPtr<Gio::DBus::Connection>& connection,
+                                const Glib::ustring& sender,
+                                const Glib::ustring& object_path,
+                                const Glib::ustring& interface_name,
+                                const Glib::ustring& property_name)
+{
+    auto all = properties(object_path, interface_name);
+    auto it = all.find(property_name);
+    if (it != all.end()) {
+        property = it->second;
+    }
+}
+
+void MockBlueZ::adapter_call(const Glib::ustring& method, const Glib::VariantContainerBase& parameters,
+                             const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation)
+{
+    if (method == "SetDiscoveryFilter") {
+        auto filter = Glib::VariantBase::cast_dynamic<Glib::Variant<Properties>>(parameters.get_child(0)).get();
+        auto rssi_it = filter.find("RSSI");
+        rssi_filter = rssi_it == filter.end() ? -127 : Glib::VariantBase::cast_dynamic<Glib::Variant<int16_t>>(rssi_it->second).get();
+        reply(invocation);
+    } else if (method == "StartDiscovery") {
+        if (discovering) {
+            invocation->return_dbus_error("org.bluez.Error.InProgress", "Operation already in progress");
+            return;
+        }
+        discovering = true;
+        scan_timer = Glib::signal_timeout().connect(sigc::mem_fun(*this, &MockBlueZ::scan), config.scan_interval_ms);
+        emit_properties_changed(adapter_path, adapter_interface, {{"Discovering", Glib::Variant<bool>::create(true)}});
+        reply(invocation);
+        scan();
+    } else if (method == "StopDiscovery") {
+        if (!discovering) {
+            invocation->return_dbus_error("org.bluez.Error.Failed", "No discovery started");
+            return;
+        }
+        discovering = false;
+        scan_timer.disconnect();
+        emit_properties_changed(adapter_path, adapter_interface, {{"Discovering", Glib::Variant<bool>::create(false)}});
+        reply(invocation);
+    } else {
+        invocation->return_dbus_error("org.freedesktop.DBus.Error.UnknownMethod", "Unknown method " + method);
+    }
+}
+
+void MockBlueZ::device_call(const std::string& path, const Glib::ustring& method,
+                            const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation)
+{
+    auto it = devices.find(path);
+    if (it == devices.end()) {
+        invocation->return_dbus_error("org.freedesktop.DBus.Error.UnknownObject", "No such device");
+        return;
+    }
+    auto& device = it->second;
+
+    if (method == "Connect") {
+        if (device.connected) {
+            reply(invocation);
+        } else if (device.connecting) {
+            invocation->return_dbus_error("org.bluez.Error.InProgress", "In Progress");
+        } else {
+            // link layer setup and service discovery
+            device.connecting = true;
+            Glib::signal_timeout().connect_once(sigc::bind(sigc::mem_fun(*this, &MockBlueZ::connected), path, invocation),
+                                                config.connect_ms);
+        }
+    } else if (method == "Disconnect") {
+        disconnect(path);
+        reply(invocation);
+    } else {
+        invocation->return_dbus_error("org.freedesktop.DBus.Error.UnknownMethod", "Unknown method " + method);
+    }
+}
+
+void MockBlueZ::characteristic_call(const std::string& path, const Glib::ustring& method, const Glib::VariantContainerBase& parameters,
+                                    const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation)
+{
+    auto it = characteristics.find(path);
+    if (it == characteristics.end()) {
+        invocation->return_dbus_error("org.freedesktop.DBus.Error.UnknownObject", "No such characteristic");
+        return;
+    }
+    auto& device = devices.at(it->second.device_path);
+    if (!device.connected) {
+        invocation->return_dbus_error("org.bluez.Error.NotConnected", "Not Connected");
+        return;
+    }
+
+    if (method == "ReadValue") {
+        std::vector<uint8_t> value;
+        if (it->second.kind == CharKind::PAIRING) {
+            value = mesh.readPairing(device.session);
+        }
+        invocation->return_value(Glib::VariantContainerBase::create_tuple(Glib::Variant<std::vector<uint8_t>>::create(value)));
+    } else if (method == "WriteValue") {
+        auto value = Glib::VariantBase::cast_dynamic<Glib::Variant<std::vector<uint8_t>>>(parameters.get_child(0)).get();
+        switch (it->second.kind) {
+            case CharKind::PAIRING:
+                mesh.writePairing(device.session, value);
+                break;
+            case CharKind::NOTIFY:
+                mesh.writeNotify(device.session, value);
+                break;
+            case CharKind::COMMAND:
+                // a real light acknowledges the write and drops what it can't decrypt
+                mesh.writeCommand(device.session, value);
+                break;
+        }
+        reply_later(config.write_ms, invocation);
+    } else if (method == "StartNotify" || method == "StopNotify") {
+        if (it->second.kind != CharKind::NOTIFY) {
+            invocation->return_dbus_error("org.bluez.Error.NotSupported", "Operation is not supported");
+            return;
+        }
+        device.notifying = method == "StartNotify";
+        emit_properties_changed(path, characteristic_interface, {{"Notifying", Glib::Variant<bool>::create(device.notifying)}});
+        reply(invocation);
+    } else {
+        invocation->return_dbus_error("org.freedesktop.DBus.Error.UnknownMethod", "Unknown method " + method);
+    }
+}
+
+void MockBlueZ::connected(std::string path, Glib::RefPtr<Gio::DBus::MethodInvocation> invocation)
+{
+    auto& device = devices.at(path);
+    device.connecting = false;
+    device.connected = true;
+    device.notifying = false;
+    device.session = mesh.connect(device.node, [this, path](const std::vector<uint8_t>& data) { notify(path, data); });
+
+    emit_properties_changed(path, device_interface, {{"Connected", Glib::Variant<bool>::create(true)},
+                                                     {"ServicesResolved", Glib::Variant<bool>::create(true)}});
+    reply(invocation);
+    g_message("Connected to node %u (%zu connections)", mesh.getNodes()[device.node].id, getConnections());
+}
+
+void MockBlueZ::reply(Glib::RefPtr<Gio::DBus::MethodInvocation> invocation)
+{
+    invocation->return_value(Glib::VariantContainerBase::create_tuple(std::vector<Glib::VariantBase>()));
+}
+
+void MockBlueZ::reply_later(uint32_t delay_ms, const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation)
+{
+    if (delay_ms == 0) {
+        reply(invocation);
+        return;
+    }
+    Glib::signal_timeout().connect_once(sigc::bind(sigc::mem_fun(*this, &MockBlueZ::reply), invocation), delay_ms);
+}
+
+void MockBlueZ::disconnect(const std::string& path)
+{
+    auto& device = devices.at(path);
+    if (!device.connected) {
+        return;
+    }
+    mesh.disconnect(device.session);
+    device.connected = false;
+    device.notifying = false;
+    emit_properties_changed(path, device_interface, {{"Connected", Glib::Variant<bool>::create(false)},
+                                                     {"ServicesResolved", Glib::Variant<bool>::create(false)}});
+    g_message("Disconnected from node %u", mesh.getNodes()[device.node].id);
+}
+
+bool MockBlueZ::scan()
+{
+    // one advertisement per node and interval, BlueZ turns each into an RSSI update
+    for (size_t i = 0; i < node_paths.size(); i++) {
+        auto rssi = mesh.getNodes()[i].rssi;
+        if (rssi >= rssi_filter) {
+            emit_properties_changed(node_paths[i], device_interface, {{"RSSI", Glib::Variant<int16_t>::create(rssi)}});
+        }
+    }
+    return discovering;
+}
+
+void MockBlueZ::notify(const std::string& path, const std::vector<uint8_t>& data)
+{
+    auto it = devices.find(path);
+    if (it == devices.end() || !it->second.notifying) {
+        return;
+    }
+    emit_properties_changed(path + notify_char, characteristic_interface, {{"Value", Glib::Variant<std::vector<uint8_t>>::create(data)}});
+}
+
+void MockBlueZ::emit_properties_changed(const std::string& path, const Glib::ustring& interface, const Properties& changed)
+{
+    // (sa{sv}as), nothing is ever invalidated here
+    connection->emit_signal(path, "org.freedesktop.DBus.Properties", "PropertiesChanged", Glib::ustring(),
+                            Glib::VariantContainerBase::create_tuple(std::vector<Glib::VariantBase>({
+                                Glib::Variant<Glib::ustring>::create(interface),
+                                Glib::Variant<Properties>::create(changed),
+                                Glib::Variant<std::vector<Glib::ustring>>::create(std::vector<Glib::ustring>())})));
+}
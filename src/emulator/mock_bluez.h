@@ -0,0 +1,114 @@
+#ifndef MOCK_BLUEZ_H
+#define MOCK_BLUEZ_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <giomm.h>
+#include <glibmm.h>
+
+#include "virtual_mesh.h"
+
+/* Responsibilities:
+    serve the part of the org.bluez D-Bus API BlueZProxy uses, backed by a VirtualMesh:
+    ObjectManager, one adapter, a Device1 per node with the three Telink characteristics
+    announce nodes through RSSI updates while discovering, honouring the discovery filter's RSSI
+    hand characteristic reads, writes and notifications to the node side of the virtual mesh
+   Meant for a private bus, it claims the org.bluez name on whatever connection it is given.
+*/
+class MockBlueZ : public sigc::trackable {
+public:
+
+    struct Config
+    {
+        std::string adapter = "hci0";
+        uint32_t connect_ms = 300;      // until Connect returns
+        uint32_t write_ms = 0;          // until WriteValue returns, a real link needs 7.5 to 30 ms
+        uint32_t scan_interval_ms = 1000;
+    };
+
+    MockBlueZ(const Glib::RefPtr<Gio::DBus::Connection>& connection, VirtualMesh& mesh, const Config& config);
+    ~MockBlueZ();
+
+    MockBlueZ(const MockBlueZ&) = delete;
+    MockBlueZ& operator=(const MockBlueZ&) = delete;
+
+    size_t getConnections() const;
+
+protected:
+
+    enum class CharKind { NOTIFY, COMMAND, PAIRING };
+
+    struct Device
+    {
+        size_t node = 0;
+        bool connecting = false;
+        bool connected = false;
+        bool notifying = false;            // StartNotify on the notification characteristic
+        uint32_t session = 0;              // in the virtual mesh, while connected
+    };
+
+    struct Characteristic
+    {
+        std::string device_path;
+        CharKind kind;
+        const char* uuid;
+    };
+
+    using Properties = std::map<Glib::ustring, Glib::VariantBase>;
+
+    void register_objects();
+    Properties properties(const std::string& path, const Glib::ustring& interface) const;
+
+    void on_method_call(const Glib::RefPtr<Gio::DBus::Connection>& connection,
+                        const Glib::ustring& sender,
+                        const Glib::ustring& object_path,
+                        const Glib::ustring& interface_name,
+                        const Glib::ustring& method_name,
+                        const Glib::VariantContainerBase& parameters,
+                        const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation);
+
+    void on_get_property(Glib::VariantBase& property,
+                         const Glib::RefPtr<Gio::DBus::Connection>& connection,
+                         const Glib::ustring& sender,
+                         const Glib::ustring& object_path,
+                         const Glib::ustring& interface_name,
+                         const Glib::ustring& property_name);
+
+    void adapter_call(const Glib::ustring& method, const Glib::VariantContainerBase& parameters,
+                      const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation);
+    void device_call(const std::string& path, const Glib::ustring& method,
+                     const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation);
+    void characteristic_call(const std::string& path, const Glib::ustring& method, const Glib::VariantContainerBase& parameters,
+                             const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation);
+
+    // timers are bound to members, sigc::trackable drops them with the object
+    void connected(std::string path, Glib::RefPtr<Gio::DBus::MethodInvocation> invocation);
+    void reply(Glib::RefPtr<Gio::DBus::MethodInvocation> invocation);
+    void reply_later(uint32_t delay_ms, const Glib::RefPtr<Gio::DBus::MethodInvocation>& invocation);
+
+    void disconnect(const std::string& path);
+    bool scan();
+    void notify(const std::string& path, const std::vector<uint8_t>& data);
+    void emit_properties_changed(const std::string& path, const Glib::ustring& interface, const Properties& changed);
+
+    Glib::RefPtr<Gio::DBus::Connection> connection;
+    VirtualMesh& mesh;
+    Config config;
+
+    std::string adapter_path;
+    std::map<std::string,Device> devices;                   // by object path
+    std::map<std::string,Characteristic> characteristics;   // by object path
+    std::vector<std::string> node_paths;                    // device path by node index
+
+    Glib::RefPtr<Gio::DBus::NodeInfo> introspection;
+    Gio::DBus::InterfaceVTable vtable;
+    std::vector<guint> registrations;
+    guint name_owner = 0;
+
+    bool discovering = false;
+    int16_t rssi_filter = -127;
+    sigc::connection scan_timer;
+};
+
+#endif
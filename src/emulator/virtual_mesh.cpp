@@ -0,0 +1,339 @@
+#include "virtual_mesh.h"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <glib.h>
+#include "../crypto/crypto.h"
+#include "../ble_stack/telink_mesh_protocol.h"
+
+using Command = TelinkMeshProtocol::Command;
+
+// "AA:BB:CC:DD:EE:FF" -> FF EE DD CC BB AA, the order the gateway keys its crypto with
+static std::vector<uint8_t> reversed_address(const std::string& address)
+{
+    unsigned int bytes[6] = {};
+    std::sscanf(address.c_str(), "%02X:%02X:%02X:%02X:%02X:%02X",
+                &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]);
+    std::vector<uint8_t> reversed;
+    for (int i = 5; i >= 0; i--) {
+        reversed.push_back(static_cast<uint8_t>(bytes[i]));
+    }
+    return reversed;
+}
+
+VirtualMesh::VirtualMesh(const Config& config, Scheduler scheduler)
+    : config(config), scheduler(scheduler), random(config.seed), alive(std::make_shared<bool>())
+{
+    if (config.nodes == 0 || config.nodes > 254) {
+        throw std::invalid_argument("A virtual mesh holds 1 to 254 nodes");
+    }
+    if (this->config.range_nodes == 0) {
+        this->config.range_nodes = 1;
+    }
+
+    std::uniform_int_distribution<int> rssi(-95, -45);
+    for (size_t i = 0; i < config.nodes; i++) {
+        Node node;
+        node.id = static_cast<uint8_t>(i + 1);
+        char address[18];
+        std::snprintf(address, sizeof(address), "A4:C1:38:%02X:%02X:%02X",
+                      static_cast<unsigned int>(config.seed & 0xFF), 0xE0, node.id);
+        node.address = address;
+        node.rssi = static_cast<int16_t>(rssi(random));
+        node.groups.fill(0xFF);
+        nodes.push_back(node);
+    }
+
+    if (config.report_interval_ms > 0) {
+        // spread the nodes over the interval, a real mesh doesn't report in lockstep
+        for (size_t i = 0; i < nodes.size(); i++) {
+            schedule_report(i, static_cast<uint32_t>(static_cast<uint64_t>(config.report_interval_ms) * i / nodes.size()));
+        }
+    }
+}
+
+uint32_t VirtualMesh::connect(size_t proxy, Notify notify)
+{
+    if (proxy >= nodes.size()) {
+        throw std::out_of_range("No such node");
+    }
+
+    Session session;
+    session.proxy = proxy;
+    session.notify = notify;
+    session.macdata = reversed_address(nodes[proxy].address);
+
+    auto id = next_session++;
+    sessions[id] = session;
+    return id;
+}
+
+void VirtualMesh::disconnect(uint32_t session)
+{
+    sessions.erase(session);
+}
+
+void VirtualMesh::writePairing(uint32_t id, const std::vector<uint8_t>& data)
+{
+    auto it = sessions.find(id);
+    if (it == sessions.end()) {
+        return;
+    }
+    auto& session = it->second;
+    session.shared_key.clear();
+
+    // 0x0c, 8 random bytes, the first 8 bytes of key_encrypt(name, password, random | zeros)
+    if (data.size() < 17 || data[0] != 0x0c) {
+        session.pairing_response = {0x0e};
+        return;
+    }
+    std::vector<uint8_t> gateway_random(data.begin() + 1, data.begin() + 9);
+    std::vector<uint8_t> request(gateway_random);
+    request.resize(16, 0x00);
+    auto expected = crypto::key_encrypt(config.name, config.password, request);
+    if (!std::equal(expected.begin(), expected.begin() + 8, data.begin() + 9)) {
+        // wrong mesh name or password
+        session.pairing_response = {0x0e};
+        return;
+    }
+
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> node_random(8);
+    for (auto& value : node_random) {
+        value = static_cast<uint8_t>(byte(random));
+    }
+    std::vector<uint8_t> response_key(node_random);
+    response_key.resize(16, 0x00);
+    auto check = crypto::key_encrypt(config.name, config.password, response_key);
+
+    session.pairing_response = {0x0d};
+    session.pairing_response.insert(session.pairing_response.end(), node_random.begin(), node_random.end());
+    session.pairing_response.insert(session.pairing_response.end(), check.begin(), check.begin() + 8);
+    session.shared_key = crypto::generate_sk(config.name, config.password, gateway_random, node_random);
+}
+
+std::vector<uint8_t> VirtualMesh::readPairing(uint32_t id) const
+{
+    auto it = sessions.find(id);
+    return it == sessions.end() ? std::vector<uint8_t>() : it->second.pairing_response;
+}
+
+void VirtualMesh::writeNotify(uint32_t id, const std::vector<uint8_t>& data)
+{
+    auto it = sessions.find(id);
+    if (it != sessions.end() && data.size() == 1 && data[0] == 0x01) {
+        it->second.notifying = true;
+    }
+}
+
+bool VirtualMesh::writeCommand(uint32_t id, const std::vector<uint8_t>& data)
+{
+    auto it = sessions.find(id);
+    if (it == sessions.end() || it->second.shared_key.empty() || data.size() != 20) {
+        stats.rejected++;
+        return false;
+    }
+    const auto& sk = it->second.shared_key;
+    const auto& a = it->second.macdata;
+
+    // undo encrypt_packet: bytes 5..19 are XORed with encrypt(sk, iv)
+    std::vector<uint8_t> iv = {0, a[0], a[1], a[2], a[3], 0x01, data[0], data[1], data[2], 0, 0, 0, 0, 0, 0, 0};
+    auto stream = crypto::encrypt(sk, iv);
+    std::array<uint8_t,20> packet;
+    std::copy(data.begin(), data.end(), packet.begin());
+    for (size_t i = 0; i < 15; i++) {
+        packet[i + 5] ^= stream[i];
+    }
+
+    // bytes 3..4 carry a MAC over the plaintext
+    std::vector<uint8_t> nonce = {a[0], a[1], a[2], a[3], 0x01, data[0], data[1], data[2], 15, 0, 0, 0, 0, 0, 0, 0};
+    auto authenticator = crypto::encrypt(sk, nonce);
+    for (size_t i = 0; i < 15; i++) {
+        authenticator[i] ^= packet[i + 5];
+    }
+    auto mac = crypto::encrypt(sk, authenticator);
+    if (mac[0] != data[3] || mac[1] != data[4]) {
+        stats.rejected++;
+        return false;
+    }
+
+    stats.commands++;
+    handle(it->second.proxy, packet);
+    return true;
+}
+
+void VirtualMesh::handle(size_t proxy, const std::array<uint8_t,20>& packet)
+{
+    uint16_t dest = packet[5] | (packet[6] << 8);
+    for (auto node : targets(proxy, dest)) {
+        uint32_t delay_ms;
+        if (!transit(proxy, node, delay_ms)) {
+            stats.lost++;
+            continue;
+        }
+        later(delay_ms, [this, node, packet]() { execute(node, packet); });
+    }
+}
+
+void VirtualMesh::execute(size_t index, const std::array<uint8_t,20>& packet)
+{
+    auto& node = nodes[index];
+    const uint8_t* payload = &packet[10];
+
+    switch (static_cast<Command>(packet[7])) {
+        case Command::COMMAND_LIGHT_ON_OFF:
+        case Command::COMMAND_LIGHT_ATTRIBUTES_SET: {
+            if (packet[7] == Command::COMMAND_LIGHT_ON_OFF) {
+                node.on = payload[0] != 0;
+            } else {
+                node.brightness = payload[0];
+                node.red = payload[1];
+                node.green = payload[2];
+                node.blue = payload[3];
+                node.yellow = payload[4];
+                node.white = payload[5];
+            }
+            // bit 0 set means off
+            const uint8_t status[4] = {node.id, 0, node.brightness, static_cast<uint8_t>(node.on ? 0 : 1)};
+            report(index, Command::COMMAND_ONLINE_STATUS_REPORT, status, sizeof(status));
+            break;
+        }
+        case Command::COMMAND_STATUS_QUERY: {
+            const uint8_t status[8] = {node.brightness, node.red, node.green, node.blue, node.yellow, node.white, 0, 0};
+            report(index, Command::COMMAND_STATUS_REPORT, status, sizeof(status));
+            break;
+        }
+        case Command::COMMAND_ADDRESS_EDIT: {
+            // mode 0xFFFF: everybody report your address
+            uint8_t address[7] = {node.id};
+            auto mac = reversed_address(node.address);
+            std::copy(mac.begin(), mac.end(), address + 1);
+            report(index, Command::COMMAND_ADDRESS_REPORT, address, sizeof(address));
+            break;
+        }
+        case Command::COMMAND_GROUP_ID_QUERY:
+            report(index, Command::COMMAND_GROUP_ID_REPORT, node.groups.data(), node.groups.size());
+            break;
+        case Command::COMMAND_GROUP_EDIT: {
+            // payload[0] 1 adds, 0 removes, payload[1..2] is the group address
+            const uint8_t group = payload[1];
+            auto existing = std::find(node.groups.begin(), node.groups.end(), group);
+            if (payload[0] && existing == node.groups.end()) {
+                auto unused = std::find(node.groups.begin(), node.groups.end(), 0xFF);
+                if (unused != node.groups.end()) {
+                    *unused = group;
+                }
+            } else if (!payload[0] && existing != node.groups.end()) {
+                *existing = 0xFF;
+            }
+            break;
+        }
+        default:
+            // commands a real light ignores as well
+            break;
+    }
+}
+
+void VirtualMesh::report(size_t index, uint8_t command, const uint8_t* payload, size_t length)
+{
+    // RX layout: seq [0-2], source node [3], command [7], vendor code [8-9], payload [10-19]
+    std::array<uint8_t,20> packet = {};
+    auto seq = notify_seq++;
+    packet[0] = seq & 0xFF;
+    packet[1] = (seq >> 8) & 0xFF;
+    packet[2] = (seq >> 16) & 0xFF;
+    packet[3] = nodes[index].id;
+    packet[7] = command;
+    packet[8] = 0x11;
+    packet[9] = 0x02;
+    std::copy(payload, payload + std::min<size_t>(length, 10), packet.begin() + 10);
+
+    // every proxy relays mesh traffic to its gateway
+    for (const auto& [id, session] : sessions) {
+        if (!session.notifying) {
+            continue;
+        }
+        uint32_t delay_ms;
+        if (!transit(index, session.proxy, delay_ms)) {
+            stats.lost++;
+            continue;
+        }
+        later(delay_ms, [this, id = id, packet]() {
+            auto it = sessions.find(id);
+            if (it == sessions.end() || !it->second.notifying) {
+                return;
+            }
+            // the notification cipher is its own inverse, decrypt_packet encrypts as well
+            auto encrypted = crypto::decrypt_packet(it->second.shared_key, it->second.macdata,
+                                                    std::vector<uint8_t>(packet.begin(), packet.end()));
+            stats.notifications++;
+            it->second.notify(encrypted);
+        });
+    }
+}
+
+void VirtualMesh::schedule_report(size_t index, uint32_t delay_ms)
+{
+    later(delay_ms, [this, index]() {
+        const auto& node = nodes[index];
+        const uint8_t status[4] = {node.id, 0, node.brightness, static_cast<uint8_t>(node.on ? 0 : 1)};
+        report(index, Command::COMMAND_ONLINE_STATUS_REPORT, status, sizeof(status));
+        schedule_report(index, config.report_interval_ms);
+    });
+}
+
+std::vector<size_t> VirtualMesh::targets(size_t proxy, uint16_t dest) const
+{
+    std::vector<size_t> result;
+    if (dest == 0x0000) {
+        // the connected node itself
+        result.push_back(proxy);
+    } else if (dest == 0xFFFF) {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            result.push_back(i);
+        }
+    } else if (dest & 0x8000) {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const auto& groups = nodes[i].groups;
+            if (std::find(groups.begin(), groups.end(), dest & 0xFF) != groups.end()) {
+                result.push_back(i);
+            }
+        }
+    } else if (dest >= 1 && dest <= nodes.size()) {
+        result.push_back(dest - 1);
+    }
+    return result;
+}
+
+unsigned int VirtualMesh::hops(size_t from, size_t to) const
+{
+    if (from == to) {
+        return 0;
+    }
+    auto distance = from > to ? from - to : to - from;
+    return 1 + static_cast<unsigned int>(distance / config.range_nodes);
+}
+
+bool VirtualMesh::transit(size_t from, size_t to, uint32_t& delay_ms)
+{
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::uniform_int_distribution<uint32_t> jitter(0, config.latency_jitter_ms);
+    delay_ms = 0;
+    for (unsigned int hop = hops(from, to); hop > 0; hop--) {
+        if (config.loss > 0 && chance(random) < config.loss) {
+            return false;
+        }
+        delay_ms += config.relay_latency_ms + jitter(random);
+    }
+    return true;
+}
+
+void VirtualMesh::later(uint32_t delay_ms, std::function<void()> fn)
+{
+    std::weak_ptr<bool> token = alive;
+    scheduler(delay_ms, [token, fn]() {
+        if (token.lock()) {
+            fn();
+        }
+    });
+}
@@ -0,0 +1,120 @@
+#ifndef VIRTUAL_MESH_H
+#define VIRTUAL_MESH_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Responsibilities:
+    simulate a Telink mesh of N lights: node state, relaying with latency and loss, reports
+    play the node side of a proxy connection: pairing, command decryption, encrypted notifications
+   The crypto is the gateway's own (crypto.cpp) run backwards, so a gateway pairing with
+   the wrong name or password, or sending a packet with a bad MAC, is rejected like by a real node.
+
+   Nodes sit on a line, a relay covers range_nodes of them, so the hop count between two nodes
+   grows with their distance. Every hop adds relay_latency_ms (plus jitter) and may lose the packet.
+   Timing is left to the owner through the scheduler, tests run it by hand.
+*/
+class VirtualMesh {
+public:
+
+    struct Config
+    {
+        std::string name = "telink_mesh1";
+        std::string password = "123";
+        size_t nodes = 200;                 // ids 1..nodes, at most 254
+        uint32_t relay_latency_ms = 20;     // per hop
+        uint32_t latency_jitter_ms = 10;
+        double loss = 0.0;                  // probability a hop drops a packet
+        size_t range_nodes = 32;            // nodes within one hop
+        uint32_t report_interval_ms = 0;    // spontaneous online status reports per node, 0 = off
+        uint32_t seed = 1;                  // same seed, same RSSI, latency and loss sequence
+    };
+
+    struct Node
+    {
+        uint8_t id = 0;
+        std::string address;                // "A4:C1:38:xx:xx:xx"
+        int16_t rssi = 0;                   // as seen by the gateway
+        bool on = true;
+        uint8_t brightness = 100;
+        uint8_t red = 0, green = 0, blue = 0, yellow = 0, white = 0;
+        std::array<uint8_t,10> groups;      // 0xFF = unused slot
+    };
+
+    struct Stats
+    {
+        uint64_t commands = 0;              // accepted from gateways
+        uint64_t rejected = 0;              // not paired or bad MAC
+        uint64_t lost = 0;                  // dropped on a hop, either direction
+        uint64_t notifications = 0;         // delivered to gateways
+    };
+
+    using Scheduler = std::function<void(uint32_t delay_ms, std::function<void()> fn)>;
+    using Notify = std::function<void(const std::vector<uint8_t>& data)>;
+
+    VirtualMesh(const Config& config, Scheduler scheduler);
+
+    VirtualMesh(const VirtualMesh&) = delete;
+    VirtualMesh& operator=(const VirtualMesh&) = delete;
+
+    const std::vector<Node>& getNodes() const { return nodes; }
+    const Stats& getStats() const { return stats; }
+    const Config& getConfig() const { return config; }
+
+    // a gateway connected to nodes[proxy], notifications go to notify once enabled
+    uint32_t connect(size_t proxy, Notify notify);
+    void disconnect(uint32_t session);
+
+    // pairing characteristic (...1914): write the request, read the response
+    void writePairing(uint32_t session, const std::vector<uint8_t>& data);
+    std::vector<uint8_t> readPairing(uint32_t session) const;
+
+    // notification characteristic (...1911): writing 0x01 enables notifications
+    void writeNotify(uint32_t session, const std::vector<uint8_t>& data);
+
+    // command characteristic (...1912), false if the packet was rejected
+    bool writeCommand(uint32_t session, const std::vector<uint8_t>& data);
+
+protected:
+
+    struct Session
+    {
+        size_t proxy = 0;
+        Notify notify;
+        std::vector<uint8_t> macdata;       // proxy address, reversed
+        std::vector<uint8_t> pairing_response;
+        std::vector<uint8_t> shared_key;
+        bool notifying = false;
+    };
+
+    void handle(size_t proxy, const std::array<uint8_t,20>& packet);
+    void execute(size_t node, const std::array<uint8_t,20>& packet);
+    void report(size_t node, uint8_t command, const uint8_t* payload, size_t length);
+    void schedule_report(size_t node, uint32_t delay_ms);
+
+    std::vector<size_t> targets(size_t proxy, uint16_t dest) const;
+    unsigned int hops(size_t from, size_t to) const;
+    // latency for the path, or false if a hop lost the packet
+    bool transit(size_t from, size_t to, uint32_t& delay_ms);
+    void later(uint32_t delay_ms, std::function<void()> fn);
+
+    Config config;
+    Scheduler scheduler;
+    std::vector<Node> nodes;
+    std::map<uint32_t,Session> sessions;
+    uint32_t next_session = 1;
+    uint32_t notify_seq = 1;
+    std::mt19937 random;
+    Stats stats;
+
+    // scheduled work holds it weakly, nothing runs once the mesh is gone
+    std::shared_ptr<bool> alive;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef AVAILABILITY_TRACKER_H
+#define AVAILABILITY_TRACKER_H
+
+#include <memory>
+#include <unordered_map>
+#include <glibmm/main.h>
+#include "timer_wheel.h"
+#include "../logging/log.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "Availability"
+
+/* Responsibilities:
+    track a liveness deadline per mesh node
+    report nodes that miss their deadline as unavailable
+   All deadlines live in one timer wheel driven by a single periodic main loop source,
+   so the number of GSources does not grow with the number of nodes.
+*/
+class AvailabilityTracker
+{
+    public:
+
+        AvailabilityTracker(uint32_t timeout_ms,
+                            sigc::slot<void,uint16_t,bool> availabilityCallback,
+                            uint32_t tick_ms = 1000)
+            : tick_ms(tick_ms),
+              timeout_ticks((timeout_ms + tick_ms - 1) / tick_ms),
+              last_tick_us(g_get_monotonic_time())
+        {
+            sigAvailability.connect(availabilityCallback);
+            tickConnection = Glib::signal_timeout().connect(sigc::mem_fun(*this,&AvailabilityTracker::on_tick), tick_ms);
+        }
+
+        ~AvailabilityTracker()
+        {
+            tickConnection.disconnect();
+        }
+
+        // node has reported in - push its deadline out, announce it if it was unavailable
+        void seen(uint16_t node_id)
+        {
+            auto& node = nodes[node_id];
+            if (!node)
+            {
+                node = std::make_unique<Node>();
+                node->timer.setCallback([this,node_id]() { on_expired(node_id); });
+            }
+
+            wheel.schedule(node->timer, timeout_ticks);
+
+            if (!node->available)
+            {
+                node->available = true;
+                LOG_DEBUG("Node %u became available",node_id);
+                sigAvailability.emit(node_id,true);
+            }
+        }
+
+        bool isAvailable(uint16_t node_id) const
+        {
+            auto it = nodes.find(node_id);
+            return it != nodes.end() && it->second->available;
+        }
+
+        // known to the tracker and past its deadline - a node never seen is neither
+        bool isUnavailable(uint16_t node_id) const
+        {
+            auto it = nodes.find(node_id);
+            return it != nodes.end() && !it->second->available;
+        }
+
+        // other per-node deadlines may share the wheel, it advances once per tick
+        TimerWheel& getWheel() { return wheel; }
+        uint32_t getTickMs() const { return tick_ms; }
+
+    protected:
+
+        struct Node
+        {
+            TimerWheel::Timer timer;
+            bool available = false;
+        };
+
+        bool on_tick()
+        {
+            // catch up on ticks missed while the main loop was busy
+            auto now_us = g_get_monotonic_time();
+            uint64_t elapsed = (now_us - last_tick_us) / (static_cast<int64_t>(tick_ms) * 1000);
+            if (elapsed > 0)
+            {
+                last_tick_us += elapsed * tick_ms * 1000;
+                wheel.advance(elapsed);
+            }
+            return true;
+        }
+
+        void on_expired(uint16_t node_id)
+        {
+            auto it = nodes.find(node_id);
+            if (it != nodes.end() && it->second->available)
+            {
+                it->second->available = false;
+                g_message("Node %u missed its liveness deadline, marking unavailable",node_id);
+                sigAvailability.emit(node_id,false);
+            }
+        }
+
+        uint32_t tick_ms;
+        uint64_t timeout_ticks;
+        int64_t last_tick_us;
+
+        TimerWheel wheel;
+        std::unordered_map<uint16_t,std::unique_ptr<Node>> nodes;
+        sigc::connection tickConnection;
+
+        sigc::signal<void,uint16_t,bool> sigAvailability;
+};
+
+#endif
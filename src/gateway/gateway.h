@@ -1,9 +1,12 @@
 #ifndef GATEWAY_H
 #define GATEWAY_H
 
-#include "../ble_stack/telink_mesh.h"
+#include "../ble_stack/mesh_link.h"
 #include "../mqtt/mqtt_client_proxy.h"
 #include "mappings.h"
+#include "availability_tracker.h"
+#include "pending_commands.h"
+#include "../logging/log.h"
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "Gateway"
@@ -12,14 +15,23 @@ class Gateway
 {
     public:
 
-        Gateway(std::shared_ptr<TelinkMesh> mesh, std::shared_ptr<MQTTClientProxy> mqtt)
-            : mesh(mesh), mqtt(mqtt), mqtt_enabled(true)
+        // several gateways may share one MQTT client, each in its own namespace
+        Gateway(std::shared_ptr<MeshLink> mesh,
+                std::shared_ptr<MQTTClientProxy> mqtt,
+                uint32_t availability_timeout_ms = 120000,
+                const MeshNamespace& ns = MeshNamespace(),
+                uint32_t command_hold_ms = 300000)
+            : mesh(mesh), mqtt(mqtt), mqtt_enabled(true), ns(ns),
+              availability(availability_timeout_ms, sigc::mem_fun(this,&Gateway::onNodeAvailability)),
+              hold_commands(command_hold_ms > 0),
+              pending(availability.getWheel(),
+                      (command_hold_ms + availability.getTickMs() - 1) / availability.getTickMs())
         {
             mesh->setRxCallback(sigc::mem_fun(this,&Gateway::onMeshMessage));
-            mqtt->setCallback(sigc::mem_fun(this,&Gateway::onMqttMessage));
+            mqtt->setCallback(ns.topic_prefix,sigc::mem_fun(this,&Gateway::onMqttMessage));
                          
             mqtt->connect();
-            mqtt->subscribe("homeassistant/light/+/set");
+            mqtt->subscribe(ns.topic_prefix + "/+/set");
 
             // start the heartbeat with an address query
             heartbeat(true,30000);
@@ -28,7 +40,7 @@ class Gateway
             /*Glib::signal_timeout().connect([this]() {
                 try
                 {
-                    g_debug("Status query heartbeat");
+                    LOG_DEBUG("Status query heartbeat");
                     auto query = prepareStatusQuery();
                     this->send_if_ready({query});
                 }
@@ -42,7 +54,7 @@ class Gateway
             Glib::signal_timeout().connect([this]() {
                 try
                 {
-                    g_debug("Address query heartbeat");
+                    LOG_DEBUG("Address query heartbeat");
                     auto query = prepareAddressQuery();
                     this->send_if_ready({query});
                 }
@@ -59,11 +71,11 @@ class Gateway
             try
             {
                 if (address_or_status){
-                    g_debug("Address query heartbeat");
+                    LOG_DEBUG("Address query heartbeat");
                     auto query = prepareAddressQuery();
                     this->send_if_ready({query});
                 } else {
-                    g_debug("Status query heartbeat");
+                    LOG_DEBUG("Status query heartbeat");
                     auto query = prepareStatusQuery();
                     this->send_if_ready({query});
                 }
@@ -78,7 +90,7 @@ class Gateway
         void onMeshMessage(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> msg)
         {
             // map to mqtt and publish
-            auto mqttmsg = telink_to_mqtt(msg);
+            auto mqttmsg = telink_to_mqtt(msg,ns);
 
             if (mqttmsg)
             {
@@ -88,13 +100,31 @@ class Gateway
             if (msg->getCommand() == TelinkMeshProtocol::Command::COMMAND_ONLINE_STATUS_REPORT
              || msg->getCommand() == TelinkMeshProtocol::Command::COMMAND_ADDRESS_REPORT)
              {
-                // announce availability
-                auto mqttmsg = telink_to_mqtt_availability(msg);
-                if (mqttmsg)
-                {
-                    mqtt->publish(mqttmsg);
-                }
+                // refresh the node's liveness deadline, availability is announced on transitions
+                availability.seen(telink_reporting_node(msg));
              }
+
+            if (!awaiting_report.empty())
+            {
+                confirm_latency(msg);
+            }
+        }
+
+        void onNodeAvailability(uint16_t node_id, bool available)
+        {
+            try
+            {
+                mqtt->publish(telink_to_mqtt_availability(node_id,available,ns));
+            }
+            catch(const std::exception& e)
+            {
+                g_warning("Could not publish availability of node %u: %s",node_id,e.what());
+            }
+
+            if (available)
+            {
+                deliver_held(node_id);
+            }
         }
 
         void mqtt_publish() // vector of mqtt messages
@@ -110,7 +140,14 @@ class Gateway
             if (mqtt_enabled)
             {
                 // map to telink and submit
-                auto packets = mqtt_to_telink(msg);
+                uint16_t node_id = 0;
+                LightCommand command;
+                if (mqtt_to_light_command(msg,ns,node_id,command) && hold_if_unavailable(node_id,command))
+                {
+                    return mqtt_enabled;
+                }
+                auto packets = command.packets(node_id);
+                trace_latency(packets);
                 mqtt_enabled = send_when_ready(packets);
             }
             return mqtt_enabled;
@@ -129,7 +166,7 @@ class Gateway
                         // enable mqtt
                         mqtt_enabled = true;
                         //start consuming
-                        mqtt->start_consuming();
+                        mqtt->start_consuming(ns.topic_prefix);
                     }
                 });
                 return false;
@@ -144,6 +181,7 @@ class Gateway
                 try {
                     for (auto packet : packets)
                     {               
+                        LatencyTracer::instance().queued(packet->getTrace());
                         mesh->send(packet);                        
                     }                    
                     return true;
@@ -159,7 +197,7 @@ class Gateway
                                         // enable mqtt
                                         mqtt_enabled = true;
                                         //start consuming
-                                        mqtt->start_consuming();
+                                        mqtt->start_consuming(ns.topic_prefix);
                                     }
                                 }
                                 catch (std::exception e)
@@ -173,7 +211,7 @@ class Gateway
                         g_warning("Send failed after maximum retries, dropping packets!");
                         // if we are here, mesh has not detected an error state - assume we were just unlucky
                         mqtt_enabled = true;                        
-                        mqtt->start_consuming();
+                        mqtt->start_consuming(ns.topic_prefix);
                     }
                     return false;
                 }
@@ -207,9 +245,98 @@ class Gateway
         }
     
     protected:
-        std::shared_ptr<TelinkMesh> mesh;
+
+        // a unicast command to a node that missed its deadline waits for the node instead of flooding the mesh
+        bool hold_if_unavailable(uint16_t node_id, const LightCommand& command)
+        {
+            if (!hold_commands || command.empty() || node_id == 0 || (node_id & 0x8000) != 0
+             || !availability.isUnavailable(node_id))
+            {
+                return false;
+            }
+            LOG_DEBUG("Node %u is unavailable, holding its command",node_id);
+            pending.hold(node_id,command);
+            return true;
+        }
+
+        // the latest state asked for while the node was away, as one packet
+        void deliver_held(uint16_t node_id)
+        {
+            auto command = pending.take(node_id);
+            if (!command)
+            {
+                return;
+            }
+            auto packet = command->coalesced(node_id);
+            if (packet)
+            {
+                g_message("Node %u is back, delivering the command held for it",node_id);
+                send_if_ready({packet});
+            }
+        }
+
+        // packets of the command being delivered carry its trace, a unicast command waits for the node's report
+        void trace_latency(const std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>>& packets)
+        {
+            auto trace = LatencyTracer::active();
+            if (!trace)
+            {
+                return;
+            }
+            for (auto& packet : packets)
+            {
+                packet->getTrace().command = trace;
+                auto dest = packet->getDestNode();
+                if (dest != 0 && (dest & 0x8000) == 0)
+                {
+                    // a newer command to the node replaces an unanswered one
+                    awaiting_report[dest] = trace;
+                }
+            }
+        }
+
+        void confirm_latency(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> msg)
+        {
+            uint16_t node;
+            if (msg->getCommand() == TelinkMeshProtocol::Command::COMMAND_ONLINE_STATUS_REPORT)
+            {
+                node = telink_reporting_node(msg);
+            }
+            else if (msg->getCommand() == TelinkMeshProtocol::Command::COMMAND_STATUS_REPORT)
+            {
+                node = msg->getSrcNode();
+            }
+            else
+            {
+                return;
+            }
+
+            auto it = awaiting_report.find(node);
+            if (it == awaiting_report.end())
+            {
+                return;
+            }
+            if (LatencyTracer::now_us() - it->second->arrived_us > max_report_wait_us)
+            {
+                // the command got lost, this report answers something else
+                awaiting_report.erase(it);
+            }
+            else if (LatencyTracer::instance().confirmed(*it->second))
+            {
+                awaiting_report.erase(it);
+            }
+        }
+
+        static constexpr int64_t max_report_wait_us = 30 * 1000000ll;
+
+        std::shared_ptr<MeshLink> mesh;
         std::shared_ptr<MQTTClientProxy> mqtt;
         bool mqtt_enabled;
+        MeshNamespace ns;
+        AvailabilityTracker availability;
+        bool hold_commands;
+        PendingCommands pending;   // shares the availability tracker's wheel, declared after it
+        std::unordered_map<uint16_t,std::shared_ptr<LatencyTrace>> awaiting_report;   // by node id
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+#ifndef LIGHT_COMMAND_H
+#define LIGHT_COMMAND_H
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "../ble_stack/telink_mesh_protocol.h"
+
+/* What a Home Assistant "set" message asks a light to do, each field only if the message names it.
+   A live command maps to one packet per field, a held one is merged with later commands for the
+   same node and delivered as a single packet.
+*/
+struct LightCommand
+{
+    std::optional<bool> on;
+    std::optional<uint8_t> brightness;
+    std::optional<std::array<uint8_t,3>> rgb;
+    std::optional<int> color_temp;      // mired
+
+    bool empty() const
+    {
+        return !on && !brightness && !rgb && !color_temp;
+    }
+
+    // fields set in the newer command win, a color replaces a color temperature and the other way round.
+    // Attributes without a state switch the light on when sent live, so they cancel a held off
+    void merge(const LightCommand& newer)
+    {
+        if (newer.on) { on = newer.on; }
+        else if ((newer.brightness || newer.rgb || newer.color_temp) && on && !*on) { on.reset(); }
+        if (newer.brightness) { brightness = newer.brightness; }
+        if (newer.rgb) { rgb = newer.rgb; color_temp.reset(); }
+        if (newer.color_temp) { color_temp = newer.color_temp; rgb.reset(); }
+    }
+
+    // one packet per field, in the order state, brightness, color, color temperature
+    std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> packets(uint16_t node_id) const
+    {
+        std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> packets;
+        if (on)
+        {
+            packets.push_back(on_off(node_id, *on));
+        }
+        if (brightness)
+        {
+            packets.push_back(attributes(node_id, *brightness));
+        }
+        if (rgb)
+        {
+            auto tmsg = attributes(node_id, 100);
+            set_rgb(*tmsg, *rgb);
+            packets.push_back(tmsg);
+        }
+        if (color_temp)
+        {
+            auto tmsg = attributes(node_id, 100);
+            set_color_temp(*tmsg, *color_temp);
+            packets.push_back(tmsg);
+        }
+        return packets;
+    }
+
+    // the whole desired state in one packet: off, the attributes (a light given a brightness is on), or just on
+    std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> coalesced(uint16_t node_id) const
+    {
+        if (on && !*on)
+        {
+            return on_off(node_id, false);
+        }
+        if (brightness || rgb || color_temp)
+        {
+            auto tmsg = attributes(node_id, brightness.value_or(100));
+            if (rgb)
+            {
+                set_rgb(*tmsg, *rgb);
+            }
+            else if (color_temp)
+            {
+                set_color_temp(*tmsg, *color_temp);
+            }
+            return tmsg;
+        }
+        if (on)
+        {
+            return on_off(node_id, true);
+        }
+        return nullptr;
+    }
+
+    protected:
+
+        static std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> on_off(uint16_t node_id, bool value)
+        {
+            auto tmsg = std::make_shared<TelinkMeshProtocol::TelinkLightOnOff>();
+            tmsg->set_on_off(value);
+            tmsg->setDestNode(node_id);
+            return tmsg;
+        }
+
+        static std::shared_ptr<TelinkMeshProtocol::TelinkLightSetAttributes> attributes(uint16_t node_id, uint8_t level)
+        {
+            auto tmsg = std::make_shared<TelinkMeshProtocol::TelinkLightSetAttributes>();
+            tmsg->setDestNode(node_id);
+            tmsg->set_brightness(level);
+            return tmsg;
+        }
+
+        static void set_rgb(TelinkMeshProtocol::TelinkLightSetAttributes& tmsg, const std::array<uint8_t,3>& rgb)
+        {
+            tmsg.set_red(rgb[0]);
+            tmsg.set_green(rgb[1]);
+            tmsg.set_blue(rgb[2]);
+        }
+
+        // warm and cold white channels for a color temperature, clamped to 2700-6500 K
+        static void set_color_temp(TelinkMeshProtocol::TelinkLightSetAttributes& tmsg, int t_mired)
+        {
+            uint8_t W = 0xff, Y = 0xff;
+            int tK = t_mired > 0 ? 1e6/t_mired : 6500;
+            tK = std::max(std::min(6500, tK), 2700);
+            if (tK > 4600) {
+                Y = static_cast<unsigned char>((((float) (6500 - tK)) * 255.0f) / 1900.0f);
+            } else {
+                W = static_cast<unsigned char>((((float) (tK - 2700)) * 255.0f) / 1900.0f);
+            }
+            tmsg.set_red(0);
+            tmsg.set_green(0);
+            tmsg.set_blue(0);
+            tmsg.set_yellow(Y);
+            tmsg.set_white(W);
+        }
+};
+
+#endif
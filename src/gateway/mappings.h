@@ -5,11 +5,33 @@
 #include <json/json.h> // Assuming you use the JsonCpp library for JSON
 #include <iomanip>
 #include "../ble_stack/telink_mesh_protocol.h"
+#include "light_command.h"
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "Mappings"
 
-mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshAddressReport> msg)
+// where a mesh lives in MQTT - one per mesh when a gateway serves several meshes
+struct MeshNamespace
+{
+    std::string topic_prefix = "homeassistant/light";  // topics are <prefix>/<node>/<suffix>
+    std::string unique_id_prefix = "mesh_light_";      // Home Assistant unique_id is <prefix><node>
+
+    // homeassistant/light/<mesh_id>/<node>/..., a valid discovery topic (node_id level)
+    static MeshNamespace forMesh(const std::string& mesh_id)
+    {
+        MeshNamespace ns;
+        ns.topic_prefix += "/" + mesh_id;
+        ns.unique_id_prefix = mesh_id + "_light_";
+        return ns;
+    }
+
+    std::string topic(uint16_t node_id, const std::string& suffix) const
+    {
+        return topic_prefix + "/" + std::to_string(node_id) + "/" + suffix;
+    }
+};
+
+mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshAddressReport> msg, const MeshNamespace& ns = MeshNamespace())
 {          
     auto mac_address = msg->getMAC();
     // Convert MAC address to string format
@@ -21,15 +43,15 @@ mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMe
     std::string mac_address_str = mac_ss.str();
     
     // Construct the topic string
-    std::string topic = "homeassistant/light/" + std::to_string(msg->getNodeID()) + "/config";
+    std::string topic = ns.topic(msg->getNodeID(),"config");
 
     // Create the JSON payload
     Json::Value payload;
     payload["name"] = "Light " + std::to_string(msg->getNodeID());
-    payload["unique_id"] = "mesh_light_" + std::to_string(msg->getNodeID());
-    payload["state_topic"] = "homeassistant/light/" + std::to_string(msg->getNodeID()) + "/state";
-    payload["command_topic"] = "homeassistant/light/" + std::to_string(msg->getNodeID()) + "/set";
-    payload["availability_topic"] = "homeassistant/light/" + std::to_string(msg->getNodeID()) + "/available";
+    payload["unique_id"] = ns.unique_id_prefix + std::to_string(msg->getNodeID());
+    payload["state_topic"] = ns.topic(msg->getNodeID(),"state");
+    payload["command_topic"] = ns.topic(msg->getNodeID(),"set");
+    payload["availability_topic"] = ns.topic(msg->getNodeID(),"available");
     payload["payload_available"] = "true";
     payload["payload_not_available"] = "false";
     payload["schema"] = "json";
@@ -77,34 +99,35 @@ def publish_light_availability(mqtt_client,mesh_id, available=True):
 
 */
 
-mqtt::message::ptr_t telink_to_mqtt_availability(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> msg)
+// node id of the reporting node for address/online status reports, 0xFFFF otherwise
+uint16_t telink_reporting_node(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> msg)
 {
-    uint16_t node_id;
-             
     switch (msg->getCommand())
     {
         case TelinkMeshProtocol::Command::COMMAND_ADDRESS_REPORT:
-            node_id = std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshAddressReport>(msg)->getNodeID();
-            break;
+            return std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshAddressReport>(msg)->getNodeID();
         case TelinkMeshProtocol::Command::COMMAND_ONLINE_STATUS_REPORT:
-            node_id = std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshOnlineStatusReport>(msg)->getNodeID();
-            break;
+            return std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshOnlineStatusReport>(msg)->getNodeID();
         default:
-            node_id=0xFFFF;
+            return 0xFFFF;
     }
-    
+}
+
+mqtt::message::ptr_t telink_to_mqtt_availability(uint16_t node_id, bool available, const MeshNamespace& ns = MeshNamespace())
+{
     // Build the topic string
-    std::string topic = "homeassistant/light/" + std::to_string(node_id) + "/available";
+    std::string topic = ns.topic(node_id,"available");
     
-    std::string payload_str = "true";
+    std::string payload_str = available ? "true" : "false";
 
-    return mqtt::message::create(topic,payload_str);
+    // retained, so subscribers joining later see the current availability
+    return mqtt::message::create(topic,payload_str,1,true);
 }
 
-mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshOnlineStatusReport> msg)
+mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshOnlineStatusReport> msg, const MeshNamespace& ns = MeshNamespace())
 {        
     // Build the topic string
-    std::string topic = "homeassistant/light/" + std::to_string(msg->getNodeID()) + "/state";
+    std::string topic = ns.topic(msg->getNodeID(),"state");
 
     // Create the JSON payload
     Json::Value payload;
@@ -119,9 +142,9 @@ mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMe
     return mqtt::message::create(topic,payload_str);
 }
 
-mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkLightStatusReport> msg)
+mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkLightStatusReport> msg, const MeshNamespace& ns = MeshNamespace())
 {    
-    const std::string topic = "homeassistant/light/" + std::to_string(msg->getSrcNode()) + "/status";
+    const std::string topic = ns.topic(msg->getSrcNode(),"status");
 
 
     // Construct the JSON payload
@@ -142,9 +165,9 @@ mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkLi
     return mqtt::message::create(topic,payload_str);
 }
 
-mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshGroupIDReport> msg)
+mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshGroupIDReport> msg, const MeshNamespace& ns = MeshNamespace())
 {    
-    const std::string topic = "homeassistant/light/" + std::to_string(msg->getSrcNode()) + "/status";
+    const std::string topic = ns.topic(msg->getSrcNode(),"status");
 
 
     // Construct the JSON payload
@@ -159,9 +182,9 @@ mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMe
     return mqtt::message::create(topic,payload_str);
 }
 
-mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshDeviceInfoReport> msg)
+mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshDeviceInfoReport> msg, const MeshNamespace& ns = MeshNamespace())
 {    
-    const std::string topic = "homeassistant/light/" + std::to_string(msg->getSrcNode()) + "/status";
+    const std::string topic = ns.topic(msg->getSrcNode(),"status");
 
 
     // Construct the JSON payload
@@ -176,9 +199,9 @@ mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMe
     return mqtt::message::create(topic,payload_str);
 }
 
-mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshTimeReport> msg)
+mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshTimeReport> msg, const MeshNamespace& ns = MeshNamespace())
 {    
-    const std::string topic = "homeassistant/light/" + std::to_string(msg->getSrcNode()) + "/status";
+    const std::string topic = ns.topic(msg->getSrcNode(),"status");
 
 
     // Construct the JSON payload
@@ -191,18 +214,18 @@ mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMe
     return mqtt::message::create(topic,payload);
 }
 
-mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> msg)
+mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> msg, const MeshNamespace& ns = MeshNamespace())
 {       
         switch (msg->getCommand())
         {
             case TelinkMeshProtocol::Command::COMMAND_ADDRESS_REPORT:
-                return telink_to_mqtt(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshAddressReport>(msg));
+                return telink_to_mqtt(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshAddressReport>(msg),ns);
                 break;
             case TelinkMeshProtocol::Command::COMMAND_ONLINE_STATUS_REPORT:
-                return telink_to_mqtt(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshOnlineStatusReport>(msg));
+                return telink_to_mqtt(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshOnlineStatusReport>(msg),ns);
                 break;
             case TelinkMeshProtocol::Command::COMMAND_STATUS_REPORT:
-                return telink_to_mqtt(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkLightStatusReport>(msg));
+                return telink_to_mqtt(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkLightStatusReport>(msg),ns);
                 break;
             case TelinkMeshProtocol::Command::COMMAND_GROUP_ID_REPORT:
                 //return telink_to_mqtt(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshGroupIDReport>(msg));
@@ -219,28 +242,34 @@ mqtt::message::ptr_t telink_to_mqtt(std::shared_ptr<TelinkMeshProtocol::TelinkMe
         throw std::runtime_error("Not implemented yet");
 }
 
-std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> mqtt_to_telink(mqtt::const_message_ptr msg)
+// parses "<prefix>/<node>/set", false if the message is not a command for a node
+bool mqtt_to_light_command(mqtt::const_message_ptr msg, const MeshNamespace& ns, uint16_t& node_id, LightCommand& command)
 {
-
-    std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> packets = {};
-    // Parse the topic to match "homeassistant/light/+/set" and "homeassistant/light/+/state"
+    // Parse the topic to match "<prefix>/+/set" and "<prefix>/+/state"
     std::string topic = msg->get_topic();    
 
     try {
+        const std::string prefix = ns.topic_prefix + "/";
+        if (topic.compare(0, prefix.size(), prefix) != 0) {
+            g_warning("Topic %s is outside of %s, ignoring message.",topic.c_str(),ns.topic_prefix.c_str());
+            return false;
+        }
+
         std::vector<std::string> topic_parts;
-        std::istringstream topic_stream(topic);
+        std::istringstream topic_stream(topic.substr(prefix.size()));
         std::string part;
 
         while (std::getline(topic_stream, part, '/')) {
             topic_parts.push_back(part);
         }
 
-        if (topic_parts.size() != 4 || topic_parts[0] != "homeassistant" || topic_parts[1] != "light") {
+        if (topic_parts.size() != 2) {
             g_warning("Invalid topic format, ignoring message."); 
+            return false;
         }
 
         // Extract the mesh node ID from the topic
-        uint16_t node_id = std::stoi(topic_parts[2]); // The mesh ID is the third part of the topic
+        node_id = std::stoi(topic_parts[0]); // The mesh ID follows the prefix
         
                 
         Json::Value payload;
@@ -254,69 +283,33 @@ std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> mqtt_to_telin
             g_warning("Error decoding JSON payload: %s. Ignoring message.",errs.c_str());
         }
 
-    // Determine purpose and map to telink packet
+    // Determine purpose and map to a light command
 
     // Process the "set" topic
-        if (topic_parts[3] == "set") {
+        if (topic_parts[1] == "set") {
             if (payload.isMember("state")) {
                 std::string state = payload["state"].asString();
                 std::transform(state.begin(), state.end(), state.begin(), ::toupper);
-                
-                auto tmsg = std::make_shared<TelinkMeshProtocol::TelinkLightOnOff>();
-                
-                tmsg->set_on_off(state == "ON");
-                tmsg->setDestNode(node_id);
-                packets.push_back(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshPacket>(tmsg));
+                command.on = state == "ON";
             }
 
             if (payload.isMember("brightness")) {
-                uint8_t brightness = payload["brightness"].asInt();                            
-                auto tmsg = std::make_shared<TelinkMeshProtocol::TelinkLightSetAttributes>();
-                tmsg->setDestNode(node_id);
-                tmsg->set_brightness(brightness);
-                packets.push_back(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshPacket>(tmsg));
+                command.brightness = static_cast<uint8_t>(payload["brightness"].asInt());
             }
 
             if (payload.isMember("color")) {
                 const Json::Value& color = payload["color"];
                 if (color.isMember("r") && color.isMember("g") && color.isMember("b")) {
-                    int r = color["r"].asInt();
-                    int g = color["g"].asInt();
-                    int b = color["b"].asInt();
-                    auto tmsg = std::make_shared<TelinkMeshProtocol::TelinkLightSetAttributes>();
-                    tmsg->setDestNode(node_id);
-                    tmsg->set_red(r);
-                    tmsg->set_green(g);
-                    tmsg->set_blue(b);
-                    tmsg->set_brightness(100);
-                    packets.push_back(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshPacket>(tmsg));
+                    command.rgb = std::array<uint8_t,3>{static_cast<uint8_t>(color["r"].asInt()),
+                                                        static_cast<uint8_t>(color["g"].asInt()),
+                                                        static_cast<uint8_t>(color["b"].asInt())};
                 }
             }
 
             if (payload.isMember("color_temp")) {
-                int t_mired = payload["color_temp"].asInt();
-
-                auto tmsg = std::make_shared<TelinkMeshProtocol::TelinkLightSetAttributes>();
-                uint8_t W = 0xff, Y = 0xff;
-                
-
-                int tK = 1e6/t_mired;
-                
-                tK = std::max(std::min(6500, tK), 2700);
-                if (tK > 4600) {
-                    Y = static_cast<unsigned char>((((float) (6500 - tK)) * 255.0f) / 1900.0f);
-                } else {
-                    W = static_cast<unsigned char>((((float) (tK - 2700)) * 255.0f) / 1900.0f);
-                }
-                tmsg->setDestNode(node_id);
-                tmsg->set_red(0);
-                tmsg->set_green(0);
-                tmsg->set_blue(0);
-                tmsg->set_brightness(100);  
-                tmsg->set_yellow(Y);  
-                tmsg->set_white(W);
-                packets.push_back(std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshPacket>(tmsg));                
+                command.color_temp = payload["color_temp"].asInt();
             }
+            return true;
         }
         // Process the "state" topic
        /* else if (topic_parts[3] == "state") {
@@ -329,7 +322,17 @@ std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> mqtt_to_telin
         std::cerr << "Error processing MQTT message: " << e.what() << std::endl;
     }
 
-    return packets;
+    return false;
+}
+
+std::vector<std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> mqtt_to_telink(mqtt::const_message_ptr msg, const MeshNamespace& ns = MeshNamespace())
+{
+    uint16_t node_id;
+    LightCommand command;
+    if (!mqtt_to_light_command(msg, ns, node_id, command)) {
+        return {};
+    }
+    return command.packets(node_id);
 }
 
 std::shared_ptr<TelinkMeshProtocol::TelinkMeshAddressEdit> prepareAddressQuery()
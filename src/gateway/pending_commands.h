@@ -0,0 +1,92 @@
+#ifndef PENDING_COMMANDS_H
+#define PENDING_COMMANDS_H
+
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include "timer_wheel.h"
+#include "light_command.h"
+
+/* Responsibilities:
+    hold the latest desired state of nodes that are offline, later commands merge into it
+    forget a held state that is not picked up within its time to live
+    hand the state over once, when the node is back
+   Deadlines run on the timer wheel of the availability tracker, so they need no main loop source
+   of their own. Entries stay allocated per node once used, like the tracker's.
+*/
+class PendingCommands
+{
+    public:
+
+        PendingCommands(TimerWheel& wheel, uint64_t ttl_ticks)
+            : wheel(wheel), ttl_ticks(ttl_ticks)
+        {
+        }
+
+        // merges into the node's held command, the time to live restarts with every command
+        void hold(uint16_t node_id, const LightCommand& command)
+        {
+            auto& entry = entries[node_id];
+            if (!entry)
+            {
+                entry = std::make_unique<Entry>();
+                entry->timer.setCallback([this,node_id]() { on_expired(node_id); });
+            }
+
+            if (!entry->command)
+            {
+                entry->command = command;
+                held++;
+            }
+            else
+            {
+                entry->command->merge(command);
+            }
+            wheel.schedule(entry->timer, ttl_ticks);
+        }
+
+        // the node's held command, nothing if none is held or it expired
+        std::optional<LightCommand> take(uint16_t node_id)
+        {
+            auto it = entries.find(node_id);
+            if (it == entries.end() || !it->second->command)
+            {
+                return std::nullopt;
+            }
+            it->second->timer.cancel();
+            std::optional<LightCommand> command;
+            command.swap(it->second->command);
+            held--;
+            return command;
+        }
+
+        size_t size() const { return held; }
+        uint64_t getExpired() const { return expired; }
+
+    protected:
+
+        struct Entry
+        {
+            std::optional<LightCommand> command;
+            TimerWheel::Timer timer;
+        };
+
+        void on_expired(uint16_t node_id)
+        {
+            auto it = entries.find(node_id);
+            if (it != entries.end() && it->second->command)
+            {
+                it->second->command.reset();
+                held--;
+                expired++;
+            }
+        }
+
+        TimerWheel& wheel;
+        const uint64_t ttl_ticks;
+        std::unordered_map<uint16_t,std::unique_ptr<Entry>> entries;
+        size_t held = 0;
+        uint64_t expired = 0;
+};
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Session files: what reached the gateway from the outside, with timing, for replay.
+
+   Layout: the magic "TMR1", then one record after another
+     varint  microseconds since the previous record
+     u8      kind
+     MQTT_IN:  u8 flags (bits 0-1 QoS, bit 2 retained), varint topic length, topic, varint payload length, payload
+     MESH_RX:  u8 channel (index of the mesh in the process), u8 length, decrypted packet bytes
+   A notification costs 24-26 bytes. A file cut short by a crash reads up to its last complete record.
+*/
+namespace SessionLog {
+
+enum Kind : uint8_t
+{
+    MQTT_IN = 1,    // consumed from the broker
+    MESH_RX = 2     // notification from a mesh node
+};
+
+struct Record
+{
+    uint64_t time_us = 0;       // since the start of the recording
+    Kind kind = MQTT_IN;
+    uint8_t channel = 0;        // MESH_RX only
+    uint8_t qos = 0;            // MQTT_IN only
+    bool retained = false;      // MQTT_IN only
+    std::string topic;          // MQTT_IN only
+    std::string payload;        // MQTT payload or raw packet bytes
+};
+
+static constexpr char magic[4] = {'T','M','R','1'};
+
+/* Responsibilities:
+    append records to a session file, stamped with the monotonic clock
+    keep writes off the disk until a buffer fills or flush() is called
+   Not thread safe, everything recorded comes from the gateway's main loop.
+*/
+class Writer
+{
+    public:
+
+        // throws std::runtime_error if the file can't be created
+        explicit Writer(const std::string& path)
+            : file(std::fopen(path.c_str(), "wb")), start(std::chrono::steady_clock::now())
+        {
+            if (!file)
+            {
+                throw std::runtime_error("Could not create session file " + path);
+            }
+            buffer.reserve(max_buffer + 512);
+            buffer.insert(buffer.end(), magic, magic + sizeof(magic));
+        }
+
+        ~Writer()
+        {
+            flush();
+            std::fclose(file);
+        }
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        void mqtt(const std::string& topic, const std::string& payload, uint8_t qos, bool retained)
+        {
+            Record record;
+            record.time_us = now_us();
+            record.kind = MQTT_IN;
+            record.qos = qos;
+            record.retained = retained;
+            record.topic = topic;
+            record.payload = payload;
+            write(record);
+        }
+
+        void mesh(uint8_t channel, const uint8_t* data, size_t length)
+        {
+            Record record;
+            record.time_us = now_us();
+            record.kind = MESH_RX;
+            record.channel = channel;
+            record.payload.assign(reinterpret_cast<const char*>(data), length);
+            write(record);
+        }
+
+        // records must come in time order, an earlier one is stamped with the previous time
+        void write(const Record& record)
+        {
+            uint64_t time = record.time_us > last_us ? record.time_us : last_us;
+            put_varint(time - last_us);
+            last_us = time;
+            buffer.push_back(record.kind);
+
+            if (record.kind == MESH_RX)
+            {
+                const size_t length = record.payload.size() < 255 ? record.payload.size() : 255;
+                buffer.push_back(record.channel);
+                buffer.push_back(static_cast<uint8_t>(length));
+                buffer.insert(buffer.end(), record.payload.begin(), record.payload.begin() + length);
+            }
+            else
+            {
+                buffer.push_back((record.qos & 0x03) | (record.retained ? 0x04 : 0));
+                put_varint(record.topic.size());
+                buffer.insert(buffer.end(), record.topic.begin(), record.topic.end());
+                put_varint(record.payload.size());
+                buffer.insert(buffer.end(), record.payload.begin(), record.payload.end());
+            }
+            records++;
+
+            if (buffer.size() >= max_buffer)
+            {
+                flush();
+            }
+        }
+
+        void flush()
+        {
+            if (!buffer.empty())
+            {
+                std::fwrite(buffer.data(), 1, buffer.size(), file);
+                std::fflush(file);
+                buffer.clear();
+            }
+        }
+
+        uint64_t getRecords() const { return records; }
+
+    protected:
+
+        uint64_t now_us() const
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        void put_varint(uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                buffer.push_back(static_cast<uint8_t>(value) | 0x80);
+                value >>= 7;
+            }
+            buffer.push_back(static_cast<uint8_t>(value));
+        }
+
+        static constexpr size_t max_buffer = 64 * 1024;
+
+        FILE* file;
+        std::chrono::steady_clock::time_point start;
+        uint64_t last_us = 0;
+        uint64_t records = 0;
+        std::vector<uint8_t> buffer;
+};
+
+/* Responsibilities:
+    load a whole session file, so replaying it never waits for the disk
+    hand out its records in order
+*/
+class Reader
+{
+    public:
+
+        // throws std::runtime_error if the file can't be read or isn't a session file
+        explicit Reader(const std::string& path)
+        {
+            FILE* file = std::fopen(path.c_str(), "rb");
+            if (!file)
+            {
+                throw std::runtime_error("Could not open session file " + path);
+            }
+            uint8_t chunk[64 * 1024];
+            size_t length;
+            while ((length = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+            {
+                data.insert(data.end(), chunk, chunk + length);
+            }
+            std::fclose(file);
+
+            if (data.size() < sizeof(magic) || std::memcmp(data.data(), magic, sizeof(magic)) != 0)
+            {
+                throw std::runtime_error("Not a session file: " + path);
+            }
+            offset = sizeof(magic);
+        }
+
+        // false at the end of the file, or at a record cut short
+        bool next(Record& record)
+        {
+            size_t position = offset;
+            uint64_t delta;
+            if (!get_varint(position, delta) || position >= data.size())
+            {
+                return end(position);
+            }
+            record.kind = static_cast<Kind>(data[position++]);
+
+            if (record.kind == MESH_RX)
+            {
+                if (position + 2 > data.size() || position + 2 + data[position + 1] > data.size())
+                {
+                    return end(position);
+                }
+                record.channel = data[position];
+                size_t length = data[position + 1];
+                record.topic.clear();
+                record.payload.assign(reinterpret_cast<const char*>(&data[position + 2]), length);
+                position += 2 + length;
+            }
+            else if (record.kind == MQTT_IN)
+            {
+                if (position >= data.size())
+                {
+                    return end(position);
+                }
+                uint8_t flags = data[position++];
+                record.qos = flags & 0x03;
+                record.retained = (flags & 0x04) != 0;
+                if (!get_string(position, record.topic) || !get_string(position, record.payload))
+                {
+                    return end(position);
+                }
+            }
+            else
+            {
+                // unknown kind, nothing after it can be trusted
+                truncated = true;
+                offset = data.size();
+                return false;
+            }
+
+            time_us += delta;
+            record.time_us = time_us;
+            offset = position;
+            return true;
+        }
+
+        // the file ended in the middle of a record
+        bool isTruncated() const { return truncated; }
+
+    protected:
+
+        bool end(size_t position)
+        {
+            truncated = position > offset || offset < data.size();
+            offset = data.size();
+            return false;
+        }
+
+        bool get_varint(size_t& position, uint64_t& value) const
+        {
+            value = 0;
+            for (unsigned int shift = 0; shift < 64; shift += 7)
+            {
+                if (position >= data.size())
+                {
+                    return false;
+                }
+                uint8_t byte = data[position++];
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool get_string(size_t& position, std::string& value) const
+        {
+            uint64_t length;
+            if (!get_varint(position, length) || length > data.size() - position)
+            {
+                return false;
+            }
+            value.assign(reinterpret_cast<const char*>(&data[position]), length);
+            position += length;
+            return true;
+        }
+
+        std::vector<uint8_t> data;
+        size_t offset = 0;
+        uint64_t time_us = 0;
+        bool truncated = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef SESSION_REPLAY_H
+#define SESSION_REPLAY_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <glibmm/main.h>
+#include <mqtt/client.h>
+
+#include "../ble_stack/mesh_link.h"
+#include "../logging/log.h"
+#include "session_log.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "Session"
+
+/* Responsibilities:
+    pass a mesh through unchanged, recording every packet it delivers to the gateway
+*/
+class RecordingMesh : public MeshLink {
+public:
+
+    RecordingMesh(std::shared_ptr<MeshLink> mesh, SessionLog::Writer& writer, uint8_t channel)
+        : mesh(mesh), writer(writer), channel(channel) {}
+
+    void setRxCallback(sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback) override
+    {
+        this->rxCallback = rxCallback;
+        mesh->setRxCallback(sigc::mem_fun(*this,&RecordingMesh::on_packet_rx));
+    }
+
+    bool isReady() override { return mesh->isReady(); }
+    void onReady(std::function<void()> callback) override { mesh->onReady(callback); }
+    void send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet) override { mesh->send(packet); }
+
+protected:
+
+    void on_packet_rx(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
+    {
+        auto data = packet->getData();
+        writer.mesh(channel, data.data(), data.size());
+        rxCallback(packet);
+    }
+
+    std::shared_ptr<MeshLink> mesh;
+    SessionLog::Writer& writer;
+    uint8_t channel;
+    sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback;
+};
+
+/* Responsibilities:
+    stand in for a mesh during replay: always ready, swallows what the gateway sends,
+    delivers recorded notifications as if a node had sent them
+    count what was sent, the replay's measure of gateway throughput
+*/
+class ReplayMesh : public MeshLink {
+public:
+
+    void setRxCallback(sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback) override
+    {
+        this->rxCallback = rxCallback;
+    }
+
+    bool isReady() override { return true; }
+
+    void onReady(std::function<void()> callback) override { callback(); }
+
+    void send(const std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>) override
+    {
+        sent++;
+        last_send = std::chrono::steady_clock::now();
+    }
+
+    void inject(const std::string& data)
+    {
+        auto packet = TelinkMeshProtocol::TelinkMeshPacket::create(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+        rxCallback(packet);
+    }
+
+    uint64_t getSent() const { return sent; }
+    std::chrono::steady_clock::time_point getLastSend() const { return last_send; }
+
+protected:
+    sigc::slot<void,std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket>> rxCallback;
+    uint64_t sent = 0;
+    std::chrono::steady_clock::time_point last_send;
+};
+
+/* Responsibilities:
+    replay a session file against gateways running on ReplayMesh stand-ins:
+    mesh notifications are injected directly, MQTT messages are published to the broker,
+    so they reach the gateway through the same client and main loop path as in production
+    keep recorded timing (scaled by speed) or run as fast as possible (speed 0)
+    publish without the retained flag unless asked to, a replay must not overwrite the broker's retained state
+    report replay lag and gateway output once the gateway has gone quiet
+*/
+class SessionReplayer {
+public:
+
+    SessionReplayer(const std::string& path,
+                    std::vector<std::shared_ptr<ReplayMesh>> meshes,
+                    const std::string& broker_url,
+                    const std::string& client_id,
+                    double speed,
+                    std::function<void()> finished,
+                    bool retain = false)
+        : meshes(meshes), client(broker_url, client_id), speed(speed), retain(retain), finished(finished)
+    {
+        SessionLog::Reader reader(path);
+        SessionLog::Record record;
+        while (reader.next(record))
+        {
+            records.push_back(record);
+        }
+        if (reader.isTruncated())
+        {
+            g_warning("Session file %s ends in a partial record, replaying %zu complete ones",path.c_str(),records.size());
+        }
+
+        mqtt::connect_options options;
+        options.set_clean_session(true);
+        client.connect(options);
+    }
+
+    ~SessionReplayer()
+    {
+        timer.disconnect();
+        try
+        {
+            client.disconnect();
+        }
+        catch (const mqtt::exception& e)
+        {
+            g_warning("Replay client disconnect failed: %s",e.what());
+        }
+    }
+
+    void start()
+    {
+        g_message("Replaying %zu records %s",records.size(),speed > 0 ? "at recorded timing" : "as fast as possible");
+        started = std::chrono::steady_clock::now();
+        schedule();
+    }
+
+protected:
+
+    using Clock = std::chrono::steady_clock;
+
+    void schedule()
+    {
+        if (next >= records.size())
+        {
+            replayed = Clock::now();
+            timer = Glib::signal_timeout().connect([this]() { return settle(); }, settle_poll_ms);
+            return;
+        }
+
+        if (speed <= 0)
+        {
+            // let the loop dispatch what the gateway received in between
+            timer = Glib::signal_idle().connect([this]() { run_slice(); return false; });
+            return;
+        }
+
+        auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(due(records[next]) - Clock::now()).count();
+        timer = Glib::signal_timeout().connect([this]() { run_slice(); return false; }, delay > 0 ? delay : 0);
+    }
+
+    // replays everything that is due, but never holds the loop for more than a slice
+    void run_slice()
+    {
+        auto slice_end = Clock::now() + std::chrono::microseconds(slice_us);
+        while (next < records.size())
+        {
+            auto now = Clock::now();
+            if (now >= slice_end)
+            {
+                break;
+            }
+            if (speed > 0)
+            {
+                if (due(records[next]) > now)
+                {
+                    break;
+                }
+                auto lag = std::chrono::duration_cast<std::chrono::microseconds>(now - due(records[next])).count();
+                max_lag_us = std::max<int64_t>(max_lag_us, lag);
+            }
+            replay(records[next++]);
+        }
+        schedule();
+    }
+
+    void replay(const SessionLog::Record& record)
+    {
+        try
+        {
+            if (record.kind == SessionLog::MESH_RX)
+            {
+                if (record.channel >= meshes.size())
+                {
+                    skipped++;
+                    return;
+                }
+                meshes[record.channel]->inject(record.payload);
+                injected++;
+            }
+            else
+            {
+                auto message = mqtt::make_message(record.topic, record.payload, record.qos, retain && record.retained);
+                client.publish(message);
+                published++;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            // the recording may hold packets today's gateway rejects, keep going
+            skipped++;
+            LOG_DEBUG("Replay of record at %llu us failed: %s",static_cast<unsigned long long>(record.time_us),e.what());
+        }
+    }
+
+    // the gateway is done once it hasn't sent anything for a while
+    bool settle()
+    {
+        uint64_t sent = 0;
+        auto last_send = replayed;
+        for (const auto& mesh : meshes)
+        {
+            sent += mesh->getSent();
+            last_send = std::max(last_send, mesh->getLastSend());
+        }
+        if (sent != settled_sent)
+        {
+            settled_sent = sent;
+            return true;
+        }
+        if (Clock::now() - last_send < std::chrono::milliseconds(settle_quiet_ms))
+        {
+            return true;
+        }
+
+        auto ms = [this](Clock::time_point t) {
+            return static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(t - started).count());
+        };
+        g_message("Replay done: %zu records in %lld ms, %llu MQTT messages published, %llu mesh notifications injected, %llu skipped",
+                  records.size(), ms(replayed),
+                  static_cast<unsigned long long>(published), static_cast<unsigned long long>(injected),
+                  static_cast<unsigned long long>(skipped));
+        g_message("Gateway sent %llu mesh packets, the last at %lld ms; max replay lag %lld us",
+                  static_cast<unsigned long long>(sent), ms(last_send), static_cast<long long>(max_lag_us));
+
+        if (finished)
+        {
+            finished();
+        }
+        return false;
+    }
+
+    Clock::time_point due(const SessionLog::Record& record) const
+    {
+        return started + std::chrono::microseconds(static_cast<int64_t>(record.time_us / speed));
+    }
+
+    static constexpr int64_t slice_us = 2000;
+    static constexpr unsigned int settle_poll_ms = 100;
+    static constexpr unsigned int settle_quiet_ms = 1000;
+
+    std::vector<SessionLog::Record> records;
+    std::vector<std::shared_ptr<ReplayMesh>> meshes;
+    mqtt::client client;
+    double speed;
+    bool retain;
+    std::function<void()> finished;
+
+    size_t next = 0;
+    Clock::time_point started;
+    Clock::time_point replayed;
+    sigc::connection timer;
+
+    uint64_t published = 0;
+    uint64_t injected = 0;
+    uint64_t skipped = 0;
+    uint64_t settled_sent = 0;
+    int64_t max_lag_us = 0;
+};
+
+#endif
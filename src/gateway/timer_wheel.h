@@ -0,0 +1,174 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+/* Hierarchical timer wheel
+    4 levels of 64 slots each, i.e. 2^24 ticks of range.
+    schedule/cancel are O(1) (intrusive doubly linked slot lists),
+    advancing one tick is O(1) amortized (timers cascade down at most 3 times).
+    Not thread safe - meant to be driven from a single periodic main loop source.
+*/
+class TimerWheel {
+public:
+
+    class Timer
+    {
+        friend class TimerWheel;
+        public:
+            Timer() = default;
+            explicit Timer(std::function<void()> callback) : callback(std::move(callback)) {}
+            ~Timer() { cancel(); }
+
+            Timer(const Timer&) = delete;
+            Timer& operator=(const Timer&) = delete;
+
+            void setCallback(std::function<void()> cb) { callback = std::move(cb); }
+
+            bool isPending() const { return wheel != nullptr; }
+            uint64_t getExpiry() const { return expiry; }
+
+            void cancel()
+            {
+                if (wheel)
+                {
+                    wheel->unlink(*this);
+                }
+            }
+
+        protected:
+            Timer* prev = nullptr;
+            Timer* next = nullptr;
+            TimerWheel* wheel = nullptr;
+            uint64_t expiry = 0;
+            std::function<void()> callback;
+    };
+
+    static constexpr unsigned LEVEL_BITS = 6;
+    static constexpr unsigned LEVELS = 4;
+    static constexpr uint64_t SLOTS = 1ull << LEVEL_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+    static constexpr uint64_t MAX_TICKS = (1ull << (LEVEL_BITS * LEVELS)) - 1;
+
+    TimerWheel()
+    {
+        for (auto& level : slots)
+        {
+            for (auto& head : level)
+            {
+                head.prev = &head;
+                head.next = &head;
+            }
+        }
+    }
+
+    ~TimerWheel()
+    {
+        // detach remaining timers so their destructors do not touch us
+        for (auto& level : slots)
+        {
+            for (auto& head : level)
+            {
+                while (head.next != &head)
+                {
+                    unlink(*head.next);
+                }
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // (re)arm timer to fire 'ticks' ticks from now (0 fires on the next tick)
+    void schedule(Timer& timer, uint64_t ticks)
+    {
+        timer.cancel();
+        if (ticks == 0) { ticks = 1; }
+        if (ticks > MAX_TICKS) { ticks = MAX_TICKS; }
+        timer.expiry = current + ticks;
+        link(timer);
+    }
+
+    // advance the wheel by 'ticks' ticks, firing expired timers
+    void advance(uint64_t ticks = 1)
+    {
+        while (ticks-- > 0)
+        {
+            tick();
+        }
+    }
+
+    uint64_t now() const { return current; }
+    size_t size() const { return count; }
+
+protected:
+
+    void tick()
+    {
+        ++current;
+
+        // cascade higher levels each time the level below wraps around
+        for (unsigned level = 1; level < LEVELS; level++)
+        {
+            if ((current & ((1ull << (LEVEL_BITS * level)) - 1)) != 0) { break; }
+
+            Timer& head = slots[level][(current >> (LEVEL_BITS * level)) & SLOT_MASK];
+            while (head.next != &head)
+            {
+                Timer& timer = *head.next;
+                unlink(timer);
+                link(timer);
+            }
+        }
+
+        // fire everything in the current level 0 slot - callbacks may re-arm their timer
+        Timer& head = slots[0][current & SLOT_MASK];
+        while (head.next != &head)
+        {
+            Timer& timer = *head.next;
+            unlink(timer);
+            if (timer.callback)
+            {
+                timer.callback();
+            }
+        }
+    }
+
+    void link(Timer& timer)
+    {
+        uint64_t delta = timer.expiry > current ? timer.expiry - current : 0;
+        unsigned level = 0;
+        while (level < LEVELS - 1 && delta >= (1ull << (LEVEL_BITS * (level + 1))))
+        {
+            level++;
+        }
+
+        Timer& head = slots[level][(timer.expiry >> (LEVEL_BITS * level)) & SLOT_MASK];
+        timer.prev = head.prev;
+        timer.next = &head;
+        head.prev->next = &timer;
+        head.prev = &timer;
+        timer.wheel = this;
+        count++;
+    }
+
+    void unlink(Timer& timer)
+    {
+        timer.prev->next = timer.next;
+        timer.next->prev = timer.prev;
+        timer.prev = nullptr;
+        timer.next = nullptr;
+        timer.wheel = nullptr;
+        count--;
+    }
+
+    std::array<std::array<Timer, SLOTS>, LEVELS> slots;
+    uint64_t current = 0;
+    size_t count = 0;
+};
+
+#endif
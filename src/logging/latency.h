@@ -0,0 +1,292 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+/* Responsibilities:
+    count latencies in log-linear buckets, HDR histogram style: every power of two
+    is split into 32 linear buckets, so any value is kept within 1/32 (3%) of itself
+    answer percentiles, mean and max from the counts
+   Recording is a few relaxed atomic increments and safe from any thread. Values are
+   microseconds, from 0 to about 76 hours, larger ones are counted in the last bucket.
+*/
+class LatencyHistogram
+{
+    public:
+
+        static constexpr unsigned int sub_bits = 5;
+        static constexpr uint64_t sub_count = 1ull << sub_bits;     // linear buckets per power of two
+        static constexpr unsigned int max_shift = 32;
+        static constexpr size_t buckets = 2 * sub_count + max_shift * sub_count;
+
+        LatencyHistogram() = default;
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        void record(int64_t value_us)
+        {
+            const uint64_t value = value_us < 0 ? 0 : static_cast<uint64_t>(value_us);
+            counts[index_of(value)].fetch_add(1, std::memory_order_relaxed);
+            total.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+
+            uint64_t seen = max.load(std::memory_order_relaxed);
+            while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        uint64_t getCount() const { return total.load(std::memory_order_relaxed); }
+        uint64_t getSum() const { return sum.load(std::memory_order_relaxed); }
+        uint64_t getMax() const { return max.load(std::memory_order_relaxed); }
+
+        double getMean() const
+        {
+            auto count = getCount();
+            return count ? static_cast<double>(getSum()) / count : 0.0;
+        }
+
+        // smallest value that at least quantile (0..1) of the recorded values do not exceed,
+        // reported as the top of its bucket like HdrHistogram does
+        uint64_t getPercentile(double quantile) const
+        {
+            const uint64_t count = getCount();
+            if (count == 0)
+            {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * count));
+            rank = rank < 1 ? 1 : (rank > count ? count : rank);
+
+            uint64_t seen = 0;
+            for (size_t i = 0; i < buckets; i++)
+            {
+                seen += counts[i].load(std::memory_order_relaxed);
+                if (seen >= rank)
+                {
+                    auto top = highest_in(i);
+                    return top < getMax() ? top : getMax();
+                }
+            }
+            return getMax();
+        }
+
+        // values in the buckets that end at or below bound_us, for cumulative exposition formats
+        uint64_t countUpTo(uint64_t bound_us) const
+        {
+            uint64_t seen = 0;
+            for (size_t i = 0; i < buckets && highest_in(i) <= bound_us; i++)
+            {
+                seen += counts[i].load(std::memory_order_relaxed);
+            }
+            return seen;
+        }
+
+        static size_t index_of(uint64_t value)
+        {
+            if (value < 2 * sub_count)
+            {
+                return value;
+            }
+            unsigned int shift = std::bit_width(value) - (sub_bits + 1);
+            if (shift > max_shift)
+            {
+                return buckets - 1;
+            }
+            return 2 * sub_count + (shift - 1) * sub_count + ((value >> shift) - sub_count);
+        }
+
+        static uint64_t lowest_in(size_t index)
+        {
+            if (index < 2 * sub_count)
+            {
+                return index;
+            }
+            unsigned int shift = (index - 2 * sub_count) / sub_count + 1;
+            return (sub_count + (index - 2 * sub_count) % sub_count) << shift;
+        }
+
+        static uint64_t highest_in(size_t index)
+        {
+            return index + 1 < buckets ? lowest_in(index + 1) - 1 : UINT64_MAX;
+        }
+
+    protected:
+
+        std::array<std::atomic<uint64_t>,buckets> counts{};
+        std::atomic<uint64_t> total{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+};
+
+// timestamps of one MQTT command on its way to a light, shared by the packets it maps to
+struct LatencyTrace
+{
+    uint64_t id = 0;
+    int64_t arrived_us = 0;                 // the MQTT client thread got it from the broker
+    int64_t dispatched_us = 0;              // the main loop consumed it
+    std::atomic<int64_t> written_us{0};     // the last of its BLE writes was acknowledged, BLE thread
+};
+
+// a packet's own stamps, written on the thread that holds the packet at the time
+struct PacketTrace
+{
+    std::shared_ptr<LatencyTrace> command;  // empty: not traced, e.g. heartbeat queries
+    int64_t queued_us = 0;                  // handed to the mesh
+    int64_t submitted_us = 0;               // BLE write submitted
+};
+
+/* Responsibilities:
+    start a trace for every MQTT command and take the timestamps along its path:
+      MQTT_DISPATCH  MQTT client thread -> main loop, the broker side can't be seen without synced clocks
+      QUEUE          handed to the mesh -> BLE write submitted (TX queue, BLE thread hop, waiting for a link)
+      BLE_WRITE      write submitted -> acknowledged by BlueZ
+      MESH           last write acknowledged -> status report of the addressed node
+      END_TO_END     MQTT arrival -> status report
+    keep one histogram per stage for the whole process
+   Group and broadcast commands are measured up to BLE_WRITE, there is no single report to wait for.
+*/
+class LatencyTracer
+{
+    public:
+
+        enum Stage
+        {
+            MQTT_DISPATCH,
+            QUEUE,
+            BLE_WRITE,
+            MESH,
+            END_TO_END,
+            STAGES
+        };
+
+        static LatencyTracer& instance()
+        {
+            static auto* tracer = new LatencyTracer();
+            return *tracer;
+        }
+
+        static const char* name(Stage stage)
+        {
+            static const char* names[STAGES] = {"mqtt_dispatch", "queue", "ble_write", "mesh", "end_to_end"};
+            return names[stage];
+        }
+
+        static int64_t now_us()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // the command being delivered on this thread, set for the duration of an MQTT callback
+        static std::shared_ptr<LatencyTrace>& active()
+        {
+            thread_local std::shared_ptr<LatencyTrace> trace;
+            return trace;
+        }
+
+        class Scope
+        {
+            public:
+                explicit Scope(const std::shared_ptr<LatencyTrace>& trace) : previous(active()) { active() = trace; }
+                ~Scope() { active() = previous; }
+                Scope(const Scope&) = delete;
+                Scope& operator=(const Scope&) = delete;
+            protected:
+                std::shared_ptr<LatencyTrace> previous;
+        };
+
+        // arrived_us 0: arrival unknown, MQTT_DISPATCH is not sampled
+        std::shared_ptr<LatencyTrace> begin(int64_t arrived_us)
+        {
+            auto trace = std::make_shared<LatencyTrace>();
+            trace->id = next_id.fetch_add(1, std::memory_order_relaxed);
+            trace->dispatched_us = now_us();
+            trace->arrived_us = arrived_us ? arrived_us : trace->dispatched_us;
+            if (arrived_us)
+            {
+                record(MQTT_DISPATCH, trace->dispatched_us - arrived_us);
+            }
+            return trace;
+        }
+
+        void queued(PacketTrace& packet)
+        {
+            if (packet.command)
+            {
+                packet.queued_us = now_us();
+            }
+        }
+
+        void submitted(PacketTrace& packet)
+        {
+            if (packet.command && packet.queued_us)
+            {
+                packet.submitted_us = now_us();
+                record(QUEUE, packet.submitted_us - packet.queued_us);
+            }
+        }
+
+        void written(PacketTrace& packet)
+        {
+            if (packet.command && packet.submitted_us)
+            {
+                auto now = now_us();
+                record(BLE_WRITE, now - packet.submitted_us);
+                packet.command->written_us.store(now, std::memory_order_release);
+            }
+        }
+
+        // false while none of the command's writes has completed, the report can't be the answer yet
+        bool confirmed(const LatencyTrace& trace)
+        {
+            auto written = trace.written_us.load(std::memory_order_acquire);
+            if (written == 0)
+            {
+                return false;
+            }
+            auto now = now_us();
+            record(MESH, now - written);
+            record(END_TO_END, now - trace.arrived_us);
+            return true;
+        }
+
+        void record(Stage stage, int64_t value_us)
+        {
+            histograms[stage].record(value_us);
+        }
+
+        const LatencyHistogram& histogram(Stage stage) const { return histograms[stage]; }
+
+        // "queue: n=12 p50=1.2ms p90=3.4ms p99=8.0ms max=9.1ms", empty if nothing was recorded
+        std::string summary(Stage stage) const
+        {
+            const auto& histogram = histograms[stage];
+            if (histogram.getCount() == 0)
+            {
+                return std::string();
+            }
+            char line[160];
+            std::snprintf(line, sizeof(line), "%s: n=%llu p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms",
+                          name(stage), static_cast<unsigned long long>(histogram.getCount()),
+                          histogram.getPercentile(0.50) / 1000.0, histogram.getPercentile(0.90) / 1000.0,
+                          histogram.getPercentile(0.99) / 1000.0, histogram.getMax() / 1000.0);
+            return line;
+        }
+
+    protected:
+
+        LatencyTracer() = default;
+
+        std::array<LatencyHistogram,STAGES> histograms;
+        std::atomic<uint64_t> next_id{1};
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <glib.h>
+
+/* Logging facade with a compile-time floor and sampled tracing.
+
+   LOG_DEBUG and LOG_INFO compile to nothing below LOG_MIN_LEVEL, their arguments
+   are type checked but never evaluated. Warnings and errors keep using g_warning
+   and friends, they are never compiled out.
+
+   LOG_SAMPLED runs a per-packet trace statement for 1 in N calls, N is set at
+   runtime (LOG_TRACE_SAMPLE, 0 = off). It is independent of LOG_MIN_LEVEL, so a
+   build without debug logging can still be traced in the field; LOG_PACKET_TRACE=0
+   compiles it out as well. Statements run under it may log with g_debug directly.
+*/
+
+#define LOG_LEVEL_MESSAGE 3
+#define LOG_LEVEL_INFO    4
+#define LOG_LEVEL_DEBUG   5
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#ifndef LOG_PACKET_TRACE
+#define LOG_PACKET_TRACE 1
+#endif
+
+#define LOG_DEBUG(...) do { if constexpr (LOG_MIN_LEVEL >= LOG_LEVEL_DEBUG) { g_debug(__VA_ARGS__); } } while (0)
+#define LOG_INFO(...)  do { if constexpr (LOG_MIN_LEVEL >= LOG_LEVEL_INFO)  { g_info(__VA_ARGS__); } } while (0)
+
+#define LOG_SAMPLED(...) do { if constexpr (LOG_PACKET_TRACE != 0) { if (LogSampler::sample()) { __VA_ARGS__; } } } while (0)
+
+/* Responsibilities:
+    decide which calls of a sampled trace statement run
+   Every thread counts on its own, so sampling costs one relaxed load and an
+   increment, and nothing while it is switched off.
+*/
+class LogSampler
+{
+    public:
+
+        // 0 switches tracing off, 1 traces every call
+        static void setEvery(uint32_t n)
+        {
+            every().store(n, std::memory_order_relaxed);
+        }
+
+        static bool sample()
+        {
+            auto n = every().load(std::memory_order_relaxed);
+            if (n == 0)
+            {
+                return false;
+            }
+            thread_local uint32_t counter = 0;
+            return counter++ % n == 0;
+        }
+
+    protected:
+
+        static std::atomic<uint32_t>& every()
+        {
+            static std::atomic<uint32_t> n{0};
+            return n;
+        }
+};
+
+#endif
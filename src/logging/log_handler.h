@@ -1,53 +1,224 @@
+#ifndef LOG_HANDLER_H
+#define LOG_HANDLER_H
+
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "log_ring.h"
+
+/* Responsibilities:
+    format log records into a preallocated ring slot on the logging thread
+    write them to stderr in batches from a background thread
+    drop (and count) records when the ring is full instead of blocking the caller
+    rate limit call sites that repeat too often
+   The writer lives for the whole process, so threads still logging during exit never see it destroyed.
+*/
+class AsyncLogWriter
+{
+    public:
+
+        static AsyncLogWriter& instance()
+        {
+            static auto* writer = new AsyncLogWriter();
+            return *writer;
+        }
+
+        GLogWriterOutput write(GLogLevelFlags log_level, const GLogField* fields, gsize n_fields)
+        {
+            const gchar *level_str = "UNKNOWN";
+            const gchar *log_domain = "APP";
+            const gchar *message = "(no message)";
+            const gchar *file = nullptr;
+            const gchar *line = nullptr;
+
+            // dispatch on the first character, most keys are never compared in full
+            for (gsize i = 0; i < n_fields; i++) {
+                const gchar* key = fields[i].key;
+                switch (key[0]) {
+                    case 'M':
+                        if (std::strcmp(key, "MESSAGE") == 0) { message = (const gchar *)fields[i].value; }
+                        break;
+                    case 'G':
+                        if (std::strcmp(key, "GLIB_DOMAIN") == 0) { log_domain = (const gchar *)fields[i].value; }
+                        break;
+                    case 'C':
+                        if (std::strcmp(key, "CODE_FILE") == 0) { file = (const gchar *)fields[i].value; }
+                        else if (std::strcmp(key, "CODE_LINE") == 0) { line = (const gchar *)fields[i].value; }
+                        break;
+                }
+            }
+
+            switch (log_level & G_LOG_LEVEL_MASK) {
+                case G_LOG_LEVEL_ERROR: level_str = "ERROR"; break;
+                case G_LOG_LEVEL_CRITICAL: level_str = "CRITICAL"; break;
+                case G_LOG_LEVEL_WARNING: level_str = "WARNING"; break;
+                case G_LOG_LEVEL_MESSAGE: level_str = "MESSAGE"; break;
+                case G_LOG_LEVEL_INFO: level_str = "INFO"; break;
+                case G_LOG_LEVEL_DEBUG: level_str = "DEBUG"; break;
+            }
+
+            const bool urgent = (log_level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL)) != 0;
+            uint32_t suppressed = 0;
+            if (!urgent && !limiter.allow(site_of(log_domain, file, line, message), g_get_monotonic_time(), suppressed)) {
+                return G_LOG_WRITER_HANDLED;
+            }
+
+            if (stopped.load(std::memory_order_acquire)) {
+                fprintf(stderr, "[%s] [%s] %s:%s: %s\n", level_str, log_domain, file ? file : "unknown", line ? line : "unknown", message);
+                return G_LOG_WRITER_HANDLED;
+            }
+
+            auto* slot = ring.claim();
+            if (!slot) {
+                // counted, reported with the next batch
+                return G_LOG_WRITER_HANDLED;
+            }
+
+            int length;
+            if (suppressed > 0) {
+                length = snprintf(slot->text, sizeof(slot->text), "[%s] [%s] %s:%s: %s (%u similar messages suppressed)\n",
+                                  level_str, log_domain, file ? file : "unknown", line ? line : "unknown", message, suppressed);
+            } else {
+                length = snprintf(slot->text, sizeof(slot->text), "[%s] [%s] %s:%s: %s\n",
+                                  level_str, log_domain, file ? file : "unknown", line ? line : "unknown", message);
+            }
+            if (length < 0) {
+                length = 0;
+            } else if (static_cast<size_t>(length) >= sizeof(slot->text)) {
+                // truncated, keep the line terminated
+                length = sizeof(slot->text) - 1;
+                slot->text[length - 1] = '\n';
+            }
+            slot->length = length;
+            ring.publish(slot);
+
+            if (urgent) {
+                // GLib may abort right after we return
+                flush();
+            }
+            return G_LOG_WRITER_HANDLED;
+        }
+
+        // messages per call site and second, 0 disables the limit
+        void setRateLimit(uint32_t per_second)
+        {
+            limiter.setLimit(per_second);
+        }
+
+        // writes everything published so far
+        void flush()
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex);
+            batch.clear();
+            ring.consume([this](const char* text, size_t length) {
+                batch.append(text, length);
+                if (batch.size() >= max_batch) {
+                    write_batch();
+                }
+            });
+
+            auto dropped = ring.take_dropped();
+            if (dropped > 0) {
+                char notice[96];
+                int length = snprintf(notice, sizeof(notice), "[WARNING] [Log] dropped %llu log messages, stderr is too slow\n",
+                                      static_cast<unsigned long long>(dropped));
+                batch.append(notice, length > 0 ? length : 0);
+            }
+            write_batch();
+        }
+
+        // drains the ring and stops the background thread, later records are written directly
+        void shutdown()
+        {
+            if (stopping.exchange(true)) {
+                return;
+            }
+            if (worker.joinable()) {
+                worker.join();
+            }
+            flush();
+            stopped.store(true, std::memory_order_release);
+        }
+
+    protected:
+
+        AsyncLogWriter() : worker([this]() { run(); })
+        {
+            std::atexit([]() { AsyncLogWriter::instance().shutdown(); });
+        }
+
+        void run()
+        {
+            while (!stopping.load(std::memory_order_relaxed)) {
+                flush();
+                std::this_thread::sleep_for(std::chrono::milliseconds(flush_interval_ms));
+            }
+        }
+
+        void write_batch()
+        {
+            if (!batch.empty()) {
+                fwrite(batch.data(), 1, batch.size(), stderr);
+                fflush(stderr);
+                batch.clear();
+            }
+        }
+
+        // call site by code location, or by message text for the non-structured API
+        static uint64_t site_of(const gchar* domain, const gchar* file, const gchar* line, const gchar* message)
+        {
+            if (file && line) {
+                auto site = reinterpret_cast<uintptr_t>(file) * 31 + reinterpret_cast<uintptr_t>(line);
+                return (site ^ (site >> 29)) * 0xbf58476d1ce4e5b9ull;
+            }
+            // FNV-1a
+            uint64_t hash = 14695981039346656037ull;
+            for (auto* text : {domain, message}) {
+                for (; *text; text++) {
+                    hash = (hash ^ static_cast<uint8_t>(*text)) * 1099511628211ull;
+                }
+            }
+            return hash;
+        }
+
+        static constexpr unsigned int flush_interval_ms = 20;
+        static constexpr size_t max_batch = 64 * 1024;
+
+        LogRing<1024,512> ring;
+        LogRateLimiter<256> limiter;
+        std::mutex flush_mutex;
+        std::string batch;
+        std::atomic<bool> stopping{false};
+        std::atomic<bool> stopped{false};
+        std::thread worker;
+};
 
-// Custom log writer function
 // Custom log writer function
 GLogWriterOutput structured_log_writer(GLogLevelFlags log_level,
                                        const GLogField *fields,
                                        gsize n_fields,
                                        gpointer user_data) {
-    const gchar *level_str = "UNKNOWN";
-    const gchar *log_domain = "APP";
-    const gchar *message = "(no message)";
-    const gchar *file = "unknown";
-    const gchar *line = "unknown";    
-    
-    for (gsize i = 0; i < n_fields; i++) {
-        if (g_strcmp0(fields[i].key, "MESSAGE") == 0) {
-            message = (const gchar *)fields[i].value;
-        } else if (g_strcmp0(fields[i].key, "GLIB_DOMAIN") == 0) {
-            log_domain = (const gchar *)fields[i].value;
-        } else if (g_strcmp0(fields[i].key, "CODE_FILE") == 0) {
-            file = (const gchar *)fields[i].value;
-        } else if (g_strcmp0(fields[i].key, "CODE_LINE") == 0) {
-            line = (const gchar *)fields[i].value;
-        }
-    }
-
-    switch (log_level & G_LOG_LEVEL_MASK) {
-        case G_LOG_LEVEL_ERROR: level_str = "ERROR"; break;
-        case G_LOG_LEVEL_CRITICAL: level_str = "CRITICAL"; break;
-        case G_LOG_LEVEL_WARNING: level_str = "WARNING"; break;
-        case G_LOG_LEVEL_MESSAGE: level_str = "MESSAGE"; break;
-        case G_LOG_LEVEL_INFO: level_str = "INFO"; break;
-        case G_LOG_LEVEL_DEBUG: level_str = "DEBUG"; break;
-    }
-
-    fprintf(stderr, "[%s] [%s] %s:%s: %s\n", level_str, log_domain, file, line, message);
-    return G_LOG_WRITER_HANDLED;
+    return AsyncLogWriter::instance().write(log_level, fields, n_fields);
 }
 
 // int main() {
 //     // Set custom log writer function
 //     g_log_set_writer_func(structured_log_writer, NULL, NULL);
-    
+
 //     g_debug("This is a debug message");
 //     g_info("This is an info message");
 //     g_message("This is a message");
 //     g_warning("This is a warning message");
 //     g_error("This is an error message");
-    
+
 //     return 0;
 // }
+
+#endif
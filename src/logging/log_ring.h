@@ -0,0 +1,185 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* Responsibilities:
+    preallocated slots that any thread formats a log line into without locking
+    hand published lines to a single consumer in order
+    count the lines dropped because the ring was full
+   Bounded multi-producer queue with a sequence number per slot: a producer
+   claims a slot by advancing the enqueue position, writes into it and
+   publishes it by bumping the slot sequence. Only one thread may consume
+   at a time.
+*/
+template<size_t Capacity, size_t TextSize>
+class LogRing
+{
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            size_t position;
+            size_t length;
+            char text[TextSize];
+        };
+
+        LogRing()
+        {
+            for (size_t i = 0; i < Capacity; i++)
+            {
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        LogRing(const LogRing&) = delete;
+        LogRing& operator=(const LogRing&) = delete;
+
+        // slot to format into, nullptr (and a counted drop) when the ring is full
+        Slot* claim()
+        {
+            size_t position = enqueue_pos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Slot& slot = slots[position & (Capacity - 1)];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (diff == 0)
+                {
+                    if (enqueue_pos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        slot.position = position;
+                        slot.length = 0;
+                        return &slot;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                else
+                {
+                    position = enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void publish(Slot* slot)
+        {
+            slot->sequence.store(slot->position + 1, std::memory_order_release);
+        }
+
+        // hands published lines to fn(text, length) in order, stops at the first unpublished slot
+        template<typename Fn>
+        size_t consume(Fn&& fn)
+        {
+            size_t count = 0;
+            for (;;)
+            {
+                Slot& slot = slots[dequeue_pos & (Capacity - 1)];
+                if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+                {
+                    return count;
+                }
+                fn(slot.text, slot.length);
+                slot.sequence.store(dequeue_pos + Capacity, std::memory_order_release);
+                dequeue_pos++;
+                count++;
+            }
+        }
+
+        // drops since the last call
+        uint64_t take_dropped()
+        {
+            return dropped.exchange(0, std::memory_order_relaxed);
+        }
+
+        static constexpr size_t capacity() { return Capacity; }
+        static constexpr size_t text_size() { return TextSize; }
+
+    protected:
+
+        std::array<Slot,Capacity> slots;
+        alignas(64) std::atomic<size_t> enqueue_pos{0};
+        alignas(64) size_t dequeue_pos = 0;
+        alignas(64) std::atomic<uint64_t> dropped{0};
+};
+
+/* Responsibilities:
+    let at most 'limit' messages per call site through within each window
+    report how many were suppressed once the next window opens
+   Call sites hash into a fixed table, a collision merely resets the entry.
+   Counters are updated without locks, so the limit is approximate when
+   several threads log from the same call site at once.
+*/
+template<size_t Sites>
+class LogRateLimiter
+{
+        static_assert((Sites & (Sites - 1)) == 0, "Sites must be a power of two");
+
+    public:
+
+        // limit 0 lets everything through
+        explicit LogRateLimiter(uint32_t limit = 20, int64_t window_us = 1000000)
+            : limit(limit), window_us(window_us) {}
+
+        void setLimit(uint32_t new_limit) { limit.store(new_limit, std::memory_order_relaxed); }
+
+        // suppressed receives the count held back during the previous window of this site
+        bool allow(uint64_t site, int64_t now_us, uint32_t& suppressed)
+        {
+            suppressed = 0;
+            auto current_limit = limit.load(std::memory_order_relaxed);
+            if (current_limit == 0)
+            {
+                return true;
+            }
+
+            auto& entry = entries[site & (Sites - 1)];
+            if (entry.site.load(std::memory_order_relaxed) != site)
+            {
+                entry.site.store(site, std::memory_order_relaxed);
+                entry.window_start.store(now_us, std::memory_order_relaxed);
+                entry.count.store(0, std::memory_order_relaxed);
+                entry.suppressed.store(0, std::memory_order_relaxed);
+            }
+
+            auto window_start = entry.window_start.load(std::memory_order_relaxed);
+            if (now_us - window_start >= window_us &&
+                entry.window_start.compare_exchange_strong(window_start, now_us, std::memory_order_relaxed))
+            {
+                entry.count.store(0, std::memory_order_relaxed);
+                suppressed = entry.suppressed.exchange(0, std::memory_order_relaxed);
+            }
+
+            if (entry.count.fetch_add(1, std::memory_order_relaxed) < current_limit)
+            {
+                return true;
+            }
+            entry.suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+    protected:
+
+        struct Entry
+        {
+            std::atomic<uint64_t> site{0};
+            std::atomic<int64_t> window_start{0};
+            std::atomic<uint32_t> count{0};
+            std::atomic<uint32_t> suppressed{0};
+        };
+
+        std::atomic<uint32_t> limit;
+        int64_t window_us;
+        std::array<Entry,Sites> entries;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef LOOP_WATCHDOG_H
+#define LOOP_WATCHDOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <execinfo.h>
+#include <pthread.h>
+
+#include "latency.h"
+#include "metrics.h"
+
+/* Responsibilities:
+    take a heartbeat from a high priority timer on the event loop and record how late each one fires
+    watch the heartbeats from a thread of its own, so a loop that is stuck is noticed while it is stuck
+    sample the loop thread's stack once per stall that exceeds the threshold, that names the blocking callback
+    report the sample right away and the stall's total length once the loop is back
+   The loop thread is the one calling heartbeat(). The sample is taken by signalling it, the handler only
+   calls backtrace() into a preallocated buffer, symbols are resolved on the watchdog thread. Function names
+   need the executable linked with -rdynamic, otherwise the frames are addresses.
+   One watchdog per process, it owns the sampling signal while it exists.
+*/
+class LoopWatchdog
+{
+    public:
+
+        struct Stall
+        {
+            int64_t blocked_us = 0;             // so far when sampled, in total once recovered
+            bool recovered = false;
+            std::vector<std::string> frames;    // innermost first, empty once recovered
+        };
+
+        // called on the watchdog thread for a sample, on the loop thread for the recovery
+        using Reporter = std::function<void(const Stall&)>;
+
+        static constexpr int max_frames = 48;
+
+        // the loop's timer must fire every interval_us, a heartbeat later than threshold_us is a stall
+        LoopWatchdog(int64_t threshold_us, int64_t interval_us, Reporter reporter)
+            : threshold_us(threshold_us), interval_us(interval_us), reporter(reporter)
+        {
+            // backtrace() loads libgcc on its first call, that must not happen inside the handler
+            void* frames[1];
+            backtrace(frames, 1);
+
+            struct sigaction action{};
+            action.sa_handler = &LoopWatchdog::on_sample_signal;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            active() = this;
+            sigaction(sample_signal(), &action, &previous_action);
+
+            thread = std::thread(&LoopWatchdog::run, this);
+        }
+
+        ~LoopWatchdog()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wakeup.notify_all();
+            thread.join();
+            sigaction(sample_signal(), &previous_action, nullptr);
+            active() = nullptr;
+        }
+
+        LoopWatchdog(const LoopWatchdog&) = delete;
+        LoopWatchdog& operator=(const LoopWatchdog&) = delete;
+
+        // loop thread, from the timer callback
+        void heartbeat(int64_t now = LatencyTracer::now_us())
+        {
+            auto previous = last_beat.exchange(now, std::memory_order_acq_rel);
+            if (previous == 0)
+            {
+                loop_thread = pthread_self();
+                loop_thread_known.store(true, std::memory_order_release);
+                return;
+            }
+            lag.record(now - previous - interval_us);
+
+            if (stalled_beat.load(std::memory_order_acquire) == previous)
+            {
+                stalled_beat.store(0, std::memory_order_relaxed);
+                reporter(Stall{now - previous, true, {}});
+            }
+        }
+
+        // how late the heartbeats fired, in microseconds
+        const LatencyHistogram& histogram() const { return lag; }
+
+        // "n=1200 p50=0.1ms p90=0.3ms p99=12.0ms max=850.0ms", empty before the second heartbeat
+        std::string summary() const
+        {
+            if (lag.getCount() == 0)
+            {
+                return std::string();
+            }
+            char line[128];
+            std::snprintf(line, sizeof(line), "n=%llu p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms",
+                          static_cast<unsigned long long>(lag.getCount()),
+                          lag.getPercentile(0.50) / 1000.0, lag.getPercentile(0.90) / 1000.0,
+                          lag.getPercentile(0.99) / 1000.0, lag.getMax() / 1000.0);
+            return line;
+        }
+
+        static int sample_signal() { return SIGRTMIN + 1; }
+
+    protected:
+
+        // watchdog thread, checks a few times per threshold
+        void run()
+        {
+            const auto check = std::chrono::microseconds(std::max<int64_t>(threshold_us / 4, 1000));
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wakeup.wait_for(lock, check, [this]() { return stopping; }))
+            {
+                auto beat = last_beat.load(std::memory_order_acquire);
+                if (beat == 0 || beat == sampled_beat)
+                {
+                    continue;
+                }
+                auto blocked = LatencyTracer::now_us() - beat;
+                if (blocked - interval_us < threshold_us)
+                {
+                    continue;
+                }
+
+                // one sample per stall, it started with the last heartbeat
+                sampled_beat = beat;
+                lock.unlock();
+                auto frames = sample();
+                stalls.inc();
+                stalled_beat.store(beat, std::memory_order_release);
+                reporter(Stall{blocked, false, frames});
+                lock.lock();
+            }
+        }
+
+        std::vector<std::string> sample()
+        {
+            if (!loop_thread_known.load(std::memory_order_acquire))
+            {
+                return {};
+            }
+            sampled_frames.store(-1, std::memory_order_relaxed);
+            if (pthread_kill(loop_thread, sample_signal()) != 0)
+            {
+                return {};
+            }
+
+            // the handler runs as soon as the kernel schedules the loop thread, even inside a blocking call
+            int count = -1;
+            for (int i = 0; i < 100 && (count = sampled_frames.load(std::memory_order_acquire)) < 0; i++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (count <= 0)
+            {
+                return {};
+            }
+
+            std::vector<std::string> frames;
+            char** symbols = backtrace_symbols(sample_buffer, count);
+            // skip the handler and the signal trampoline
+            for (int i = 2; i < count; i++)
+            {
+                frames.push_back(symbols ? symbols[i] : "?");
+            }
+            std::free(symbols);
+            return frames;
+        }
+
+        static LoopWatchdog*& active()
+        {
+            static LoopWatchdog* watchdog = nullptr;
+            return watchdog;
+        }
+
+        // loop thread, async-signal-safe: backtrace() into a preallocated buffer and an atomic store
+        static void on_sample_signal(int)
+        {
+            auto* watchdog = active();
+            if (watchdog)
+            {
+                int count = backtrace(watchdog->sample_buffer, max_frames);
+                watchdog->sampled_frames.store(count, std::memory_order_release);
+            }
+        }
+
+        const int64_t threshold_us;
+        const int64_t interval_us;
+        Reporter reporter;
+        LatencyHistogram lag;
+        Metrics::Counter stalls = Metrics::instance().counter("meshgateway_main_loop_stalls_total",
+                                                              "Main loop heartbeats later than the watchdog threshold");
+
+        std::atomic<int64_t> last_beat{0};
+        std::atomic<int64_t> stalled_beat{0};   // the heartbeat a reported stall started with
+        int64_t sampled_beat = 0;               // watchdog thread only
+        pthread_t loop_thread{};
+        std::atomic<bool> loop_thread_known{false};
+
+        void* sample_buffer[max_frames];
+        std::atomic<int> sampled_frames{-1};
+        struct sigaction previous_action{};
+
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        bool stopping = false;
+        std::thread thread;
+};
+
+#endif
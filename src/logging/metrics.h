@@ -0,0 +1,315 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "latency.h"
+
+/* Responsibilities:
+    hand out counters whose hot path is a plain increment of a slot owned by the calling thread
+    keep gauges and latency histograms under their Prometheus names
+    sum the per-thread slots and render everything in the Prometheus text format at scrape time
+   Registration takes a lock and is meant for static handles at the call site, counting never does.
+   A thread's slots outlive it, so its counts stay in the totals.
+*/
+class Metrics
+{
+    public:
+
+        static constexpr size_t max_counters = 2048;
+
+        // a counter, or a family of them told apart by one label (e.g. the mesh command byte)
+        class Counter
+        {
+            public:
+
+                Counter() = default;
+
+                void inc(size_t label = 0, uint64_t n = 1) const
+                {
+                    if (label >= width)
+                    {
+                        return;
+                    }
+                    // only this thread writes its slot, no read-modify-write needed
+                    auto& slot = shard().values[base + label];
+                    slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+                }
+
+            protected:
+
+                friend class Metrics;
+                Counter(size_t base, size_t width) : base(base), width(width) {}
+
+                size_t base = 0;
+                size_t width = 0;
+        };
+
+        using Gauge = std::atomic<int64_t>;
+        using LabelFormat = std::function<std::string(size_t)>;
+
+        // records the microseconds until it goes out of scope, also when an exception leaves it, and counts itself in flight meanwhile
+        class Timer
+        {
+            public:
+
+                explicit Timer(LatencyHistogram& histogram, Gauge* in_flight = nullptr)
+                    : histogram(histogram), in_flight(in_flight), start(LatencyTracer::now_us())
+                {
+                    if (in_flight)
+                    {
+                        (*in_flight)++;
+                    }
+                }
+
+                ~Timer()
+                {
+                    histogram.record(LatencyTracer::now_us() - start);
+                    if (in_flight)
+                    {
+                        (*in_flight)--;
+                    }
+                }
+
+                Timer(const Timer&) = delete;
+                Timer& operator=(const Timer&) = delete;
+
+            protected:
+
+                LatencyHistogram& histogram;
+                Gauge* in_flight;
+                int64_t start;
+        };
+
+        static Metrics& instance()
+        {
+            static auto* metrics = new Metrics();
+            return *metrics;
+        }
+
+        // width > 1: one counter per label value 0..width-1, only those that counted are rendered
+        Counter counter(const std::string& name, const std::string& help,
+                        const std::string& label = "", size_t width = 1, LabelFormat format = nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& family : counters)
+            {
+                if (family.name == name)
+                {
+                    return Counter(family.base, family.width);
+                }
+            }
+            if (next_counter + width > max_counters)
+            {
+                throw std::length_error("Too many counters for " + name);
+            }
+            if (!format)
+            {
+                format = [](size_t value) { return std::to_string(value); };
+            }
+            counters.push_back(CounterFamily{name, help, label, format, next_counter, width});
+            next_counter += width;
+            return Counter(counters.back().base, width);
+        }
+
+        Gauge& gauge(const std::string& name, const std::string& help)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& entry = gauges[name];
+            if (!entry.value)
+            {
+                entry.help = help;
+                entry.value = std::make_unique<Gauge>(0);
+            }
+            return *entry.value;
+        }
+
+        // owned histogram, the same name and label value give the same one. unit_seconds is what one recorded unit is worth
+        LatencyHistogram& histogram(const std::string& name, const std::string& help,
+                                    const std::string& label = "", const std::string& value = "", double unit_seconds = 1e-6)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& family = histograms[name];
+            auto key = label_pair(label, value);
+            for (auto& entry : family.entries)
+            {
+                if (entry.labels == key)
+                {
+                    return *entry.owned;
+                }
+            }
+            family.help = help;
+            family.entries.push_back(HistogramEntry{key, unit_seconds, std::make_unique<LatencyHistogram>(), nullptr});
+            family.entries.back().histogram = family.entries.back().owned.get();
+            return *family.entries.back().owned;
+        }
+
+        // a histogram kept elsewhere, it must live as long as the process
+        void addHistogram(const std::string& name, const std::string& help,
+                          const std::string& label, const std::string& value,
+                          const LatencyHistogram& histogram, double unit_seconds = 1e-6)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& family = histograms[name];
+            family.help = help;
+            family.entries.push_back(HistogramEntry{label_pair(label, value), unit_seconds, nullptr, &histogram});
+        }
+
+        // Prometheus text exposition format 0.0.4
+        std::string render()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::string out;
+            out.reserve(16 * 1024);
+
+            for (const auto& family : counters)
+            {
+                header(out, family.name, family.help, "counter");
+                for (size_t i = 0; i < family.width; i++)
+                {
+                    uint64_t total = 0;
+                    for (const auto& shard : shards)
+                    {
+                        total += shard->values[family.base + i].load(std::memory_order_relaxed);
+                    }
+                    if (family.width == 1)
+                    {
+                        sample(out, family.name, "", static_cast<double>(total));
+                    }
+                    else if (total > 0)
+                    {
+                        sample(out, family.name, label_pair(family.label, family.format(i)), static_cast<double>(total));
+                    }
+                }
+            }
+
+            for (const auto& [name, entry] : gauges)
+            {
+                header(out, name, entry.help, "gauge");
+                sample(out, name, "", static_cast<double>(entry.value->load(std::memory_order_relaxed)));
+            }
+
+            for (const auto& [name, family] : histograms)
+            {
+                header(out, name, family.help, "histogram");
+                for (const auto& entry : family.entries)
+                {
+                    render_histogram(out, name, entry);
+                }
+            }
+            return out;
+        }
+
+    protected:
+
+        struct Shard
+        {
+            std::array<std::atomic<uint64_t>,max_counters> values{};
+        };
+
+        struct CounterFamily
+        {
+            std::string name;
+            std::string help;
+            std::string label;
+            LabelFormat format;
+            size_t base;
+            size_t width;
+        };
+
+        struct GaugeEntry
+        {
+            std::string help;
+            std::unique_ptr<Gauge> value;
+        };
+
+        struct HistogramEntry
+        {
+            std::string labels;                         // rendered, e.g. method="WriteValue"
+            double unit_seconds;
+            std::unique_ptr<LatencyHistogram> owned;
+            const LatencyHistogram* histogram;
+        };
+
+        struct HistogramFamily
+        {
+            std::string help;
+            std::vector<HistogramEntry> entries;
+        };
+
+        Metrics() = default;
+
+        static Shard& shard()
+        {
+            thread_local Shard* shard = instance().add_shard();
+            return *shard;
+        }
+
+        Shard* add_shard()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shards.push_back(std::make_unique<Shard>());
+            return shards.back().get();
+        }
+
+        static std::string label_pair(const std::string& label, const std::string& value)
+        {
+            return label.empty() ? std::string() : label + "=\"" + value + "\"";
+        }
+
+        static void header(std::string& out, const std::string& name, const std::string& help, const char* type)
+        {
+            out += "# HELP " + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+        }
+
+        static void sample(std::string& out, const std::string& name, const std::string& labels, double value)
+        {
+            char number[32];
+            std::snprintf(number, sizeof(number), "%.9g", value);
+            out += name;
+            if (!labels.empty())
+            {
+                out += "{" + labels + "}";
+            }
+            out += " ";
+            out += number;
+            out += "\n";
+        }
+
+        // bucket bounds are rounded down to the histogram's own bucket edges, within its 3% precision
+        static void render_histogram(std::string& out, const std::string& name, const HistogramEntry& entry)
+        {
+            static constexpr double bounds[] = {1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+                                                1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+            const std::string separator = entry.labels.empty() ? "" : ",";
+            for (double bound : bounds)
+            {
+                char le[32];
+                std::snprintf(le, sizeof(le), "le=\"%g\"", bound);
+                auto count = entry.histogram->countUpTo(static_cast<uint64_t>(bound / entry.unit_seconds + 1e-9));
+                sample(out, name + "_bucket", entry.labels + separator + le, static_cast<double>(count));
+            }
+            const auto count = entry.histogram->getCount();
+            sample(out, name + "_bucket", entry.labels + separator + "le=\"+Inf\"", static_cast<double>(count));
+            sample(out, name + "_sum", entry.labels, entry.histogram->getSum() * entry.unit_seconds);
+            sample(out, name + "_count", entry.labels, static_cast<double>(count));
+        }
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Shard>> shards;
+        std::vector<CounterFamily> counters;
+        size_t next_counter = 0;
+        std::map<std::string,GaugeEntry> gauges;
+        std::map<std::string,HistogramFamily> histograms;
+};
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+/* Responsibilities:
+    listen on a local TCP port or a Unix socket for Prometheus scrapes
+    answer GET /metrics with the rendered metrics from a thread of its own, off the main loop
+   One scrape at a time, each connection is closed after its response.
+   listen is "unix:<path>", "<host>:<port>" or just "<port>", which binds to 127.0.0.1.
+*/
+class MetricsServer
+{
+    public:
+
+        // throws std::runtime_error if the socket can't be bound
+        explicit MetricsServer(const std::string& listen, Metrics& metrics = Metrics::instance())
+            : metrics(metrics)
+        {
+            if (listen.compare(0, 5, "unix:") == 0)
+            {
+                bind_unix(listen.substr(5));
+            }
+            else
+            {
+                auto colon = listen.rfind(':');
+                bind_tcp(colon == std::string::npos ? "127.0.0.1" : listen.substr(0, colon),
+                         std::stoi(colon == std::string::npos ? listen : listen.substr(colon + 1)));
+            }
+            if (::listen(fd, 4) < 0 || pipe(wakeup) < 0)
+            {
+                auto error = std::string(strerror(errno));
+                close(fd);
+                throw std::runtime_error("Could not listen for metrics scrapes: " + error);
+            }
+            thread = std::thread(&MetricsServer::run, this);
+        }
+
+        ~MetricsServer()
+        {
+            stopping.store(true);
+            char byte = 0;
+            if (write(wakeup[1], &byte, 1) < 0)
+            {
+                // the thread still sees stopping at its next scrape
+            }
+            thread.join();
+            close(wakeup[0]);
+            close(wakeup[1]);
+            close(fd);
+            if (!unix_path.empty())
+            {
+                unlink(unix_path.c_str());
+            }
+        }
+
+        MetricsServer(const MetricsServer&) = delete;
+        MetricsServer& operator=(const MetricsServer&) = delete;
+
+    protected:
+
+        void bind_tcp(const std::string& host, int port)
+        {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+            {
+                throw std::runtime_error("Invalid metrics listen address " + host);
+            }
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            bind_or_throw(reinterpret_cast<sockaddr*>(&address), sizeof(address), host + ":" + std::to_string(port));
+        }
+
+        void bind_unix(const std::string& path)
+        {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (path.empty() || path.size() >= sizeof(address.sun_path))
+            {
+                throw std::runtime_error("Invalid metrics socket path " + path);
+            }
+            std::memcpy(address.sun_path, path.c_str(), path.size());
+            // a socket left behind by a previous run
+            unlink(path.c_str());
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            bind_or_throw(reinterpret_cast<sockaddr*>(&address), sizeof(address), path);
+            unix_path = path;
+        }
+
+        void bind_or_throw(const sockaddr* address, socklen_t length, const std::string& name)
+        {
+            if (fd < 0 || bind(fd, address, length) < 0)
+            {
+                auto error = std::string(strerror(errno));
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                throw std::runtime_error("Could not bind metrics endpoint " + name + ": " + error);
+            }
+        }
+
+        void run()
+        {
+            while (!stopping.load())
+            {
+                pollfd fds[2] = {{fd, POLLIN, 0}, {wakeup[0], POLLIN, 0}};
+                if (poll(fds, 2, -1) < 0)
+                {
+                    continue;
+                }
+                if (fds[1].revents)
+                {
+                    break;
+                }
+                int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client >= 0)
+                {
+                    serve(client);
+                    close(client);
+                }
+            }
+        }
+
+        void serve(int client)
+        {
+            // a scraper that stalls must not keep the next one waiting
+            timeval timeout{2, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            std::string request;
+            char buffer[1024];
+            while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+            {
+                auto n = read(client, buffer, sizeof(buffer));
+                if (n <= 0)
+                {
+                    return;
+                }
+                request.append(buffer, n);
+            }
+
+            std::string status = "200 OK";
+            std::string body;
+            if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0)
+            {
+                body = metrics.render();
+            }
+            else
+            {
+                status = "404 Not Found";
+                body = "Not found, try /metrics\n";
+            }
+            send_all(client, "HTTP/1.0 " + status + "\r\n"
+                             "Content-Type: text/plain; version=0.0.4\r\n"
+                             "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                             "Connection: close\r\n\r\n" + body);
+        }
+
+        static void send_all(int client, const std::string& data)
+        {
+            size_t sent = 0;
+            while (sent < data.size())
+            {
+                auto n = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                {
+                    return;
+                }
+                sent += n;
+            }
+        }
+
+        Metrics& metrics;
+        int fd = -1;
+        int wakeup[2] = {-1, -1};
+        std::string unix_path;
+        std::atomic<bool> stopping{false};
+        std::thread thread;
+};
+
+#endif
@@ -1,16 +1,163 @@
 #define G_LOG_USE_STRUCTURED 1
 #include "ble_stack/telink_mesh.h"
+#include "ble_stack/ble_thread.h"
 #include "mqtt/mqtt_client_proxy.h"
 #include "gateway/gateway.h"
+#include "gateway/session_replay.h"
 #include "logging/log_handler.h"
+#include "logging/log.h"
+#include "logging/metrics_server.h"
+#include "logging/loop_watchdog.h"
+#include <sstream>
 
 int main() {
     g_log_set_writer_func(structured_log_writer, NULL, NULL);
+    const char* log_rate_limit = std::getenv("LOG_RATE_LIMIT"); // messages per call site and second, 0 = unlimited
+    if (log_rate_limit) {
+        AsyncLogWriter::instance().setRateLimit(std::stoul(log_rate_limit));
+    }
+    const char* log_trace_sample = std::getenv("LOG_TRACE_SAMPLE"); // trace 1 in N packets, 0 = off
+    if (log_trace_sample) {
+        LogSampler::setEvery(std::stoul(log_trace_sample));
+    }
     const char* mesh_name = std::getenv("MESH_NAME");
     const char* mesh_password = std::getenv("MESH_PASSWORD");
     const char* mesh_connected_name = std::getenv("MESH_CONNECTED_NAME");
     const char* mqtt_broker_url = std::getenv("MQTT_BROKER_URL");
     const char* mqtt_client_id = std::getenv("MQTT_CLIENT_ID");
+    const char* availability_timeout = std::getenv("NODE_AVAILABILITY_TIMEOUT"); // seconds
+    const char* command_hold_ttl = std::getenv("COMMAND_HOLD_TTL"); // seconds a command for an unavailable node is held, 0 = send anyway
+    const char* mesh_connections = std::getenv("MESH_CONNECTIONS"); // pooled proxy connections
+    const char* mesh_state_file = std::getenv("MESH_STATE_FILE"); // known good proxies
+    const char* mesh_rssi_threshold = std::getenv("MESH_RSSI_THRESHOLD"); // dBm, connect without waiting
+    const char* bluez_adapters = std::getenv("BLUEZ_ADAPTERS"); // e.g. "hci0,hci1", default all
+    const char* bluez_dbus_address = std::getenv("BLUEZ_DBUS_ADDRESS"); // "session" or a D-Bus address, default the system bus
+    const char* meshes = std::getenv("MESHES"); // "<id>:<name>:<password>,...", one process for several meshes
+    const char* ble_thread_env = std::getenv("BLE_THREAD"); // "0" keeps BlueZ on the main loop
+    const char* mesh_capture_file = std::getenv("MESH_CAPTURE_FILE"); // pcapng of all mesh packets, off by default
+    const char* mesh_capture_max_mb = std::getenv("MESH_CAPTURE_MAX_MB"); // rotate to <file>.1 beyond this size
+    const char* session_record_file = std::getenv("SESSION_RECORD_FILE"); // record MQTT input and mesh notifications
+    const char* session_replay_file = std::getenv("SESSION_REPLAY_FILE"); // replay a recording instead of using BlueZ
+    const char* session_replay_speed = std::getenv("SESSION_REPLAY_SPEED"); // 1 = recorded timing, 0 = as fast as possible
+    const char* session_replay_retain = std::getenv("SESSION_REPLAY_RETAIN"); // "1" keeps the recorded retained flags, default off
+    const char* latency_report_interval = std::getenv("LATENCY_REPORT_INTERVAL"); // seconds between per-stage command latency summaries, 0 = off
+    const char* metrics_listen = std::getenv("METRICS_LISTEN"); // Prometheus endpoint, "<port>", "<host>:<port>" or "unix:<path>", off by default
+    const char* loop_watchdog_ms = std::getenv("LOOP_WATCHDOG_MS"); // main loop stall threshold for a stack sample, 0 = off
+    const char* mqtt_spool_file = std::getenv("MQTT_SPOOL_FILE"); // outbound messages while the broker is away, empty = off
+    const char* mqtt_spool_kb = std::getenv("MQTT_SPOOL_KB"); // spool size, the latest message per topic is kept
+    const char* mqtt_spool_drain_rate = std::getenv("MQTT_SPOOL_DRAIN_RATE"); // spooled messages per second after a reconnect
+    const bool use_ble_thread = !(ble_thread_env && std::string(ble_thread_env) == "0");
+
+    std::vector<std::string> adapters;
+    if (bluez_adapters) {
+        std::istringstream list(bluez_adapters);
+        std::string adapter;
+        while (std::getline(list, adapter, ',')) {
+            if (!adapter.empty()) {
+                adapters.push_back(adapter);
+            }
+        }
+    }
+
+    struct MeshConfig
+    {
+        std::string id;   // empty: the single mesh keeps the plain homeassistant/light namespace
+        std::string name;
+        std::string password;
+    };
+    std::vector<MeshConfig> mesh_configs;
+    if (meshes) {
+        std::istringstream list(meshes);
+        std::string entry;
+        while (std::getline(list, entry, ',')) {
+            auto first = entry.find(':');
+            auto second = entry.find(':', first == std::string::npos ? first : first + 1);
+            if (first == std::string::npos || second == std::string::npos) {
+                g_warning("Ignoring malformed MESHES entry '%s'",entry.c_str());
+                continue;
+            }
+            mesh_configs.push_back({entry.substr(0,first), entry.substr(first+1,second-first-1), entry.substr(second+1)});
+        }
+    } else {
+        mesh_configs.push_back({"", mesh_name, mesh_password});
+    }
+
+    // one recording for the whole process, it continues across restarts of the loop below
+    std::unique_ptr<SessionLog::Writer> recorder;
+    if (session_record_file && !session_replay_file) {
+        recorder = std::make_unique<SessionLog::Writer>(session_record_file);
+        Glib::signal_timeout().connect_seconds([&recorder]() { recorder->flush(); return true; }, 1);
+        g_message("Recording session to %s",session_record_file);
+    }
+
+    // one capture for the whole process, a restart must not truncate the packets that led up to it
+    std::unique_ptr<PacketCapture> capture;
+    if (mesh_capture_file && !session_replay_file) {
+        try {
+            const uint64_t max_mb = mesh_capture_max_mb ? std::stoull(mesh_capture_max_mb) : 100;
+            capture = std::make_unique<PacketCapture>(mesh_capture_file, max_mb * 1024 * 1024);
+            g_message("Capturing mesh packets to %s",mesh_capture_file);
+        } catch (const std::exception& e) {
+            g_warning("Packet capture disabled: %s",e.what());
+        }
+    }
+
+    // a high priority heartbeat on the main loop, a thread of its own notices when it stops
+    const unsigned int watchdog_threshold_ms = loop_watchdog_ms ? std::stoul(loop_watchdog_ms) : 500;
+    const unsigned int heartbeat_ms = 100;
+    std::unique_ptr<LoopWatchdog> watchdog;
+    if (watchdog_threshold_ms > 0) {
+        watchdog = std::make_unique<LoopWatchdog>(watchdog_threshold_ms * 1000ll, heartbeat_ms * 1000ll, [](const LoopWatchdog::Stall& stall) {
+            if (stall.recovered) {
+                g_warning("Main loop was blocked for %.1f ms",stall.blocked_us / 1000.0);
+                return;
+            }
+            std::string frames;
+            for (const auto& frame : stall.frames) {
+                frames += "\n    " + frame;
+            }
+            g_warning("Main loop blocked for %.1f ms, in:%s",stall.blocked_us / 1000.0,frames.c_str());
+        });
+        Glib::signal_timeout().connect([&watchdog]() { watchdog->heartbeat(); return true; }, heartbeat_ms, Glib::PRIORITY_HIGH);
+    }
+
+    // cumulative since start, so a summary reads like the process' whole history
+    const unsigned int latency_interval = latency_report_interval ? std::stoul(latency_report_interval) : 300;
+    if (latency_interval > 0) {
+        Glib::signal_timeout().connect_seconds([&watchdog]() {
+            for (int stage = 0; stage < LatencyTracer::STAGES; stage++) {
+                auto line = LatencyTracer::instance().summary(static_cast<LatencyTracer::Stage>(stage));
+                if (!line.empty()) {
+                    g_message("Command latency %s",line.c_str());
+                }
+            }
+            if (watchdog && !watchdog->summary().empty()) {
+                g_message("Main loop lag %s",watchdog->summary().c_str());
+            }
+            return true;
+        }, latency_interval);
+    }
+
+    // serves scrapes for the whole process, across restarts of the loop below
+    std::unique_ptr<MetricsServer> metrics_server;
+    if (metrics_listen) {
+        for (int stage = 0; stage < LatencyTracer::STAGES; stage++) {
+            Metrics::instance().addHistogram("meshgateway_command_latency_seconds", "MQTT command latency per stage",
+                                             "stage", LatencyTracer::name(static_cast<LatencyTracer::Stage>(stage)),
+                                             LatencyTracer::instance().histogram(static_cast<LatencyTracer::Stage>(stage)));
+        }
+        if (watchdog) {
+            Metrics::instance().addHistogram("meshgateway_main_loop_lag_seconds", "Main loop heartbeat lateness",
+                                             "", "", watchdog->histogram());
+        }
+
+        try {
+            metrics_server = std::make_unique<MetricsServer>(metrics_listen);
+            g_message("Serving metrics on %s",metrics_listen);
+        } catch (const std::exception& e) {
+            g_warning("Metrics endpoint disabled: %s",e.what());
+        }
+    }
 
     while(true)
     {
@@ -20,27 +167,114 @@ int main() {
             // Create and run the main event loop to handle signals
             auto mainLoop = Glib::MainLoop::create();
 
-            BlueZProxy btproxy;
+            if (session_replay_file) {
+                // no BlueZ at all, stand-in meshes and the real broker
+                auto mqtt_client = std::make_shared<MQTTClientProxy>(mqtt_broker_url, mqtt_client_id);
+                std::vector<std::shared_ptr<ReplayMesh>> replay_meshes;
+                std::vector<std::unique_ptr<Gateway>> gateways;
+                for (const auto& config : mesh_configs) {
+                    replay_meshes.push_back(std::make_shared<ReplayMesh>());
+                    gateways.push_back(std::make_unique<Gateway>(
+                                    replay_meshes.back(),
+                                    mqtt_client,
+                                    availability_timeout ? std::stoul(availability_timeout)*1000 : 120000,
+                                    config.id.empty() ? MeshNamespace() : MeshNamespace::forMesh(config.id),
+                                    command_hold_ttl ? std::stoul(command_hold_ttl)*1000 : 300000));
+                }
+
+                SessionReplayer replayer(session_replay_file, replay_meshes, mqtt_broker_url,
+                                         std::string(mqtt_client_id) + "_replay",
+                                         session_replay_speed ? std::stod(session_replay_speed) : 1.0,
+                                         [&mainLoop]() { mainLoop->quit(); },
+                                         session_replay_retain && std::string(session_replay_retain) == "1");
+                replayer.start();
+                mainLoop->run();
+                return 0;
+            }
+
+            // BlueZ either gets a thread of its own or shares the main loop
+            std::unique_ptr<BleThread> ble_thread;
+            std::unique_ptr<BlueZProxy> btproxy;
+            if (use_ble_thread) {
+                ble_thread = std::make_unique<BleThread>(adapters, bluez_dbus_address ? bluez_dbus_address : "");
+            } else {
+                btproxy = std::make_unique<BlueZProxy>(adapters, bluez_dbus_address ? bluez_dbus_address : "");
+            }
+            auto with_ble = [&](std::function<void(BlueZProxy&)> fn) {
+                if (ble_thread) {
+                    ble_thread->invoke(fn);
+                } else {
+                    fn(*btproxy);
+                }
+            };
 
-            btproxy.disconnect_by_name(mesh_connected_name);
-            btproxy.disconnect_by_name(mesh_name);
+            with_ble([&](BlueZProxy& ble) {
+                if (mesh_connected_name) {
+                    ble.disconnect_by_name(mesh_connected_name);
+                }
+                for (const auto& config : mesh_configs) {
+                    ble.disconnect_by_name(config.name);
+                }
+            });
 
-            auto mesh = std::make_shared<TelinkMesh>(
-                            btproxy,
-                            mesh_name,
-                            mesh_password,
-                            0x0211
-                            );
-            
+            // all meshes share the D-Bus connection and the MQTT client
             auto mqtt_client = std::make_shared<MQTTClientProxy>(mqtt_broker_url, mqtt_client_id);
+            mqtt_client->setRecorder(recorder.get());
+            const std::string spool_file = mqtt_spool_file ? mqtt_spool_file : "mqtt_spool.bin";
+            if (!spool_file.empty()) {
+                try {
+                    const size_t spool_kb = mqtt_spool_kb ? std::stoul(mqtt_spool_kb) : 1024;
+                    mqtt_client->setSpool(std::make_unique<MqttSpool>(spool_file, spool_kb * 1024),
+                                          mqtt_spool_drain_rate ? std::stoul(mqtt_spool_drain_rate) : 50);
+                } catch (const std::exception& e) {
+                    g_warning("MQTT spool disabled: %s",e.what());
+                }
+            }
+            std::vector<std::unique_ptr<Gateway>> gateways;
+
+            for (const auto& config : mesh_configs)
+            {
+                std::string state_file = mesh_state_file ? mesh_state_file : "mesh_proxies.json";
+                if (!config.id.empty()) {
+                    // one state file per mesh, mesh_proxies.json -> mesh_proxies_<id>.json
+                    auto dot = state_file.rfind('.');
+                    state_file.insert(dot == std::string::npos ? state_file.size() : dot, "_" + config.id);
+                }
+
+                const size_t pool_size = mesh_connections ? std::stoul(mesh_connections) : 1;
+                const int16_t rssi_threshold = mesh_rssi_threshold ? std::stoi(mesh_rssi_threshold) : -70;
+
+                std::shared_ptr<MeshLink> mesh;
+                if (ble_thread) {
+                    mesh = std::make_shared<ThreadedMesh>(*ble_thread, config.name, config.password, 0x0211,
+                                                          pool_size, state_file, rssi_threshold, capture.get());
+                } else {
+                    mesh = std::make_shared<TelinkMesh>(*btproxy, config.name, config.password, 0x0211,
+                                                        pool_size, state_file, rssi_threshold, capture.get());
+                }
+                if (recorder) {
+                    mesh = std::make_shared<RecordingMesh>(mesh, *recorder, gateways.size());
+                }
 
-            Gateway gateway(mesh,mqtt_client);
+                gateways.push_back(std::make_unique<Gateway>(
+                                mesh,
+                                mqtt_client,
+                                availability_timeout ? std::stoul(availability_timeout)*1000 : 120000,
+                                config.id.empty() ? MeshNamespace() : MeshNamespace::forMesh(config.id),
+                                command_hold_ttl ? std::stoul(command_hold_ttl)*1000 : 300000));
+                g_message("Serving mesh %s%s",config.name.c_str(),config.id.empty() ? "" : (" as " + config.id).c_str());
+            }
 
             mainLoop->run();  // Start the loop that processes the incoming signals 
             /* code */
         }
         catch(const std::exception& e)
         {
+            if (session_replay_file) {
+                // a replay that failed once fails the same way again
+                g_warning("Replay failed: %s",e.what());
+                return 1;
+            }
             g_warning("Unhandled exception: %s \n\n Attempting to restart...",e.what());
         } catch (const Glib::Error& e) {
             g_warning("Unhandled exception: %s",e.what().c_str());   
@@ -2,8 +2,20 @@
 #define MQTT_CLIENT_PROXY_H
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
 #include <glibmm/main.h>
 #include <mqtt/client.h>
+#include "../logging/log.h"
+#include "../gateway/session_log.h"
+#include "../logging/latency.h"
+#include "../logging/metrics.h"
+#include "../ble_stack/spsc_queue.h"
+#include "mqtt_spool.h"
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "MQTT Client"
@@ -63,23 +75,79 @@ public:
 
     void setCallback(sigc::slot<bool,mqtt::const_message_ptr> callback)
     {
-        sigMessageRx.connect(callback);
+        setCallback("",callback);
+    }
+
+    // messages are routed to the callback with the longest matching topic prefix
+    void setCallback(const std::string& topic_prefix, sigc::slot<bool,mqtt::const_message_ptr> callback)
+    {
+        routes.push_back(Route{topic_prefix + (topic_prefix.empty() ? "" : "/"), callback});
+    }
+
+    // replay what a paused route missed, until it asks to pause again
+    void resume(const std::string& topic_prefix)
+    {
+        auto route = find_route(topic_prefix + "/");
+        if (!route || !route->paused)
+        {
+            return;
+        }
+
+        route->paused = false;
+        while (!route->backlog.empty() && !route->paused)
+        {
+            auto pending = route->backlog.front();
+            route->backlog.pop_front();
+            deliver(*route,pending.msg,pending.trace);
+        }
+    }
+
+    // every consumed message goes to the session file as well, before it is routed
+    void setRecorder(SessionLog::Writer* recorder)
+    {
+        this->recorder = recorder;
+    }
+
+    // MQTT client thread, paho calls message_arrived before it queues the message for consumption
+    void arrived(const mqtt::message* msg)
+    {
+        arrivals.push(Arrival{msg, LatencyTracer::now_us()});
     }
 
     bool dispatch(sigc::slot_base* callback) override {
         try{
-            g_debug("Dequeueing MQTT message");
+            LOG_DEBUG("Dequeueing MQTT message");
             // get message from the queue
             mqtt::const_message_ptr msg;
             pending_event = mqttclient.try_consume_message(&msg);
 
             if (pending_event)
             {
-                if (!sigMessageRx.emit(msg))
+                if (recorder)
+                {
+                    recorder->mqtt(msg->get_topic(), msg->get_payload_str(), msg->get_qos(), msg->is_retained());
+                }
+
+                auto trace = LatencyTracer::instance().begin(arrival_of(msg.get()));
+                auto route = find_route(msg->get_topic());
+                if (!route)
+                {
+                    LOG_DEBUG("No handler for topic %s",msg->get_topic().c_str());
+                }
+                else if (route->paused)
+                {
+                    // another mesh may still be able to take messages, park this one
+                    if (route->backlog.size() >= max_backlog)
+                    {
+                        g_warning("MQTT backlog for %s full, dropping oldest message",route->prefix.c_str());
+                        route->backlog.pop_front();
+                    }
+                    route->backlog.push_back(Pending{msg,trace});
+                }
+                else
                 {
-                    g_warning("Could not handle consumed MQTT message, stopping MQTT consumption...");
-                    mqttclient.stop_consuming();
-                };
+                    deliver(*route,msg,trace);
+                }
             }
         }
         catch(const std::exception& e)
@@ -90,7 +158,86 @@ public:
         return true;
     }
 
-    sigc::signal<bool,mqtt::const_message_ptr> sigMessageRx;
+protected:
+
+    struct Pending
+    {
+        mqtt::const_message_ptr msg;
+        std::shared_ptr<LatencyTrace> trace;
+    };
+
+    struct Route
+    {
+        std::string prefix;
+        sigc::slot<bool,mqtt::const_message_ptr> callback;
+        bool paused = false;
+        std::deque<Pending> backlog;
+    };
+
+    struct Arrival
+    {
+        const mqtt::message* msg = nullptr;   // identity only, never dereferenced
+        int64_t time_us = 0;
+    };
+
+    // arrival time of a consumed message, 0 if it was not seen arriving
+    int64_t arrival_of(const mqtt::message* msg)
+    {
+        for (size_t i = 0; const Arrival* arrival = arrivals.peek(i); i++)
+        {
+            if (arrival->msg == msg)
+            {
+                const int64_t time_us = arrival->time_us;
+                // entries ahead of it belong to messages consumed without a trace
+                Arrival skipped;
+                for (size_t j = 0; j <= i; j++)
+                {
+                    arrivals.pop(skipped);
+                }
+                return time_us;
+            }
+        }
+        // its arrival did not fit the full queue, the queued entries belong to newer messages
+        return 0;
+    }
+
+    Route* find_route(const std::string& topic)
+    {
+        Route* best = nullptr;
+        for (auto& route : routes)
+        {
+            if (topic.compare(0, route.prefix.size(), route.prefix) == 0
+                && (!best || route.prefix.size() > best->prefix.size()))
+            {
+                best = &route;
+            }
+        }
+        return best;
+    }
+
+    void deliver(Route& route, mqtt::const_message_ptr msg, const std::shared_ptr<LatencyTrace>& trace)
+    {
+        // the packets the callback maps the message to pick the trace up
+        LatencyTracer::Scope scope(trace);
+        if (!route.callback(msg))
+        {
+            if (route.prefix.empty())
+            {
+                g_warning("Could not handle consumed MQTT message, stopping MQTT consumption...");
+                mqttclient.stop_consuming();
+            }
+            else
+            {
+                g_warning("Could not handle consumed MQTT message, pausing %s...",route.prefix.c_str());
+                route.paused = true;
+            }
+        }
+    }
+
+    static constexpr size_t max_backlog = 256;
+    std::vector<Route> routes;
+    SessionLog::Writer* recorder = nullptr;
+    SpscQueue<Arrival,256> arrivals;   // MQTT client thread -> main loop
         
 };
 
@@ -100,16 +247,39 @@ public:
     MQTTCallback(MQTTMessageSource& rxSource)
         : rxSource(rxSource) {}
 
+    // MQTT client thread, the client must not be called from here
+    void setConnectedCallback(std::function<void()> callback)
+    {
+        on_connected = callback;
+    }
+
+    // whether outbound messages are kept while the broker is away, for the warning on a lost connection
+    void setSpooling(bool spooling)
+    {
+        this->spooling = spooling;
+    }
+
     void connected(const std::string& cause) override {
         
         //source->trigger_event();  // Trigger the event directly in the custom source
         g_message("Connected with MQTT broker. Cause: %s",cause.c_str());
+        if (on_connected)
+        {
+            on_connected();
+        }
     }
 
     void connection_lost(const std::string& cause) override {
         
       //  source->trigger_event();  // Trigger the event directly in the custom source
-      g_warning("Lost connection with MQTT broker. Cause: %s",cause.c_str());
+      if (spooling)
+      {
+          g_warning("Lost connection with MQTT broker, spooling outbound messages until it is back. Cause: %s",cause.c_str());
+      }
+      else
+      {
+          g_warning("Lost connection with MQTT broker, dropping outbound messages until it is back. Cause: %s",cause.c_str());
+      }
     }
 
     void message_arrived(mqtt::const_message_ptr msg) override {
@@ -117,14 +287,11 @@ public:
         {
             /* code */
                 
-            // Extract the payload and topic from the message
-            std::string payload = msg->get_payload_str();  // Get the payload as a string
-            std::string topic = msg->get_topic();
-
-            // Use g_debug to output the topic and payload of the message
-            g_debug("Received MQTT message with topic: %s", topic.c_str());
-            g_debug("Message payload: %s", payload.c_str());
+            // borrow topic and payload from the message, only when this one is traced
+            LOG_SAMPLED(g_debug("Received MQTT message with topic: %s", msg->get_topic().c_str());
+                        g_debug("Message payload: %s", msg->get_payload_str().c_str()));
             
+            rxSource.arrived(msg.get());
             rxSource.trigger_event();  // Trigger the event directly in the custom source
         }
         catch(const std::exception& e)
@@ -140,6 +307,8 @@ public:
 
 private:
     MQTTMessageSource& rxSource;  // Pointer to the custom MQTT source
+    std::function<void()> on_connected;
+    std::atomic<bool> spooling{false};  // set on the main loop, read on the MQTT client thread
 };
 
 
@@ -161,21 +330,42 @@ public:
 
 
 
-class MQTTClientProxy {
+class MQTTClientProxy : public sigc::trackable {
 public:
     MQTTClientProxy(const std::string& server_uri, const std::string& client_id)
-        : client(server_uri, client_id), rxSource(client), callback(rxSource)
+        : client(server_uri, client_id), rxSource(client), callback(rxSource), context(Glib::MainContext::get_default())
     {
 
         client.set_callback(callback);
+        // paho reconnects by itself, subscriptions and the spool are handled back on the main loop
+        callback.setConnectedCallback([this]() {
+            context->signal_idle().connect_once(sigc::mem_fun(*this, &MQTTClientProxy::on_connected));
+        });
+    }
+
+    // outbound messages that can't be published are kept in a spool file, sent at drain_rate per second once the broker is back
+    void setSpool(std::unique_ptr<MqttSpool> spool, unsigned int drain_rate)
+    {
+        this->spool = std::move(spool);
+        this->drain_rate = std::max(drain_rate, 1u);
+        callback.setSpooling(true);
+        if (!this->spool->empty())
+        {
+            g_message("%zu MQTT messages spooled by an earlier run",this->spool->size());
+        }
     }
 
     void connect() {
+        if (client.is_connected()) {
+            // shared by several gateways, the first one connects
+            return;
+        }
         mqtt::connect_options conn_opts;
         conn_opts.set_clean_session(true);
+        conn_opts.set_automatic_reconnect(1, 30);
         try {
             client.connect(conn_opts);
-            g_info("Connected to broker.");
+            LOG_INFO("Connected to broker.");
         } catch (const mqtt::exception& e) {
             g_warning("Unexpected exception: %s",e.what());            
         }
@@ -186,7 +376,22 @@ public:
         rxSource.setCallback(callback);
     }
 
+    // for a client shared by several meshes, each one handles its own topic prefix
+    void setCallback(const std::string& topic_prefix, sigc::slot<bool,mqtt::const_message_ptr> callback)
+    {
+        rxSource.setCallback(topic_prefix,callback);
+    }
+
+    void setRecorder(SessionLog::Writer* recorder)
+    {
+        rxSource.setRecorder(recorder);
+    }
+
     void subscribe(std::string topicfilter) {
+        // remembered for reconnects, a clean session starts without subscriptions
+        if (std::find(subscriptions.begin(), subscriptions.end(), topicfilter) == subscriptions.end()) {
+            subscriptions.push_back(topicfilter);
+        }
         client.subscribe(topicfilter, 1);        
     }
 
@@ -195,22 +400,109 @@ public:
         client.start_consuming();
     }
 
-    void publish(mqtt::const_message_ptr 	msg)
+    // resume a topic prefix that paused itself by returning false from its callback
+    void start_consuming(const std::string& topic_prefix)
     {
-        // Extract the payload and topic from the message
-        std::string payload = msg->get_payload_str();  // Get the payload as a string
-        std::string topic = msg->get_topic();
+        rxSource.resume(topic_prefix);
+    }
 
-        // Use g_debug to output the topic and payload of the message
-        g_debug("Publishing MQTT message to topic: %s", topic.c_str());
-        g_debug("Message payload: %s", payload.c_str());
-        client.publish(msg);
+    void publish(mqtt::const_message_ptr 	msg)
+    {
+        // borrow topic and payload from the message, only when this one is traced
+        LOG_SAMPLED(g_debug("Publishing MQTT message to topic: %s", msg->get_topic().c_str());
+                    g_debug("Message payload: %s", msg->get_payload_str().c_str()));
+        // the synchronous client blocks until the broker acknowledges, QoS 0 until the message is written
+        static auto& in_flight = Metrics::instance().gauge("meshgateway_mqtt_publish_in_flight", "MQTT publishes waiting for the broker");
+        static auto& latency = Metrics::instance().histogram("meshgateway_mqtt_publish_seconds", "MQTT publish latency");
+        if (spool && (!spool->empty() || !client.is_connected())) {
+            // behind what is spooled already, a drained older state must not overwrite this one
+            spool_message(msg);
+            return;
+        }
+        try {
+            Metrics::Timer timer(latency, &in_flight);
+            client.publish(msg);
+        } catch (const mqtt::exception& e) {
+            if (!spool) {
+                throw;
+            }
+            g_warning("Could not publish to %s, spooling: %s",msg->get_topic().c_str(),e.what());
+            spool_message(msg);
+        }
     }
 
 private:
+
+    void spool_message(mqtt::const_message_ptr msg)
+    {
+        if (!spool->push(MqttSpool::Message{msg->get_topic(), msg->get_payload_str(), static_cast<uint8_t>(msg->get_qos()), msg->is_retained()})) {
+            g_warning("MQTT message to %s too large for the spool, dropping it",msg->get_topic().c_str());
+        }
+        spooled = spool->size();
+        if (client.is_connected()) {
+            start_draining();
+        }
+    }
+
+    // main loop, after paho connected or reconnected
+    void on_connected()
+    {
+        for (const auto& topicfilter : subscriptions) {
+            try {
+                client.subscribe(topicfilter, 1);
+            } catch (const mqtt::exception& e) {
+                g_warning("Could not subscribe to %s again: %s",topicfilter.c_str(),e.what());
+            }
+        }
+        if (spool && !spool->empty()) {
+            g_message("Draining %zu spooled MQTT messages",spool->size());
+            start_draining();
+        }
+    }
+
+    void start_draining()
+    {
+        if (!drainTimer.connected()) {
+            drainTimer = context->signal_timeout().connect(sigc::mem_fun(*this, &MQTTClientProxy::drain), drain_tick_ms);
+        }
+    }
+
+    // a slice of drain_rate per tick, stops when the spool is empty or the broker is gone again
+    bool drain()
+    {
+        const unsigned int slice = std::max(drain_rate * drain_tick_ms / 1000, 1u);
+        MqttSpool::Message message;
+        for (unsigned int i = 0; i < slice && spool->front(message); i++) {
+            if (!client.is_connected()) {
+                return false;
+            }
+            try {
+                client.publish(mqtt::make_message(message.topic, message.payload, message.qos, message.retained));
+            } catch (const mqtt::exception& e) {
+                g_warning("Draining the MQTT spool failed, retrying once reconnected: %s",e.what());
+                return false;
+            }
+            spool->pop();
+        }
+        spooled = spool->size();
+        if (spool->empty()) {
+            g_message("MQTT spool drained");
+            return false;
+        }
+        return true;
+    }
+
+    static constexpr unsigned int drain_tick_ms = 100;
+
     mqtt::client client;
     MQTTMessageSource rxSource;
     MQTTCallback callback;
+    Glib::RefPtr<Glib::MainContext> context;
+    std::vector<std::string> subscriptions;
+    std::unique_ptr<MqttSpool> spool;
+    unsigned int drain_rate = 50;
+    sigc::connection drainTimer;
+    Metrics::Gauge& spooled = Metrics::instance().gauge("meshgateway_mqtt_spooled", "Outbound MQTT messages waiting in the spool");
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,387 @@
+#ifndef MQTT_SPOOL_H
+#define MQTT_SPOOL_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Spool files: outbound MQTT messages kept while the broker is unreachable.
+
+   Layout: a 64 byte header (magic "MQS1", capacity, head, tail, used bytes), then a ring of records
+     u32  record size, 8 byte aligned, 0 marks a wrap to the start of the ring
+     u8   live, cleared when a newer message for the same topic replaces it
+     u8   flags (bits 0-1 QoS, bit 2 retained)
+     u16  topic length
+     u32  payload length
+     topic, payload, padding
+   The header is updated after the record it covers, a crash leaves the last push out at worst.
+   Writes go to the page cache, they survive a crash of the process but not of the machine.
+*/
+
+/* Responsibilities:
+    keep one message per topic, the latest, in the order of their last update
+    reclaim the space of replaced messages when the ring runs full, drop the oldest when it still is
+    reopen a spool left by an earlier run, a file that does not fit the capacity starts empty
+   Not thread safe, the spool belongs to the main loop.
+*/
+class MqttSpool
+{
+    public:
+
+        struct Message
+        {
+            std::string topic;
+            std::string payload;
+            uint8_t qos = 0;
+            bool retained = false;
+        };
+
+        // throws std::runtime_error if the file can't be created or mapped
+        MqttSpool(const std::string& path, size_t capacity)
+            : capacity(align(capacity))
+        {
+            fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0)
+            {
+                throw std::runtime_error("Could not open MQTT spool " + path);
+            }
+            struct stat st{};
+            fstat(fd, &st);
+            const bool fresh = static_cast<size_t>(st.st_size) != header_size + this->capacity;
+            if (fresh && ftruncate(fd, header_size + this->capacity) < 0)
+            {
+                close(fd);
+                throw std::runtime_error("Could not size MQTT spool " + path);
+            }
+            void* mapping = mmap(nullptr, header_size + this->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                close(fd);
+                throw std::runtime_error("Could not map MQTT spool " + path);
+            }
+            header = static_cast<Header*>(mapping);
+            ring = static_cast<uint8_t*>(mapping) + header_size;
+
+            if (fresh || !recover())
+            {
+                reset();
+            }
+        }
+
+        ~MqttSpool()
+        {
+            munmap(header, header_size + capacity);
+            close(fd);
+        }
+
+        MqttSpool(const MqttSpool&) = delete;
+        MqttSpool& operator=(const MqttSpool&) = delete;
+
+        // replaces the spooled message with the same topic, false if the message is too large to spool at all
+        bool push(const Message& message)
+        {
+            const uint64_t size = record_size(message);
+            if (size > capacity / 2 || message.topic.size() > UINT16_MAX)
+            {
+                return false;
+            }
+
+            auto it = index.find(message.topic);
+            if (it != index.end())
+            {
+                kill(it->second);
+                index.erase(it);
+            }
+
+            uint64_t offset;
+            while (!reserve(size, offset))
+            {
+                make_room();
+            }
+
+            RecordHeader record{static_cast<uint32_t>(size), 1,
+                                static_cast<uint8_t>((message.qos & 0x03) | (message.retained ? 0x04 : 0)),
+                                static_cast<uint16_t>(message.topic.size()), static_cast<uint32_t>(message.payload.size())};
+            std::memcpy(ring + offset, &record, sizeof(record));
+            std::memcpy(ring + offset + sizeof(record), message.topic.data(), message.topic.size());
+            std::memcpy(ring + offset + sizeof(record) + message.topic.size(), message.payload.data(), message.payload.size());
+
+            header->tail = (offset + size) % capacity;
+            header->used += size;
+            index[message.topic] = offset;
+            return true;
+        }
+
+        // the oldest message, false if the spool is empty
+        bool front(Message& message)
+        {
+            skip_dead();
+            if (index.empty())
+            {
+                return false;
+            }
+            const auto* record = record_at(header->head);
+            const char* data = reinterpret_cast<const char*>(ring + header->head + sizeof(RecordHeader));
+            message.topic.assign(data, record->topic_length);
+            message.payload.assign(data + record->topic_length, record->payload_length);
+            message.qos = record->flags & 0x03;
+            message.retained = (record->flags & 0x04) != 0;
+            return true;
+        }
+
+        // removes the message front() returned
+        void pop()
+        {
+            skip_dead();
+            if (index.empty())
+            {
+                return;
+            }
+            const auto* record = record_at(header->head);
+            index.erase(std::string(reinterpret_cast<const char*>(ring + header->head + sizeof(RecordHeader)), record->topic_length));
+            release_head();
+        }
+
+        size_t size() const { return index.size(); }
+        bool empty() const { return index.empty(); }
+        uint64_t getDropped() const { return dropped; }
+
+        static constexpr size_t header_size = 64;
+
+    protected:
+
+        struct Header
+        {
+            char magic[4];
+            uint32_t reserved;
+            uint64_t capacity;
+            uint64_t head;      // oldest record
+            uint64_t tail;      // where the next record goes
+            uint64_t used;      // bytes between head and tail, wrap gaps included
+        };
+
+        struct RecordHeader
+        {
+            uint32_t size;
+            uint8_t live;
+            uint8_t flags;
+            uint16_t topic_length;
+            uint32_t payload_length;
+        };
+
+        static_assert(sizeof(Header) <= header_size, "spool header too large");
+
+        static constexpr char magic[4] = {'M','Q','S','1'};
+
+        static uint64_t align(uint64_t value) { return (value + 7) & ~uint64_t(7); }
+
+        static uint64_t record_size(const Message& message)
+        {
+            return align(sizeof(RecordHeader) + message.topic.size() + message.payload.size());
+        }
+
+        RecordHeader* record_at(uint64_t offset) { return reinterpret_cast<RecordHeader*>(ring + offset); }
+
+        void reset()
+        {
+            std::memset(header, 0, header_size);
+            std::memcpy(header->magic, magic, sizeof(magic));
+            header->capacity = capacity;
+            index.clear();
+            dead_bytes = 0;
+        }
+
+        // rebuilds the topic index, false if the ring does not hold up
+        bool recover()
+        {
+            if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->capacity != capacity
+                || header->head >= capacity || header->tail >= capacity || header->used > capacity)
+            {
+                return false;
+            }
+            uint64_t offset = header->head;
+            uint64_t remaining = header->used;
+            while (remaining > 0)
+            {
+                uint64_t gap = wrap_gap(offset);
+                if (gap)
+                {
+                    if (gap > remaining)
+                    {
+                        return false;
+                    }
+                    remaining -= gap;
+                    offset = 0;
+                    continue;
+                }
+                const auto* record = record_at(offset);
+                if (record->size < sizeof(RecordHeader) || record->size > remaining || offset + record->size > capacity
+                    || sizeof(RecordHeader) + record->topic_length + record->payload_length > record->size)
+                {
+                    return false;
+                }
+                if (!record->live)
+                {
+                    dead_bytes += record->size;
+                }
+                else
+                {
+                    std::string topic(reinterpret_cast<const char*>(ring + offset + sizeof(RecordHeader)), record->topic_length);
+                    auto it = index.find(topic);
+                    if (it != index.end())
+                    {
+                        kill(it->second);
+                    }
+                    index[topic] = offset;
+                }
+                remaining -= record->size;
+                offset = (offset + record->size) % capacity;
+            }
+            return offset == header->tail;
+        }
+
+        // bytes skipped to the start of the ring at this offset, 0 if a record starts here
+        uint64_t wrap_gap(uint64_t offset)
+        {
+            if (capacity - offset < sizeof(RecordHeader) || record_at(offset)->size == 0)
+            {
+                return capacity - offset;
+            }
+            return 0;
+        }
+
+        void kill(uint64_t offset)
+        {
+            record_at(offset)->live = 0;
+            dead_bytes += record_at(offset)->size;
+        }
+
+        // a contiguous stretch of size bytes at the tail, wrapping to the start if that is where the space is
+        bool reserve(uint64_t size, uint64_t& offset)
+        {
+            const uint64_t tail = header->tail;
+            const uint64_t free = capacity - header->used;
+            if (free < size)
+            {
+                return false;
+            }
+            if (header->used == 0)
+            {
+                header->head = header->tail = 0;
+                offset = 0;
+                return true;
+            }
+            if (tail >= header->head)
+            {
+                if (capacity - tail >= size)
+                {
+                    offset = tail;
+                    return true;
+                }
+                // the rest of the ring is a gap, the record goes to the start
+                if (header->head >= size)
+                {
+                    if (capacity - tail >= sizeof(RecordHeader))
+                    {
+                        record_at(tail)->size = 0;
+                    }
+                    header->used += capacity - tail;
+                    header->tail = 0;
+                    offset = 0;
+                    return true;
+                }
+                return false;
+            }
+            offset = tail;
+            return true;
+        }
+
+        // reclaims replaced messages if that is worth it, drops the oldest message otherwise
+        void make_room()
+        {
+            const uint64_t used = header->used;
+            skip_dead();
+            if (header->used < used)
+            {
+                // replaced messages at the head were enough
+                return;
+            }
+            if (dead_bytes > 0)
+            {
+                compact();
+                return;
+            }
+            if (!index.empty())
+            {
+                pop();
+                dropped++;
+            }
+        }
+
+        // rewrites the live messages from the start of the ring, in their order
+        void compact()
+        {
+            std::vector<Message> live;
+            live.reserve(index.size());
+            Message message;
+            while (front(message))
+            {
+                live.push_back(message);
+                pop();
+            }
+            header->head = header->tail = header->used = 0;
+            dead_bytes = 0;
+            for (const auto& entry : live)
+            {
+                push(entry);
+            }
+        }
+
+        void skip_dead()
+        {
+            while (header->used > 0)
+            {
+                uint64_t gap = wrap_gap(header->head);
+                if (gap)
+                {
+                    header->used -= gap;
+                    header->head = 0;
+                    continue;
+                }
+                if (record_at(header->head)->live)
+                {
+                    return;
+                }
+                dead_bytes -= record_at(header->head)->size;
+                release_head();
+            }
+        }
+
+        void release_head()
+        {
+            const uint64_t size = record_at(header->head)->size;
+            header->used -= size;
+            header->head = (header->head + size) % capacity;
+            if (header->used == 0)
+            {
+                header->head = header->tail = 0;
+            }
+        }
+
+        const uint64_t capacity;
+        int fd = -1;
+        Header* header = nullptr;
+        uint8_t* ring = nullptr;
+        std::unordered_map<std::string,uint64_t> index;   // live record offset by topic
+        uint64_t dead_bytes = 0;                          // replaced records still in the ring
+        uint64_t dropped = 0;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+#include "adapter_table.h"
+
+// A removed adapter leaves the table, objects below it or of another adapter do not remove it
+TEST(AdapterTableTest, RemovedAdapterLeaves) {
+    AdapterTable<int> adapters;
+    adapters.add("/org/bluez/hci0", 1);
+    adapters.add("/org/bluez/hci1", 2);
+    ASSERT_EQ(adapters.size(), 2u);
+
+    EXPECT_FALSE(adapters.remove("/org/bluez/hci1/dev_A4_C1_38_00_00_01"));
+    EXPECT_FALSE(adapters.remove("/org/bluez/hci2"));
+    EXPECT_EQ(adapters.size(), 2u);
+
+    EXPECT_TRUE(adapters.remove("/org/bluez/hci1"));
+    EXPECT_EQ(adapters.find("hci1"), adapters.end());
+    ASSERT_EQ(adapters.size(), 1u);
+    EXPECT_EQ(adapters.begin()->second.Path, "/org/bluez/hci0");
+
+    // plugged in again
+    adapters.add("/org/bluez/hci1", 3);
+    ASSERT_NE(adapters.find("hci1"), adapters.end());
+    EXPECT_EQ(adapters.find("hci1")->second.Proxy, 3);
+}
+
+// Only adapters on the allow list are usable, an empty list allows all
+TEST(AdapterTableTest, AllowList) {
+    AdapterTable<int> all;
+    EXPECT_TRUE(all.allows("hci3"));
+
+    AdapterTable<int> some({"hci0", "hci2"});
+    EXPECT_TRUE(some.allows("hci2"));
+    EXPECT_FALSE(some.allows("hci1"));
+    EXPECT_EQ(AdapterTable<int>::name_of("/org/bluez/hci2"), "hci2");
+}
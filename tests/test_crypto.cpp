@@ -109,6 +109,12 @@ TEST(CryptoTest, DecryptPacket) {
     //EXPECT_EQ(decrypted_packet, packet);
     EXPECT_EQ(decrypted_packet2, expected);
 
+    // In place decryption matches
+    auto in_place = packet;
+    EXPECT_TRUE(decrypt_packet_in_place(sk, address, in_place.data(), in_place.size()));
+    EXPECT_EQ(in_place, expected);
+    EXPECT_FALSE(decrypt_packet_in_place(sk, address, in_place.data(), 24));
+
     // Invalid input cases
     //EXPECT_THROW(decrypt_packet(std::vector<uint8_t>{}, address, encrypted_packet), std::invalid_argument);
     //EXPECT_THROW(decrypt_packet(sk, std::vector<uint8_t>{}, encrypted_packet), std::invalid_argument);
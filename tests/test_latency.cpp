@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "latency.h"
+
+// Every value lands in a bucket that holds it, no bucket is wider than 1/32 of its values
+TEST(LatencyHistogramTest, BucketPrecision) {
+    for (uint64_t value : {0ull, 1ull, 63ull, 64ull, 65ull, 1000ull, 123456ull, 1ull << 37})
+    {
+        auto index = LatencyHistogram::index_of(value);
+        EXPECT_LE(LatencyHistogram::lowest_in(index), value);
+        EXPECT_GE(LatencyHistogram::highest_in(index), value);
+        auto width = LatencyHistogram::highest_in(index) - LatencyHistogram::lowest_in(index) + 1;
+        EXPECT_LE(width * 32, value < 64 ? 32 : value);
+    }
+    // buckets tile the range without gaps
+    for (size_t i = 0; i + 1 < LatencyHistogram::buckets; i++)
+    {
+        EXPECT_EQ(LatencyHistogram::highest_in(i) + 1, LatencyHistogram::lowest_in(i + 1));
+    }
+    EXPECT_EQ(LatencyHistogram::index_of(UINT64_MAX), LatencyHistogram::buckets - 1);
+}
+
+// Percentiles come out within the bucket precision, never above the largest value
+TEST(LatencyHistogramTest, Percentiles) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.getPercentile(0.5), 0u);
+    for (int64_t value = 1; value <= 1000; value++)
+    {
+        histogram.record(value * 1000);
+    }
+    EXPECT_EQ(histogram.getCount(), 1000u);
+    EXPECT_EQ(histogram.getMax(), 1000000u);
+    EXPECT_NEAR(histogram.getMean(), 500500.0, 0.1);
+    EXPECT_NEAR(static_cast<double>(histogram.getPercentile(0.50)), 500000.0, 500000.0 / 32);
+    EXPECT_NEAR(static_cast<double>(histogram.getPercentile(0.99)), 990000.0, 990000.0 / 32);
+    EXPECT_EQ(histogram.getPercentile(1.0), 1000000u);
+    EXPECT_EQ(histogram.countUpTo(63), 0u);
+    EXPECT_EQ(histogram.countUpTo(UINT64_MAX), 1000u);
+
+    // clock steps backwards count as zero
+    histogram.record(-5);
+    EXPECT_EQ(histogram.getPercentile(0.0), 0u);
+}
+
+// Threads record without losing counts
+TEST(LatencyHistogramTest, ConcurrentRecord) {
+    LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&histogram, t]() {
+            for (int i = 0; i < 10000; i++)
+            {
+                histogram.record(t * 100 + i % 100);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(histogram.getCount(), 40000u);
+    EXPECT_EQ(histogram.getMax(), 399u);
+}
+
+// A command passes every stage once, a report before the write completes is not its answer
+TEST(LatencyTracerTest, Stages) {
+    auto& tracer = LatencyTracer::instance();
+    uint64_t before[LatencyTracer::STAGES];
+    for (int stage = 0; stage < LatencyTracer::STAGES; stage++)
+    {
+        before[stage] = tracer.histogram(static_cast<LatencyTracer::Stage>(stage)).getCount();
+    }
+    auto count = [&](LatencyTracer::Stage stage) { return tracer.histogram(stage).getCount() - before[stage]; };
+
+    auto trace = tracer.begin(LatencyTracer::now_us() - 2000);
+    EXPECT_EQ(count(LatencyTracer::MQTT_DISPATCH), 1u);
+    {
+        LatencyTracer::Scope scope(trace);
+        EXPECT_EQ(LatencyTracer::active(), trace);
+    }
+    EXPECT_FALSE(LatencyTracer::active());
+
+    PacketTrace packet{trace};
+    tracer.queued(packet);
+    tracer.submitted(packet);
+    EXPECT_EQ(count(LatencyTracer::QUEUE), 1u);
+    EXPECT_FALSE(tracer.confirmed(*trace));
+
+    tracer.written(packet);
+    EXPECT_EQ(count(LatencyTracer::BLE_WRITE), 1u);
+    EXPECT_TRUE(tracer.confirmed(*trace));
+    EXPECT_EQ(count(LatencyTracer::MESH), 1u);
+    EXPECT_EQ(count(LatencyTracer::END_TO_END), 1u);
+    EXPECT_GE(tracer.histogram(LatencyTracer::END_TO_END).getMax(), 2000u);
+    EXPECT_NE(tracer.summary(LatencyTracer::END_TO_END).find("end_to_end: n="), std::string::npos);
+
+    // untraced packets, e.g. heartbeat queries, record nothing
+    PacketTrace untraced;
+    tracer.queued(untraced);
+    tracer.submitted(untraced);
+    tracer.written(untraced);
+    EXPECT_EQ(count(LatencyTracer::QUEUE), 1u);
+    EXPECT_EQ(count(LatencyTracer::BLE_WRITE), 1u);
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "log_ring.h"
+
+// Lines come out in order, a full ring drops and counts
+TEST(LogRingTest, OrderAndDrops) {
+    LogRing<4,32> ring;
+    for (int i = 0; i < 6; i++)
+    {
+        auto* slot = ring.claim();
+        if (slot)
+        {
+            slot->length = snprintf(slot->text, sizeof(slot->text), "%d", i);
+            ring.publish(slot);
+        }
+    }
+    EXPECT_EQ(ring.take_dropped(), 2u);
+    EXPECT_EQ(ring.take_dropped(), 0u);
+
+    std::string out;
+    EXPECT_EQ(ring.consume([&out](const char* text, size_t length) { out.append(text, length); }), 4u);
+    EXPECT_EQ(out, "0123");
+    EXPECT_NE(ring.claim(), nullptr);
+}
+
+// A claimed but unpublished slot holds back the lines after it
+TEST(LogRingTest, WaitsForUnpublishedSlot) {
+    LogRing<4,32> ring;
+    auto* first = ring.claim();
+    auto* second = ring.claim();
+    second->length = snprintf(second->text, sizeof(second->text), "b");
+    ring.publish(second);
+
+    std::string out;
+    auto append = [&out](const char* text, size_t length) { out.append(text, length); };
+    EXPECT_EQ(ring.consume(append), 0u);
+    first->length = snprintf(first->text, sizeof(first->text), "a");
+    ring.publish(first);
+    EXPECT_EQ(ring.consume(append), 2u);
+    EXPECT_EQ(out, "ab");
+}
+
+// Several producers, every line arrives once or is counted as dropped
+TEST(LogRingTest, ConcurrentProducers) {
+    LogRing<256,16> ring;
+    const int producers = 4;
+    const int per_producer = 20000;
+    std::vector<std::thread> threads;
+    std::vector<int> seen(producers, 0);
+    std::atomic<int> running{producers};
+    uint64_t dropped = 0;
+
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&ring,&running,p,per_producer]() {
+            for (int i = 0; i < per_producer; i++)
+            {
+                auto* slot = ring.claim();
+                if (slot)
+                {
+                    slot->length = snprintf(slot->text, sizeof(slot->text), "%d %d", p, i);
+                    ring.publish(slot);
+                }
+            }
+            running--;
+        });
+    }
+
+    std::vector<int> last(producers, -1);
+    auto check = [&](const char* text, size_t length) {
+        int p = 0;
+        int i = 0;
+        ASSERT_EQ(sscanf(std::string(text, length).c_str(), "%d %d", &p, &i), 2);
+        EXPECT_GT(i, last[p]); // per producer order is kept
+        last[p] = i;
+        seen[p]++;
+    };
+    while (running > 0)
+    {
+        ring.consume(check);
+    }
+    ring.consume(check);
+    dropped = ring.take_dropped();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    uint64_t total = dropped;
+    for (auto count : seen)
+    {
+        total += count;
+    }
+    EXPECT_EQ(total, static_cast<uint64_t>(producers * per_producer));
+}
+
+// Repeats beyond the limit are held back and reported when the window reopens
+TEST(LogRateLimiterTest, LimitsPerSite) {
+    LogRateLimiter<16> limiter(3, 1000);
+    uint32_t suppressed = 0;
+    int allowed = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        allowed += limiter.allow(42, 0, suppressed) ? 1 : 0;
+        EXPECT_EQ(suppressed, 0u);
+    }
+    EXPECT_EQ(allowed, 3);
+
+    // another site is not affected
+    EXPECT_TRUE(limiter.allow(43, 0, suppressed));
+
+    EXPECT_TRUE(limiter.allow(42, 1000, suppressed));
+    EXPECT_EQ(suppressed, 7u);
+    EXPECT_TRUE(limiter.allow(42, 1001, suppressed));
+    EXPECT_EQ(suppressed, 0u);
+}
+
+// A limit of 0 lets everything through
+TEST(LogRateLimiterTest, Disabled) {
+    LogRateLimiter<16> limiter(0);
+    uint32_t suppressed = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        EXPECT_TRUE(limiter.allow(1, 0, suppressed));
+    }
+}
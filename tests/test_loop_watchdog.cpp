@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "loop_watchdog.h"
+
+// A callback blocking the loop is sampled while it blocks and reported again once the loop is back
+TEST(LoopWatchdogTest, ReportsStall) {
+    std::mutex mutex;
+    std::vector<LoopWatchdog::Stall> stalls;
+    LoopWatchdog watchdog(50000, 10000, [&](const LoopWatchdog::Stall& stall) {
+        std::lock_guard<std::mutex> lock(mutex);
+        stalls.push_back(stall);
+    });
+
+    // stands in for the event loop: a 10 ms timer, then one callback blocking for 300 ms
+    std::thread loop([&watchdog]() {
+        for (int i = 0; i < 10; i++)
+        {
+            watchdog.heartbeat();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        watchdog.heartbeat();
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        watchdog.heartbeat();
+    });
+    loop.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(stalls.size(), 2u);
+    EXPECT_FALSE(stalls[0].recovered);
+    EXPECT_GE(stalls[0].blocked_us, 60000);
+    EXPECT_FALSE(stalls[0].frames.empty());
+    EXPECT_TRUE(stalls[1].recovered);
+    EXPECT_GE(stalls[1].blocked_us, 300000);
+
+    EXPECT_EQ(watchdog.histogram().getCount(), 11u);
+    EXPECT_GE(watchdog.histogram().getMax(), 290000u);
+    EXPECT_NE(watchdog.summary().find("n=11 "), std::string::npos);
+}
+
+// Heartbeats on time report nothing
+TEST(LoopWatchdogTest, QuietLoop) {
+    int reports = 0;
+    LoopWatchdog watchdog(200000, 10000, [&reports](const LoopWatchdog::Stall&) { reports++; });
+    for (int i = 0; i < 20; i++)
+    {
+        watchdog.heartbeat();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(reports, 0);
+    EXPECT_LT(watchdog.histogram().getPercentile(0.5), 100000u);
+}
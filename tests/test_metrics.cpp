@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+#include "metrics_server.h"
+
+// Per-thread counts add up at scrape time, also for threads that already exited
+TEST(MetricsTest, CountersAcrossThreads) {
+    auto& metrics = Metrics::instance();
+    auto counter = metrics.counter("test_threads_total", "Increments from several threads");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([counter]() {
+            for (int i = 0; i < 10000; i++)
+            {
+                counter.inc();
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    counter.inc(0, 5);
+    auto text = metrics.render();
+    EXPECT_NE(text.find("# TYPE test_threads_total counter\ntest_threads_total 40005\n"), std::string::npos);
+}
+
+// A labelled family only shows the labels that counted, out of range labels are ignored
+TEST(MetricsTest, LabelledCounter) {
+    auto& metrics = Metrics::instance();
+    auto counter = metrics.counter("test_commands_total", "Per command", "command", 256,
+                                   [](size_t value) { return "0x" + std::to_string(value); });
+    counter.inc(7);
+    counter.inc(7);
+    counter.inc(256);
+    auto text = metrics.render();
+    EXPECT_NE(text.find("test_commands_total{command=\"0x7\"} 2\n"), std::string::npos);
+    EXPECT_EQ(text.find("test_commands_total{command=\"0x8\"}"), std::string::npos);
+
+    // registering again hands out the same counters
+    metrics.counter("test_commands_total", "Per command", "command", 256).inc(7);
+    EXPECT_NE(metrics.render().find("test_commands_total{command=\"0x7\"} 3\n"), std::string::npos);
+}
+
+// Histograms come out cumulative in seconds, with sum and count
+TEST(MetricsTest, Histogram) {
+    auto& metrics = Metrics::instance();
+    auto& histogram = metrics.histogram("test_call_seconds", "Call latency", "method", "Connect");
+    EXPECT_EQ(&histogram, &metrics.histogram("test_call_seconds", "Call latency", "method", "Connect"));
+    histogram.record(50);        // 50 us
+    histogram.record(2000);      // 2 ms
+    histogram.record(20000000);  // 20 s, beyond the largest bound
+    auto& gauge = metrics.gauge("test_depth", "Queue depth");
+    gauge = 3;
+    auto& timed = metrics.histogram("test_timer_seconds", "Timed calls");
+    try
+    {
+        Metrics::Timer timer(timed, &gauge);
+        EXPECT_EQ(gauge.load(), 4);
+        throw std::runtime_error("call failed");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    auto text = metrics.render();
+    EXPECT_NE(text.find("# TYPE test_call_seconds histogram\n"), std::string::npos);
+    EXPECT_NE(text.find("test_call_seconds_bucket{method=\"Connect\",le=\"0.0001\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("test_call_seconds_bucket{method=\"Connect\",le=\"0.0025\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("test_call_seconds_bucket{method=\"Connect\",le=\"10\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("test_call_seconds_bucket{method=\"Connect\",le=\"+Inf\"} 3\n"), std::string::npos);
+    EXPECT_NE(text.find("test_call_seconds_bucket{method=\"Connect\",le=\"1e-05\"} 0\n"), std::string::npos);
+    EXPECT_NE(text.find("test_call_seconds_sum{method=\"Connect\"} 20.00205\n"), std::string::npos);
+    EXPECT_NE(text.find("test_call_seconds_count{method=\"Connect\"} 3\n"), std::string::npos);
+    // a timer left by an exception still records and leaves the in-flight gauge as it was
+    EXPECT_NE(text.find("test_timer_seconds_count 1\n"), std::string::npos);
+    EXPECT_NE(text.find("test_depth 3\n"), std::string::npos);
+}
+
+// A scrape over the Unix socket gets the rendered text, other paths a 404
+TEST(MetricsTest, ServeUnixSocket) {
+    Metrics::instance().counter("test_scraped_total", "Seen by a scrape").inc();
+    const std::string path = "/tmp/test_metrics_" + std::to_string(getpid()) + ".sock";
+    MetricsServer server("unix:" + path);
+
+    auto get = [&](const std::string& request) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+        EXPECT_EQ(write(fd, request.data(), request.size()), static_cast<ssize_t>(request.size()));
+        std::string response;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            response.append(buffer, n);
+        }
+        close(fd);
+        return response;
+    };
+
+    auto response = get("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    EXPECT_EQ(response.compare(0, 15, "HTTP/1.0 200 OK"), 0);
+    EXPECT_NE(response.find("test_scraped_total 1\n"), std::string::npos);
+    EXPECT_EQ(get("GET / HTTP/1.1\r\n\r\n").compare(0, 12, "HTTP/1.0 404"), 0);
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <unistd.h>
+#include "mqtt_spool.h"
+
+static std::string spool_path(const char* name)
+{
+    auto path = std::string("/tmp/test_spool_") + name + "_" + std::to_string(getpid()) + ".bin";
+    std::remove(path.c_str());
+    return path;
+}
+
+static MqttSpool::Message message(const std::string& topic, const std::string& payload)
+{
+    return MqttSpool::Message{topic, payload, 1, true};
+}
+
+// A newer state for a topic replaces the spooled one and moves it to the back
+TEST(MqttSpoolTest, LatestPerTopic) {
+    auto path = spool_path("latest");
+    MqttSpool spool(path, 4096);
+    EXPECT_TRUE(spool.empty());
+    spool.push(message("light/1", "{\"state\":\"ON\"}"));
+    spool.push(message("light/2", "{\"state\":\"ON\"}"));
+    spool.push(message("light/1", "{\"state\":\"OFF\"}"));
+    EXPECT_EQ(spool.size(), 2u);
+
+    MqttSpool::Message front;
+    ASSERT_TRUE(spool.front(front));
+    EXPECT_EQ(front.topic, "light/2");
+    spool.pop();
+    ASSERT_TRUE(spool.front(front));
+    EXPECT_EQ(front.topic, "light/1");
+    EXPECT_EQ(front.payload, "{\"state\":\"OFF\"}");
+    EXPECT_EQ(front.qos, 1);
+    EXPECT_TRUE(front.retained);
+    spool.pop();
+    EXPECT_FALSE(spool.front(front));
+    std::remove(path.c_str());
+}
+
+// What is spooled when the process ends is there after a restart
+TEST(MqttSpoolTest, Reopen) {
+    auto path = spool_path("reopen");
+    {
+        MqttSpool spool(path, 4096);
+        spool.push(message("a", "1"));
+        spool.push(message("b", "2"));
+        spool.push(message("a", "3"));
+        spool.pop();
+    }
+    {
+        MqttSpool spool(path, 4096);
+        EXPECT_EQ(spool.size(), 1u);
+        MqttSpool::Message front;
+        ASSERT_TRUE(spool.front(front));
+        EXPECT_EQ(front.topic, "a");
+        EXPECT_EQ(front.payload, "3");
+        // replacing a message that was spooled by the earlier run
+        spool.push(message("a", "4"));
+        EXPECT_EQ(spool.size(), 1u);
+    }
+    // another capacity starts over
+    MqttSpool resized(path, 8192);
+    EXPECT_TRUE(resized.empty());
+    std::remove(path.c_str());
+}
+
+// Updates to a few topics never push anything out, a full ring drops the oldest topic
+TEST(MqttSpoolTest, CompactAndDrop) {
+    auto path = spool_path("compact");
+    MqttSpool spool(path, 1024);
+    for (int i = 0; i < 1000; i++)
+    {
+        ASSERT_TRUE(spool.push(message("light/" + std::to_string(i % 5), std::string(40, 'a' + i % 26))));
+    }
+    EXPECT_EQ(spool.size(), 5u);
+    EXPECT_EQ(spool.getDropped(), 0u);
+
+    for (int i = 5; i < 40; i++)
+    {
+        spool.push(message("light/" + std::to_string(i), std::string(40, 'x')));
+    }
+    EXPECT_GT(spool.getDropped(), 0u);
+    EXPECT_EQ(spool.size() + spool.getDropped(), 40u);
+    MqttSpool::Message front;
+    ASSERT_TRUE(spool.front(front));
+    EXPECT_EQ(front.topic, "light/" + std::to_string(spool.getDropped()));
+
+    EXPECT_FALSE(spool.push(message("huge", std::string(1024, 'x'))));
+    std::remove(path.c_str());
+}
+
+// Random pushes, pops and reopens behave like a list of the latest message per topic, overflow drops its front
+static void run_model(size_t capacity)
+{
+    auto path = spool_path("model");
+    std::mt19937 random(7);
+    auto spool = std::make_unique<MqttSpool>(path, capacity);
+    std::deque<MqttSpool::Message> model;
+    for (int i = 0; i < 20000; i++)
+    {
+        auto action = random() % 10;
+        if (action < 6)
+        {
+            auto msg = message("t/" + std::to_string(random() % 50), std::string(random() % 200, 'a' + random() % 26));
+            for (auto it = model.begin(); it != model.end(); ++it)
+            {
+                if (it->topic == msg.topic)
+                {
+                    model.erase(it);
+                    break;
+                }
+            }
+            model.push_back(msg);
+            spool->push(msg);
+            while (model.size() > spool->size())
+            {
+                model.pop_front();
+            }
+        }
+        else if (action < 9)
+        {
+            MqttSpool::Message front;
+            ASSERT_EQ(spool->front(front), !model.empty());
+            if (!model.empty())
+            {
+                ASSERT_EQ(front.topic, model.front().topic);
+                ASSERT_EQ(front.payload, model.front().payload);
+                model.pop_front();
+                spool->pop();
+            }
+        }
+        else if (i % 100 == 0)
+        {
+            spool.reset();
+            spool = std::make_unique<MqttSpool>(path, capacity);
+        }
+        ASSERT_EQ(spool->size(), model.size());
+    }
+    spool.reset();
+    std::remove(path.c_str());
+}
+
+TEST(MqttSpoolTest, MatchesModel) {
+    run_model(64 * 1024);
+    run_model(2048);
+}
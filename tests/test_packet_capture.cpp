@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "packet_capture.h"
+
+namespace {
+
+struct Block
+{
+    uint32_t type;
+    std::vector<uint8_t> body; // between the two length fields
+};
+
+uint32_t u32(const uint8_t* data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+std::vector<Block> read_blocks(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<Block> blocks;
+    size_t offset = 0;
+    while (offset + 12 <= bytes.size())
+    {
+        uint32_t type = u32(&bytes[offset]);
+        uint32_t length = u32(&bytes[offset + 4]);
+        EXPECT_EQ(length % 4, 0u);
+        EXPECT_EQ(u32(&bytes[offset + length - 4]), length);
+        blocks.push_back({type, std::vector<uint8_t>(bytes.begin() + offset + 8, bytes.begin() + offset + length - 4)});
+        offset += length;
+    }
+    EXPECT_EQ(offset, bytes.size());
+    return blocks;
+}
+
+}
+
+// Section header, two interfaces, then one enhanced packet block per capture
+TEST(PacketCaptureTest, WritesPcapng) {
+    const std::string path = testing::TempDir() + "capture_test.pcapng";
+    const uint8_t encrypted[20] = {0xAA, 0xBB, 0xCC};
+    const uint8_t decrypted[20] = {0x01, 0x02, 0x03};
+    {
+        PacketCapture capture(path);
+        capture.capture(PacketCapture::ENCRYPTED, PacketCapture::OUTBOUND, "A4:C1:38:00:00:01", encrypted, sizeof(encrypted));
+        capture.capture(PacketCapture::DECRYPTED, PacketCapture::INBOUND, "A4:C1:38:00:00:01", decrypted, sizeof(decrypted));
+        EXPECT_EQ(capture.getDropped(), 0u);
+    }
+
+    auto blocks = read_blocks(path);
+    ASSERT_EQ(blocks.size(), 5u);
+    EXPECT_EQ(blocks[0].type, 0x0A0D0D0Au);
+    EXPECT_EQ(u32(blocks[0].body.data()), 0x1A2B3C4Du);
+    EXPECT_EQ(blocks[1].type, 1u);
+    EXPECT_EQ(blocks[1].body[0], PacketCapture::link_type);
+    EXPECT_EQ(blocks[2].type, 1u);
+
+    const auto& tx = blocks[3];
+    EXPECT_EQ(tx.type, 6u);
+    EXPECT_EQ(u32(&tx.body[0]), static_cast<uint32_t>(PacketCapture::ENCRYPTED));
+    EXPECT_EQ(u32(&tx.body[12]), 20u);
+    EXPECT_EQ(std::memcmp(&tx.body[20], encrypted, 20), 0);
+    // comment option with the address, then epb_flags
+    EXPECT_EQ(tx.body[40], 1);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(&tx.body[44]), 17), "A4:C1:38:00:00:01");
+    EXPECT_EQ(tx.body[64], 2);
+    EXPECT_EQ(u32(&tx.body[68]), static_cast<uint32_t>(PacketCapture::OUTBOUND));
+
+    const auto& rx = blocks[4];
+    EXPECT_EQ(u32(&rx.body[0]), static_cast<uint32_t>(PacketCapture::DECRYPTED));
+    EXPECT_EQ(u32(&rx.body[68]), static_cast<uint32_t>(PacketCapture::INBOUND));
+
+    // timestamps never go backwards
+    uint64_t first = (static_cast<uint64_t>(u32(&tx.body[4])) << 32) | u32(&tx.body[8]);
+    uint64_t second = (static_cast<uint64_t>(u32(&rx.body[4])) << 32) | u32(&rx.body[8]);
+    EXPECT_LE(first, second);
+    EXPECT_GT(first, 1500000000000000ull); // anchored to the wall clock
+
+    std::remove(path.c_str());
+}
+
+// A full file is rotated and the new one starts with its own headers
+TEST(PacketCaptureTest, Rotates) {
+    const std::string path = testing::TempDir() + "capture_rotate.pcapng";
+    const uint8_t packet[20] = {};
+    {
+        PacketCapture capture(path, 1024);
+        for (int i = 0; i < 40; i++)
+        {
+            capture.capture(PacketCapture::DECRYPTED, PacketCapture::INBOUND, "A4:C1:38:00:00:01", packet, sizeof(packet));
+            capture.flush();
+        }
+    }
+
+    auto previous = read_blocks(path + ".1");
+    auto current = read_blocks(path);
+    ASSERT_FALSE(previous.empty());
+    ASSERT_FALSE(current.empty());
+    EXPECT_EQ(current[0].type, 0x0A0D0D0Au);
+
+    std::remove(path.c_str());
+    std::remove((path + ".1").c_str());
+}
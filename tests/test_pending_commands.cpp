@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <glib.h>
+#include "pending_commands.h"
+
+// Later commands for a held node merge, a color replaces a color temperature
+TEST(PendingCommandsTest, MergesIntoOnePacket) {
+    TimerWheel wheel;
+    PendingCommands pending(wheel, 300);
+
+    LightCommand first;
+    first.on = true;
+    first.color_temp = 250;
+    pending.hold(5, first);
+    LightCommand second;
+    second.brightness = 40;
+    second.rgb = std::array<uint8_t,3>{10, 20, 30};
+    pending.hold(5, second);
+    EXPECT_EQ(pending.size(), 1u);
+
+    auto command = pending.take(5);
+    ASSERT_TRUE(command);
+    EXPECT_FALSE(command->color_temp);
+    EXPECT_EQ(command->packets(5).size(), 3u);
+
+    auto packet = std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkLightSetAttributes>(command->coalesced(5));
+    ASSERT_TRUE(packet);
+    EXPECT_EQ(packet->getDestNode(), 5);
+    EXPECT_EQ(packet->get_brightness(), 40);
+    EXPECT_EQ(packet->get_red(), 10);
+    EXPECT_EQ(packet->get_blue(), 30);
+
+    // handed over once
+    EXPECT_FALSE(pending.take(5));
+    EXPECT_EQ(pending.size(), 0u);
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+// Off wins over the attributes, a bare on stays an on/off packet
+TEST(PendingCommandsTest, CoalescesState) {
+    LightCommand command;
+    command.brightness = 80;
+    command.on = false;
+    auto off = std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkLightOnOff>(command.coalesced(7));
+    ASSERT_TRUE(off);
+    EXPECT_EQ(off->get_on_off(), 0);
+
+    LightCommand on;
+    on.on = true;
+    auto packet = std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkLightOnOff>(on.coalesced(7));
+    ASSERT_TRUE(packet);
+    EXPECT_EQ(packet->get_on_off(), 1);
+
+    EXPECT_FALSE(LightCommand().coalesced(7));
+}
+
+// Attributes after a held off turn the light on, as they would sent live
+TEST(PendingCommandsTest, AttributesAfterOff) {
+    TimerWheel wheel;
+    PendingCommands pending(wheel, 300);
+
+    LightCommand off;
+    off.on = false;
+    pending.hold(3, off);
+    LightCommand dim;
+    dim.brightness = 80;
+    pending.hold(3, dim);
+
+    auto command = pending.take(3);
+    ASSERT_TRUE(command);
+    auto packet = std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkLightSetAttributes>(command->coalesced(3));
+    ASSERT_TRUE(packet);
+    EXPECT_EQ(packet->get_brightness(), 80);
+
+    // a state in the same message still wins
+    dim.on = false;
+    pending.hold(3, dim);
+    auto still_off = std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkLightOnOff>(pending.take(3)->coalesced(3));
+    ASSERT_TRUE(still_off);
+    EXPECT_EQ(still_off->get_on_off(), 0);
+}
+
+// A held command expires unless a newer one restarts its time to live
+TEST(PendingCommandsTest, Expires) {
+    TimerWheel wheel;
+    PendingCommands pending(wheel, 10);
+    LightCommand command;
+    command.on = true;
+
+    pending.hold(1, command);
+    pending.hold(2, command);
+    wheel.advance(8);
+    pending.hold(2, command);
+    wheel.advance(2);
+    EXPECT_FALSE(pending.take(1));
+    EXPECT_EQ(pending.getExpired(), 1u);
+    EXPECT_EQ(pending.size(), 1u);
+
+    wheel.advance(7);
+    EXPECT_TRUE(pending.take(2));
+
+    // the node can be held for again after it expired
+    pending.hold(1, command);
+    EXPECT_TRUE(pending.take(1));
+}
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "session_log.h"
+
+namespace {
+
+SessionLog::Record mqtt_record(uint64_t time_us, const std::string& topic, const std::string& payload)
+{
+    SessionLog::Record record;
+    record.time_us = time_us;
+    record.kind = SessionLog::MQTT_IN;
+    record.qos = 1;
+    record.retained = true;
+    record.topic = topic;
+    record.payload = payload;
+    return record;
+}
+
+SessionLog::Record mesh_record(uint64_t time_us, uint8_t channel)
+{
+    SessionLog::Record record;
+    record.time_us = time_us;
+    record.kind = SessionLog::MESH_RX;
+    record.channel = channel;
+    for (int i = 0; i < 20; i++)
+    {
+        record.payload.push_back(static_cast<char>(i * 7));
+    }
+    return record;
+}
+
+}
+
+// What is written comes back in order, with its timing
+TEST(SessionLogTest, RoundTrip) {
+    const std::string path = testing::TempDir() + "session_roundtrip.tmr";
+    {
+        SessionLog::Writer writer(path);
+        writer.write(mqtt_record(1000, "homeassistant/light/5/set", "{\"state\":\"ON\"}"));
+        writer.write(mesh_record(1500, 2));
+        writer.write(mqtt_record(3000000, "homeassistant/light/6/set", ""));
+        EXPECT_EQ(writer.getRecords(), 3u);
+    }
+
+    SessionLog::Reader reader(path);
+    SessionLog::Record record;
+
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_EQ(record.kind, SessionLog::MQTT_IN);
+    EXPECT_EQ(record.time_us, 1000u);
+    EXPECT_EQ(record.topic, "homeassistant/light/5/set");
+    EXPECT_EQ(record.payload, "{\"state\":\"ON\"}");
+    EXPECT_EQ(record.qos, 1);
+    EXPECT_TRUE(record.retained);
+
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_EQ(record.kind, SessionLog::MESH_RX);
+    EXPECT_EQ(record.time_us, 1500u);
+    EXPECT_EQ(record.channel, 2);
+    EXPECT_EQ(record.payload, mesh_record(0, 0).payload);
+
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_EQ(record.time_us, 3000000u);
+    EXPECT_EQ(record.payload, "");
+
+    EXPECT_FALSE(reader.next(record));
+    EXPECT_FALSE(reader.isTruncated());
+
+    // magic, then delta/kind/flags/lengths around the bytes themselves, a notification costs 25 here
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(bytes.size(), 4u + (2 + 1 + 1 + 1 + 25 + 1 + 14) + (2 + 1 + 1 + 1 + 20) + (4 + 1 + 1 + 1 + 25 + 1));
+
+    std::remove(path.c_str());
+}
+
+// A file cut short by a crash keeps its complete records
+TEST(SessionLogTest, TruncatedTail) {
+    const std::string path = testing::TempDir() + "session_truncated.tmr";
+    {
+        SessionLog::Writer writer(path);
+        writer.write(mesh_record(10, 0));
+        writer.write(mesh_record(20, 0));
+    }
+    std::vector<char> bytes;
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), bytes.size() - 5);
+    }
+
+    SessionLog::Reader reader(path);
+    SessionLog::Record record;
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_EQ(record.time_us, 10u);
+    EXPECT_FALSE(reader.next(record));
+    EXPECT_TRUE(reader.isTruncated());
+
+    std::remove(path.c_str());
+}
+
+// Records stamped out of order never produce a negative delta
+TEST(SessionLogTest, ClampsTime) {
+    const std::string path = testing::TempDir() + "session_clamp.tmr";
+    {
+        SessionLog::Writer writer(path);
+        writer.write(mesh_record(500, 0));
+        writer.write(mesh_record(100, 1));
+    }
+
+    SessionLog::Reader reader(path);
+    SessionLog::Record record;
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_EQ(record.time_us, 500u);
+    EXPECT_EQ(record.channel, 1);
+
+    std::remove(path.c_str());
+}
+
+TEST(SessionLogTest, RejectsOtherFiles) {
+    const std::string path = testing::TempDir() + "session_other.tmr";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "not a session";
+    }
+    EXPECT_THROW(SessionLog::Reader reader(path), std::runtime_error);
+    std::remove(path.c_str());
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include "spsc_queue.h"
+
+// FIFO order, full and empty detection
+TEST(SpscQueueTest, PushPopInOrder) {
+    SpscQueue<int,4> queue;
+    int value = 0;
+
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.pop(value));
+
+    EXPECT_TRUE(queue.push(1));
+    EXPECT_TRUE(queue.push(2));
+    EXPECT_TRUE(queue.push(3));
+    EXPECT_FALSE(queue.push(4)); // capacity is 3
+
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(value, 1);
+    EXPECT_TRUE(queue.push(4));
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(value, 2);
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(value, 3);
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(value, 4);
+    EXPECT_TRUE(queue.empty());
+}
+
+// Popped slots release what they held
+TEST(SpscQueueTest, PopReleasesSlot) {
+    SpscQueue<std::shared_ptr<int>,4> queue;
+    auto item = std::make_shared<int>(7);
+
+    EXPECT_TRUE(queue.push(item));
+    std::shared_ptr<int> out;
+    EXPECT_TRUE(queue.pop(out));
+    out.reset();
+    EXPECT_EQ(item.use_count(), 1);
+}
+
+// Peeking looks past the front without consuming, also across the wrap
+TEST(SpscQueueTest, PeekDoesNotConsume) {
+    SpscQueue<int,4> queue;
+    int value = 0;
+    EXPECT_EQ(queue.peek(0), nullptr);
+
+    queue.push(1);
+    queue.push(2);
+    queue.pop(value);
+    queue.push(3);
+    queue.push(4);  // wraps to the first slot
+    ASSERT_NE(queue.peek(2), nullptr);
+    EXPECT_EQ(*queue.peek(0), 2);
+    EXPECT_EQ(*queue.peek(2), 4);
+    EXPECT_EQ(queue.peek(3), nullptr);
+
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(value, 2);
+}
+
+// One producer and one consumer thread see every item exactly once, in order
+TEST(SpscQueueTest, ProducerConsumerThreads) {
+    SpscQueue<uint32_t,64> queue;
+    const uint32_t count = 200000;
+
+    std::thread producer([&queue,count]() {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            while (!queue.push(i)) { std::this_thread::yield(); }
+        }
+    });
+
+    uint32_t expected = 0;
+    uint32_t value = 0;
+    while (expected < count)
+    {
+        if (queue.pop(value))
+        {
+            ASSERT_EQ(value, expected);
+            expected++;
+        }
+    }
+    producer.join();
+    EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "task.h"
+
+using BleTask::CancelToken;
+using BleTask::Task;
+using BleTask::TaskScope;
+
+// Hand-driven awaitable, stands in for an asynchronous call
+struct Trigger
+{
+    std::coroutine_handle<> waiting;
+    int value = 0;
+
+    struct Awaiter
+    {
+        Trigger& trigger;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { trigger.waiting = handle; }
+        int await_resume() const { return trigger.value; }
+    };
+
+    Awaiter operator co_await() { return Awaiter{*this}; }
+
+    void fire(int result)
+    {
+        value = result;
+        auto handle = std::exchange(waiting, nullptr);
+        handle.resume();
+    }
+};
+
+Task<int> add_one(Trigger& trigger)
+{
+    int value = co_await trigger;
+    co_return value + 1;
+}
+
+Task<void> twice(Trigger& trigger, std::string& log)
+{
+    int first = co_await add_one(trigger);
+    int second = co_await add_one(trigger);
+    log = std::to_string(first) + "," + std::to_string(second);
+}
+
+// Nested tasks resume their caller with the result
+TEST(TaskTest, AwaitNestedTasks) {
+    Trigger trigger;
+    std::string log;
+    TaskScope scope;
+
+    scope.spawn(twice(trigger, log));
+    EXPECT_EQ(scope.size(), 1u);
+    trigger.fire(1);
+    EXPECT_TRUE(log.empty());
+    trigger.fire(5);
+    EXPECT_EQ(log, "2,6");
+    EXPECT_EQ(scope.size(), 0u);
+}
+
+Task<int> failing()
+{
+    throw std::runtime_error("boom");
+    co_return 0;
+}
+
+Task<void> catching(std::string& log)
+{
+    try
+    {
+        co_await failing();
+    }
+    catch (const std::exception& e)
+    {
+        log = e.what();
+    }
+}
+
+// Exceptions travel to the awaiting coroutine, uncaught ones reach the scope
+TEST(TaskTest, ExceptionsPropagate) {
+    std::string log;
+    std::string reported;
+    TaskScope scope([&reported](const std::exception& e) { reported = e.what(); });
+
+    scope.spawn(catching(log));
+    EXPECT_EQ(log, "boom");
+    EXPECT_TRUE(reported.empty());
+
+    scope.spawn([]() -> Task<void> { co_await failing(); }());
+    EXPECT_EQ(reported, "boom");
+}
+
+// Move-only results are handed over
+TEST(TaskTest, MoveOnlyResult) {
+    Trigger trigger;
+    int result = 0;
+    TaskScope scope;
+
+    // coroutine lambdas take parameters, captures would dangle once suspended
+    scope.spawn([](Trigger& trigger, int& result) -> Task<void> {
+        auto make = [](Trigger& trigger) -> Task<std::unique_ptr<int>> {
+            auto value = std::make_unique<int>(co_await trigger);
+            co_return std::move(value);
+        };
+        auto value = co_await make(trigger);
+        result = *value;
+    }(trigger, result));
+    trigger.fire(42);
+    EXPECT_EQ(result, 42);
+}
+
+// Destroying the scope destroys suspended frames and their locals
+TEST(TaskTest, ScopeDestroysSuspendedTasks) {
+    Trigger trigger;
+    auto resource = std::make_shared<int>(0);
+    bool finished = false;
+
+    {
+        TaskScope scope;
+        scope.spawn([](Trigger& trigger, [[maybe_unused]] std::shared_ptr<int> held, bool& finished) -> Task<void> {
+            co_await trigger;
+            finished = true;
+        }(trigger, resource, finished));
+        EXPECT_EQ(resource.use_count(), 2);
+    }
+
+    EXPECT_EQ(resource.use_count(), 1);
+    EXPECT_FALSE(finished);
+}
+
+// Cancel runs registered callbacks once, later registrations run at once
+TEST(TaskTest, CancelToken) {
+    CancelToken token;
+    CancelToken copy = token;
+    int woken = 0;
+
+    auto forgotten = token.on_cancel([&woken]() { woken += 10; });
+    token.on_cancel([&woken]() { woken++; });
+    token.forget(forgotten);
+
+    copy.cancel();
+    EXPECT_TRUE(token.cancelled());
+    EXPECT_EQ(woken, 1);
+    copy.cancel();
+    EXPECT_EQ(woken, 1);
+
+    token.on_cancel([&woken]() { woken++; });
+    EXPECT_EQ(woken, 2);
+}
+
+// Cancelling a scope leaves the tokens of later tasks untouched
+TEST(TaskTest, ScopeCancelRenewsToken) {
+    TaskScope scope;
+    auto before = scope.token();
+    scope.cancel();
+    EXPECT_TRUE(before.cancelled());
+    EXPECT_FALSE(scope.token().cancelled());
+}
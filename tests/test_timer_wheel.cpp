@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "timer_wheel.h"
+
+// Timer fires exactly at its expiry tick
+TEST(TimerWheelTest, FiresAtDeadline) {
+    TimerWheel wheel;
+    int fired = 0;
+    TimerWheel::Timer timer([&fired]() { fired++; });
+
+    wheel.schedule(timer, 10);
+    wheel.advance(9);
+    EXPECT_EQ(fired, 0);
+    EXPECT_TRUE(timer.isPending());
+    wheel.advance(1);
+    EXPECT_EQ(fired, 1);
+    EXPECT_FALSE(timer.isPending());
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+// Timers beyond the first level cascade down and still fire on time
+TEST(TimerWheelTest, CascadesHigherLevels) {
+    TimerWheel wheel;
+    std::vector<uint64_t> deadlines = {63, 64, 65, 127, 4095, 4096, 4161, 300000};
+    std::vector<uint64_t> fired_at;
+    std::vector<std::unique_ptr<TimerWheel::Timer>> timers;
+
+    wheel.advance(5); // start off a slot boundary
+    for (auto deadline : deadlines)
+    {
+        timers.push_back(std::make_unique<TimerWheel::Timer>([&wheel,&fired_at]() { fired_at.push_back(wheel.now()); }));
+        wheel.schedule(*timers.back(), deadline);
+    }
+
+    wheel.advance(300000);
+    ASSERT_EQ(fired_at.size(), deadlines.size());
+    for (size_t i = 0; i < deadlines.size(); i++)
+    {
+        EXPECT_EQ(fired_at[i], deadlines[i] + 5);
+    }
+}
+
+// Rescheduling pushes the deadline out instead of adding a second timer
+TEST(TimerWheelTest, RescheduleMovesDeadline) {
+    TimerWheel wheel;
+    int fired = 0;
+    TimerWheel::Timer timer([&fired]() { fired++; });
+
+    wheel.schedule(timer, 10);
+    wheel.advance(8);
+    wheel.schedule(timer, 10);
+    EXPECT_EQ(wheel.size(), 1u);
+    wheel.advance(9);
+    EXPECT_EQ(fired, 0);
+    wheel.advance(1);
+    EXPECT_EQ(fired, 1);
+}
+
+// Cancelled and destroyed timers never fire
+TEST(TimerWheelTest, CancelAndDestroy) {
+    TimerWheel wheel;
+    int fired = 0;
+    TimerWheel::Timer timer([&fired]() { fired++; });
+    wheel.schedule(timer, 3);
+    timer.cancel();
+
+    {
+        TimerWheel::Timer scoped([&fired]() { fired++; });
+        wheel.schedule(scoped, 3);
+    }
+
+    EXPECT_EQ(wheel.size(), 0u);
+    wheel.advance(10);
+    EXPECT_EQ(fired, 0);
+}
+
+// A callback may re-arm its own timer (periodic timers)
+TEST(TimerWheelTest, RearmFromCallback) {
+    TimerWheel wheel;
+    int fired = 0;
+    TimerWheel::Timer timer;
+    timer.setCallback([&]() { if (++fired < 3) { wheel.schedule(timer, 100); } });
+
+    wheel.schedule(timer, 100);
+    wheel.advance(1000);
+    EXPECT_EQ(fired, 3);
+    EXPECT_FALSE(timer.isPending());
+}
@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+#include <glib.h>
+#include <map>
+#include <vector>
+#include "crypto.h"
+#include "virtual_mesh.h"
+#include "telink_mesh_protocol.h"
+
+namespace {
+
+// runs scheduled work in due order on a virtual clock
+struct ManualClock
+{
+    uint64_t now_ms = 0;
+    std::multimap<uint64_t,std::function<void()>> pending;
+
+    VirtualMesh::Scheduler scheduler()
+    {
+        return [this](uint32_t delay_ms, std::function<void()> fn) { pending.emplace(now_ms + delay_ms, fn); };
+    }
+
+    void run_until(uint64_t until_ms)
+    {
+        while (!pending.empty() && pending.begin()->first <= until_ms)
+        {
+            auto it = pending.begin();
+            now_ms = it->first;
+            auto fn = it->second;
+            pending.erase(it);
+            fn();
+        }
+        now_ms = until_ms;
+    }
+};
+
+// the gateway's side of a connection, as TelinkMesh::ConnectedDevice does it
+struct Gateway
+{
+    VirtualMesh& mesh;
+    uint32_t session;
+    std::vector<uint8_t> macdata;
+    std::vector<uint8_t> shared_key;
+    std::vector<std::pair<uint64_t,std::vector<uint8_t>>> received;
+    uint16_t seq = 1;
+
+    Gateway(VirtualMesh& mesh, ManualClock& clock, size_t proxy)
+        : mesh(mesh)
+    {
+        session = mesh.connect(proxy, [this, &clock](const std::vector<uint8_t>& data) {
+            received.push_back({clock.now_ms, crypto::decrypt_packet(shared_key, macdata, data)});
+        });
+        const auto& address = mesh.getNodes()[proxy].address;
+        for (int i = 5; i >= 0; i--)
+        {
+            macdata.push_back(static_cast<uint8_t>(std::stoul(address.substr(i * 3, 2), nullptr, 16)));
+        }
+    }
+
+    bool pair(const std::string& name, const std::string& password)
+    {
+        auto random = crypto::get_random_bytes(8);
+        std::vector<uint8_t> data(random);
+        data.resize(16, 0x00);
+        auto encrypted = crypto::key_encrypt(name, password, data);
+        std::vector<uint8_t> request = {0x0c};
+        request.insert(request.end(), random.begin(), random.end());
+        request.insert(request.end(), encrypted.begin(), encrypted.begin() + 8);
+        mesh.writePairing(session, request);
+
+        auto response = mesh.readPairing(session);
+        if (response.size() < 9 || response[0] != 0x0d)
+        {
+            return false;
+        }
+        shared_key = crypto::generate_sk(name, password, random, std::vector<uint8_t>(response.begin() + 1, response.begin() + 9));
+        mesh.writeNotify(session, {0x01});
+        return true;
+    }
+
+    std::vector<uint8_t> encrypt(std::shared_ptr<TelinkMeshProtocol::TelinkMeshPacket> packet)
+    {
+        packet->setSeq(seq++);
+        packet->setVendorCode(0x0211);
+        return crypto::encrypt_packet(shared_key, macdata, packet->getData());
+    }
+};
+
+VirtualMesh::Config small_mesh()
+{
+    VirtualMesh::Config config;
+    config.name = "testmesh";
+    config.password = "secret";
+    config.nodes = 64;
+    config.relay_latency_ms = 20;
+    config.latency_jitter_ms = 0;
+    config.range_nodes = 16;
+    return config;
+}
+
+}
+
+// Pairing with the gateway's crypto yields a session key both sides agree on
+TEST(VirtualMeshTest, PairsAndAnswers) {
+    ManualClock clock;
+    VirtualMesh mesh(small_mesh(), clock.scheduler());
+    Gateway gateway(mesh, clock, 0);
+    ASSERT_TRUE(gateway.pair("testmesh", "secret"));
+
+    auto query = std::make_shared<TelinkMeshProtocol::TelinkLightStatusQuery>();
+    query->setDestNode(5);
+    query->setMode(0x10);
+    ASSERT_TRUE(mesh.writeCommand(gateway.session, gateway.encrypt(query)));
+    clock.run_until(1000);
+
+    ASSERT_EQ(gateway.received.size(), 1u);
+    auto report = TelinkMeshProtocol::TelinkMeshPacket::create(gateway.received[0].second);
+    EXPECT_EQ(report->getCommand(), TelinkMeshProtocol::Command::COMMAND_STATUS_REPORT);
+    EXPECT_EQ(report->getSrcNode(), 5);
+    // one hop there, one hop back
+    EXPECT_EQ(gateway.received[0].first, 40u);
+    EXPECT_EQ(mesh.getStats().commands, 1u);
+}
+
+// Commands change node state and the node reports it
+TEST(VirtualMeshTest, AppliesCommands) {
+    ManualClock clock;
+    VirtualMesh mesh(small_mesh(), clock.scheduler());
+    Gateway gateway(mesh, clock, 0);
+    ASSERT_TRUE(gateway.pair("testmesh", "secret"));
+
+    auto off = std::make_shared<TelinkMeshProtocol::TelinkLightOnOff>();
+    off->setDestNode(3);
+    off->set_on_off(0);
+    ASSERT_TRUE(mesh.writeCommand(gateway.session, gateway.encrypt(off)));
+    clock.run_until(1000);
+
+    EXPECT_FALSE(mesh.getNodes()[2].on);
+    ASSERT_EQ(gateway.received.size(), 1u);
+    auto report = std::dynamic_pointer_cast<TelinkMeshProtocol::TelinkMeshOnlineStatusReport>(
+        TelinkMeshProtocol::TelinkMeshPacket::create(gateway.received[0].second));
+    ASSERT_TRUE(report);
+    EXPECT_EQ(report->getNodeID(), 3);
+    EXPECT_FALSE(report->isLightOn());
+}
+
+// A wrong password fails pairing, unpaired or tampered packets are rejected
+TEST(VirtualMeshTest, RejectsBadCredentials) {
+    ManualClock clock;
+    VirtualMesh mesh(small_mesh(), clock.scheduler());
+
+    Gateway stranger(mesh, clock, 0);
+    EXPECT_FALSE(stranger.pair("testmesh", "wrong"));
+    EXPECT_EQ(mesh.readPairing(stranger.session)[0], 0x0e);
+
+    Gateway gateway(mesh, clock, 1);
+    ASSERT_TRUE(gateway.pair("testmesh", "secret"));
+    auto query = std::make_shared<TelinkMeshProtocol::TelinkLightStatusQuery>();
+    query->setDestNode(0xFFFF);
+    auto packet = gateway.encrypt(query);
+    packet[12] ^= 0x01;
+    EXPECT_FALSE(mesh.writeCommand(gateway.session, packet));
+    EXPECT_EQ(mesh.getStats().rejected, 1u);
+}
+
+// A broadcast reaches every node, far nodes answer later, every notifying proxy relays the answers
+TEST(VirtualMeshTest, BroadcastLatency) {
+    ManualClock clock;
+    VirtualMesh mesh(small_mesh(), clock.scheduler());
+    Gateway first(mesh, clock, 0);
+    Gateway second(mesh, clock, 63);
+    ASSERT_TRUE(first.pair("testmesh", "secret"));
+    ASSERT_TRUE(second.pair("testmesh", "secret"));
+
+    auto query = std::make_shared<TelinkMeshProtocol::TelinkMeshAddressEdit>();
+    query->setDestNode(0xFFFF);
+    query->setMode(0xFFFF);
+    ASSERT_TRUE(mesh.writeCommand(first.session, first.encrypt(query)));
+    clock.run_until(10000);
+
+    EXPECT_EQ(first.received.size(), 64u);
+    EXPECT_EQ(second.received.size(), 64u);
+    // the connected node answers at once, the farthest one crosses 4 hops each way
+    EXPECT_EQ(first.received.front().first, 0u);
+    EXPECT_EQ(first.received.back().first, 160u);
+}
+
+// Every hop losing everything leaves only the connected node's own answer
+TEST(VirtualMeshTest, Loss) {
+    ManualClock clock;
+    auto config = small_mesh();
+    config.loss = 1.0;
+    VirtualMesh mesh(config, clock.scheduler());
+    Gateway gateway(mesh, clock, 0);
+    ASSERT_TRUE(gateway.pair("testmesh", "secret"));
+
+    auto query = std::make_shared<TelinkMeshProtocol::TelinkLightStatusQuery>();
+    query->setDestNode(0xFFFF);
+    ASSERT_TRUE(mesh.writeCommand(gateway.session, gateway.encrypt(query)));
+    clock.run_until(10000);
+
+    EXPECT_EQ(gateway.received.size(), 1u);
+    EXPECT_EQ(mesh.getStats().lost, 63u);
+}
+
+// Nothing scheduled runs once the mesh is gone
+TEST(VirtualMeshTest, OutlivedByScheduler) {
+    ManualClock clock;
+    auto config = small_mesh();
+    config.report_interval_ms = 1000;
+    {
+        VirtualMesh mesh(config, clock.scheduler());
+    }
+    EXPECT_FALSE(clock.pending.empty());
+    clock.run_until(5000);
+    EXPECT_TRUE(clock.pending.empty());
+}